@@ -2,6 +2,10 @@
 
 #include "sdkconfig.h"
 
+// system includes
+#include <mutex>
+#include <vector>
+
 // esp-idf includes
 #include <esp_log.h>
 
@@ -17,6 +21,26 @@ using namespace std::chrono_literals;
 
 namespace {
 //constexpr const char * const TAG = "CONFIG";
+
+struct Subscription
+{
+    std::function<void()> callback;
+    bool pending;
+};
+
+struct Watch
+{
+    const ConfigWrapperInterface *config;
+    ConfigSubscription subscription;
+};
+
+// only grows during setup, afterwards notifications just flip the pending flags
+std::mutex subscriptionsMutex;
+std::vector<Subscription> subscriptions;
+std::vector<Watch> watches;
+uint32_t batchDepth{};
+
+void deliverPending(std::unique_lock<std::mutex> &lock);
 } // namespace
 
 std::string defaultHostname()
@@ -30,4 +54,60 @@ std::string defaultHostname()
 
 ConfigManager<ConfigContainer> configs;
 
+ConfigSubscription subscribeConfigChanges(std::function<void()> &&callback)
+{
+    std::lock_guard lock{subscriptionsMutex};
+    subscriptions.push_back(Subscription{ .callback = std::move(callback), .pending = false });
+    return subscriptions.size() - 1;
+}
+
+void watchConfig(ConfigSubscription subscription, const ConfigWrapperInterface &config)
+{
+    std::lock_guard lock{subscriptionsMutex};
+    watches.push_back(Watch{ .config = &config, .subscription = subscription });
+}
+
+void notifyConfigChanged(const ConfigWrapperInterface &config)
+{
+    std::unique_lock lock{subscriptionsMutex};
+    for (const auto &watch : watches)
+        if (watch.config == &config)
+            subscriptions[watch.subscription].pending = true;
+
+    if (!batchDepth)
+        deliverPending(lock);
+}
+
+ConfigChangeBatch::ConfigChangeBatch()
+{
+    std::lock_guard lock{subscriptionsMutex};
+    batchDepth++;
+}
+
+ConfigChangeBatch::~ConfigChangeBatch()
+{
+    std::unique_lock lock{subscriptionsMutex};
+    if (!--batchDepth)
+        deliverPending(lock);
+}
+
 INSTANTIATE_CONFIGMANAGER_TEMPLATES(ConfigContainer)
+
+namespace {
+void deliverPending(std::unique_lock<std::mutex> &lock)
+{
+    // the callbacks run unlocked, they may write configs themselves. subscriptions are not removed,
+    // so the indices stay valid. the vector is not supposed to grow after setup
+    for (size_t i = 0; i < subscriptions.size(); i++)
+    {
+        if (!subscriptions[i].pending)
+            continue;
+        subscriptions[i].pending = false;
+
+        const auto &callback = subscriptions[i].callback;
+        lock.unlock();
+        callback();
+        lock.lock();
+    }
+}
+} // namespace
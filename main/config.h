@@ -5,7 +5,9 @@
 // system includes
 #include <string>
 #include <array>
+#include <functional>
 #include <optional>
+#include <utility>
 
 // esp-idf includes
 #include <esp_sntp.h>
@@ -21,6 +23,9 @@
 #include <makearray.h>
 
 // local includes
+#include "espnowfilter.h"
+#include "espnowoutput.h"
+#include "taskmanager.h"
 
 using namespace espconfig;
 
@@ -56,6 +61,22 @@ public:
     ConfigWrapper<wifi_stack::ip_address_t> staticDns2;
 };
 
+class EspNowPeerConfig
+{
+    using mac_t = wifi_stack::mac_t;
+
+public:
+    EspNowPeerConfig(const char *macNvsKey, const char *encryptNvsKey, const char *lmkNvsKey) :
+        mac    {std::nullopt,  DoReset, {},                                              macNvsKey    },
+        encrypt{false,         DoReset, {},                                              encryptNvsKey},
+        lmk    {std::string{}, DoReset, StringOr<StringEmpty, StringMinMaxSize<32, 32>>, lmkNvsKey    }
+    {}
+
+    ConfigWrapper<std::optional<mac_t>> mac;
+    ConfigWrapper<bool> encrypt;
+    ConfigWrapper<std::string> lmk; // 16 byte key as hex
+};
+
 class ConfigContainer
 {
     using mac_t = wifi_stack::mac_t;
@@ -108,6 +129,51 @@ public:
     ConfigWrapper<espchrono::DayLightSavingMode>timeDst{espchrono::DayLightSavingMode::EuropeanSummerTime, DoReset, {},             "time_dst"            };
 
     ConfigWrapper<std::string> otaUrl             {std::string{},                          DoReset,   StringOr<StringEmpty, StringValidUrl>, "otaUrl"   };
+    ConfigWrapper<uint32_t>    otaMaxRate         {0,                                      DoReset,   {},                           "otaMaxRate"          }; // KiB/s, 0 for unlimited, only for .eota containers, see OtaDownloadThrottle
+    ConfigWrapper<bool>        otaP2pAccept       {false,                                  DoReset,   {},                           "otaP2pAccept"        }; // install images offered by configured esp-now peers
+    ConfigWrapper<bool>        otaYieldEspNow     {true,                                   DoReset,   {},                           "otaYieldEspNow"      }; // pause the download while esp-now frames are queued
+
+    ConfigWrapper<bool>        espnowCompression  {false,                                  DoReset,   {},                           "espnowCompress"      };
+    ConfigWrapper<wifi_phy_rate_t> espnowRate     {WIFI_PHY_RATE_1M_L,                     DoReset,   {},                           "espnowRate"          };
+    ConfigWrapper<bool>        espnowAutoRate     {false,                                  DoReset,   {},                           "espnowAutoRate"      }; // adapt the rate to the unicast delivery, espnowRate is the start
+    ConfigWrapper<bool>        espnowLongRange    {false,                                  DoReset,   {},                           "espnowLongRange"     };
+    ConfigWrapper<int8_t>      espnowTxPower      {78,                                     DoReset,   MinMaxValue<int8_t, 8, 84>,   "espnowTxPower"       }; // 0.25dBm steps
+    ConfigWrapper<std::string> espnowPmk          {std::string{},                          DoReset,   StringOr<StringEmpty, StringMinMaxSize<32, 32>>, "espnowPmk" };
+    ConfigWrapper<bool>        espnowRssiCapture  {false,                                  DoReset,   {},                           "espnowRssiCapt"      };
+    ConfigWrapper<uint32_t>    espnowTraceEvery   {64,                                     DoReset,   {},                           "espnowTraceNth"      }; // trace every n-th sent and received frame through the stages, 0 disables
+    ConfigWrapper<espnow::filter::MacMode> espnowRxMacMode{espnow::filter::MacMode::Off,    DoReset,   {},                           "espnowRxMacMode"     };
+    ConfigWrapper<std::string> espnowRxMacs       {std::string{},                          DoReset,   StringMaxSize<320>,           "espnowRxMacs"        }; // up to 16 senders for espnowRxMacMode, separated by commas or spaces
+    ConfigWrapper<bool>        espnowRxOwnOnly    {false,                                  DoReset,   {},                           "espnowRxOwnOnly"     }; // drop frames of other esp-now applications
+    ConfigWrapper<uint32_t>    espnowRxTypes      {0xFFFFFFFF,                             DoReset,   {},                           "espnowRxTypes"       }; // bit n accepts espnow::FrameType n
+    ConfigWrapper<espnow::output::Mode> espnowOutputMode{espnow::output::Mode::Text,       DoReset,   {},                           "espnowOutMode"       };
+    ConfigWrapper<uint32_t>    espnowOutputBaud   {CONFIG_ESP_CONSOLE_UART_BAUDRATE,       DoReset,   MinMaxValue<uint32_t, 9600, 5000000>, "espnowOutBaud" };
+    ConfigWrapper<bool>        espnowBridge       {false,                                  DoReset,   {},                           "espnowBridge"        };
+    ConfigWrapper<std::optional<wifi_stack::mac_t>> espnowBridgePeer{std::nullopt,         DoReset,   {},                           "espnowBrPeer"        }; // broadcast if empty
+    ConfigWrapper<bool>        espnowBridgeLines  {false,                                  DoReset,   {},                           "espnowBrLines"       }; // send at newlines, not only at idle gaps
+    ConfigWrapper<std::optional<wifi_stack::mac_t>> espnowTimeRef{std::nullopt,           DoReset,   {},                           "espnowTimeRef"       }; // node whose clock is the network time, this node is a reference if empty
+    ConfigWrapper<uint32_t>    espnowSyncIntv     {1000,                                   DoReset,   MinMaxValue<uint32_t, 100, 60000>, "espnowSyncIntv" }; // ms between time sync requests
+    ConfigWrapper<bool>        espnowRelay        {false,                                  DoReset,   {},                           "espnowRelay"         }; // rebroadcast relay frames of other nodes
+    ConfigWrapper<uint8_t>     espnowRelayTtl     {4,                                      DoReset,   MinMaxValue<uint8_t, 1, 16>,  "espnowRelayTtl"      }; // hops of frames this node originates
+    ConfigWrapper<uint8_t>     espnowRelayJit     {20,                                     DoReset,   MinMaxValue<uint8_t, 0, 200>, "espnowRelayJit"      }; // max random ms before a rebroadcast
+    std::array<EspNowPeerConfig, 8> espnow_peers {
+        EspNowPeerConfig {"espnowPeerMac0", "espnowPeerEnc0", "espnowPeerLmk0"},
+        EspNowPeerConfig {"espnowPeerMac1", "espnowPeerEnc1", "espnowPeerLmk1"},
+        EspNowPeerConfig {"espnowPeerMac2", "espnowPeerEnc2", "espnowPeerLmk2"},
+        EspNowPeerConfig {"espnowPeerMac3", "espnowPeerEnc3", "espnowPeerLmk3"},
+        EspNowPeerConfig {"espnowPeerMac4", "espnowPeerEnc4", "espnowPeerLmk4"},
+        EspNowPeerConfig {"espnowPeerMac5", "espnowPeerEnc5", "espnowPeerLmk5"},
+        EspNowPeerConfig {"espnowPeerMac6", "espnowPeerEnc6", "espnowPeerLmk6"},
+        EspNowPeerConfig {"espnowPeerMac7", "espnowPeerEnc7", "espnowPeerLmk7"}
+    };
+
+    // task placement, applied when the tasks are created (after a reboot)
+    ConfigWrapper<uint8_t>     radioCore          {WifiCore,                               DoReset,   MinMaxValue<uint8_t, 0, 1>,   "radioCore"           }; // espnowTx and tester, next to the wifi driver
+    ConfigWrapper<uint8_t>     appCore            {1 - WifiCore,                           DoReset,   MinMaxValue<uint8_t, 0, 1>,   "appCore"             }; // httpd, ota, console and espnowOutput
+    ConfigWrapper<uint8_t>     espnowTxPrio       {5,                                      DoReset,   MinMaxValue<uint8_t, 1, 24>,  "espnowTxPrio"        };
+    ConfigWrapper<uint8_t>     espnowOutPrio      {4,                                      DoReset,   MinMaxValue<uint8_t, 1, 24>,  "espnowOutPrio"       };
+    ConfigWrapper<uint8_t>     testerPrio         {5,                                      DoReset,   MinMaxValue<uint8_t, 1, 24>,  "testerPrio"          };
+    ConfigWrapper<uint8_t>     consolePrio        {4,                                      DoReset,   MinMaxValue<uint8_t, 1, 24>,  "consolePrio"         };
+    ConfigWrapper<uint8_t>     httpdPrio          {5,                                      DoReset,   MinMaxValue<uint8_t, 1, 24>,  "httpdPrio"           };
 
     template<typename T>
     void callForEveryConfig(T &&callable)
@@ -164,9 +230,103 @@ public:
         REGISTER_CONFIG(timeDst)
 
         REGISTER_CONFIG(otaUrl)
+        REGISTER_CONFIG(otaMaxRate)
+        REGISTER_CONFIG(otaYieldEspNow)
+        REGISTER_CONFIG(otaP2pAccept)
+
+        REGISTER_CONFIG(espnowCompression)
+        REGISTER_CONFIG(espnowRate)
+        REGISTER_CONFIG(espnowAutoRate)
+        REGISTER_CONFIG(espnowLongRange)
+        REGISTER_CONFIG(espnowTxPower)
+        REGISTER_CONFIG(espnowPmk)
+        REGISTER_CONFIG(espnowRssiCapture)
+        REGISTER_CONFIG(espnowTraceEvery)
+        REGISTER_CONFIG(espnowRxMacMode)
+        REGISTER_CONFIG(espnowRxMacs)
+        REGISTER_CONFIG(espnowRxOwnOnly)
+        REGISTER_CONFIG(espnowRxTypes)
+        REGISTER_CONFIG(espnowOutputMode)
+        REGISTER_CONFIG(espnowOutputBaud)
+        REGISTER_CONFIG(espnowBridge)
+        REGISTER_CONFIG(espnowBridgePeer)
+        REGISTER_CONFIG(espnowBridgeLines)
+        REGISTER_CONFIG(espnowTimeRef)
+        REGISTER_CONFIG(espnowSyncIntv)
+        REGISTER_CONFIG(espnowRelay)
+        REGISTER_CONFIG(espnowRelayTtl)
+        REGISTER_CONFIG(espnowRelayJit)
+
+        for (auto &entry : espnow_peers)
+        {
+            REGISTER_CONFIG(entry.mac)
+            REGISTER_CONFIG(entry.encrypt)
+            REGISTER_CONFIG(entry.lmk)
+        }
+
+        REGISTER_CONFIG(radioCore)
+        REGISTER_CONFIG(appCore)
+        REGISTER_CONFIG(espnowTxPrio)
+        REGISTER_CONFIG(espnowOutPrio)
+        REGISTER_CONFIG(testerPrio)
+        REGISTER_CONFIG(consolePrio)
+        REGISTER_CONFIG(httpdPrio)
 
 #undef REGISTER_API_VALUE
     }
 };
 
 extern ConfigManager<ConfigContainer> configs;
+
+// subsystems subscribe to the configs they derive state from instead of reading them every loop.
+// the callbacks run on the task that wrote the config, they should only hand the change over (a flag, an atomic)
+using ConfigSubscription = size_t;
+
+// meant to be called during setup, subscriptions live forever
+ConfigSubscription subscribeConfigChanges(std::function<void()> &&callback);
+void watchConfig(ConfigSubscription subscription, const ConfigWrapperInterface &config);
+
+template<typename ...T>
+void watchConfigs(ConfigSubscription subscription, const ConfigWrapper<T> &...configs)
+{
+    (watchConfig(subscription, configs), ...);
+}
+
+// the callback gets the new value, called like void(const T &)
+template<typename T, typename F>
+void onConfigChange(const ConfigWrapper<T> &config, F &&callback)
+{
+    watchConfig(subscribeConfigChanges([&config, callback = std::forward<F>(callback)](){ callback(config.value); }), config);
+}
+
+// marks the subscriptions watching the config, they are called right away or when the outermost batch ends
+void notifyConfigChanged(const ConfigWrapperInterface &config);
+
+// collects the notifications of several writes, every subscription is called once for all of them
+class ConfigChangeBatch
+{
+public:
+    ConfigChangeBatch();
+    ~ConfigChangeBatch();
+
+    ConfigChangeBatch(const ConfigChangeBatch &) = delete;
+    ConfigChangeBatch &operator=(const ConfigChangeBatch &) = delete;
+};
+
+template<typename T, typename V>
+tl::expected<void, std::string> writeConfig(ConfigWrapper<T> &config, V &&value)
+{
+    auto result = configs.write_config(config, std::forward<V>(value));
+    if (result)
+        notifyConfigChanged(config);
+    return result;
+}
+
+template<typename T>
+tl::expected<void, std::string> resetConfig(ConfigWrapper<T> &config)
+{
+    auto result = configs.reset_config(config);
+    if (result)
+        notifyConfigChanged(config);
+    return result;
+}
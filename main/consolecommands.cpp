@@ -0,0 +1,804 @@
+#include "consolecommands.h"
+
+// system includes
+#include <array>
+#include <optional>
+#include <string>
+
+// esp-idf includes
+#include <driver/uart.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// 3rdparty lib includes
+#include <cpputils.h>
+#include <espstrutils.h>
+#include <espwifistack.h>
+#include <fmt/core.h>
+#include <schedulertask.h>
+#include <tl/expected.hpp>
+
+// local includes
+#include "config.h"
+#include "debugconsole.h"
+#include "espnow.h"
+#include "espnowcompression.h"
+#include "espnowcycles.h"
+#include "espnowfilter.h"
+#include "espnowota.h"
+#include "espnowoutput.h"
+#include "espnowping.h"
+#include "espnowrate.h"
+#include "espnowrelay.h"
+#include "espnowtimesync.h"
+#include "espnowtrace.h"
+#include "taskmanager.h"
+#include "telemetry.h"
+#include "tester.h"
+
+namespace {
+constexpr const char * const TAG = "CONSOLE";
+
+class Args
+{
+public:
+    explicit Args(std::string_view line);
+
+    size_t size() const { return m_count; }
+    std::string_view operator[](size_t index) const { return index < m_count ? m_items[index] : std::string_view{}; }
+
+private:
+    std::array<std::string_view, 8> m_items;
+    size_t m_count{};
+};
+
+using CommandResult = tl::expected<void, std::string>;
+
+struct Command
+{
+    std::string_view name;
+    std::string_view usage;
+    size_t minArgs;
+    CommandResult (*handler)(const Args &args);
+};
+
+template<typename... T>
+void print(fmt::format_string<T...> format, T&&... args)
+{
+    consoleWrite(fmt::format(format, std::forward<T>(args)...));
+}
+
+tl::expected<wifi_stack::mac_t, std::string> parseMac(std::string_view text);
+tl::expected<size_t, std::string> parseHex(std::string_view hex, uint8_t *data, size_t maxSize);
+template<typename T>
+tl::expected<T, std::string> parseNumber(std::string_view text);
+
+CommandResult cmdHelp(const Args &args);
+CommandResult cmdSend(const Args &args);
+CommandResult cmdRelay(const Args &args);
+CommandResult cmdRoutes(const Args &args);
+CommandResult cmdRates(const Args &args);
+CommandResult cmdTraces(const Args &args);
+CommandResult cmdCycles(const Args &args);
+CommandResult cmdFlood(const Args &args);
+CommandResult cmdQosProbe(const Args &args);
+CommandResult cmdLoadGen(const Args &args);
+CommandResult cmdResults(const Args &args);
+CommandResult cmdAbort(const Args &args);
+CommandResult cmdPing(const Args &args);
+CommandResult cmdPeers(const Args &args);
+CommandResult cmdStats(const Args &args);
+CommandResult cmdTasks(const Args &args);
+CommandResult cmdHeap(const Args &args);
+CommandResult cmdHeapTrace(const Args &args);
+CommandResult cmdReboot(const Args &args);
+CommandResult cmdMemDebug(const Args &args);
+CommandResult cmdLogLevel(const Args &args);
+CommandResult cmdCompressBench(const Args &args);
+CommandResult cmdBridge(const Args &args);
+CommandResult cmdP2pOta(const Args &args);
+
+// args[0] is the command itself, minArgs counts the required arguments after it
+constexpr const Command commands[] {
+    { "help",          "help",                                        0, cmdHelp          },
+    { "send",          "send <mac|broadcast> <hex>",                  2, cmdSend          },
+    { "relay",         "relay <mac|broadcast> <hex>",                 2, cmdRelay         },
+    { "routes",        "routes",                                      0, cmdRoutes        },
+    { "rates",         "rates",                                       0, cmdRates         },
+    { "traces",        "traces [reset]",                              0, cmdTraces        },
+    { "cycles",        "cycles [reset]",                              0, cmdCycles        },
+    { "flood",         "flood <rate/s, 0=max> <secs> [mac] [size]",   2, cmdFlood         },
+    { "qosprobe",      "qosprobe <rate/s> <secs> [mac] [size]",       2, cmdQosProbe      },
+    { "loadgen",       "loadgen <rate/s per node> <secs> [mac] [size] [nodes] [pattern]", 2, cmdLoadGen },
+    { "results",       "results",                                     0, cmdResults       },
+    { "abort",         "abort",                                       0, cmdAbort         },
+    { "ping",          "ping <mac|broadcast> <count> [interval ms]",  2, cmdPing          },
+    { "peers",         "peers",                                       0, cmdPeers         },
+    { "stats",         "stats",                                       0, cmdStats         },
+    { "tasks",         "tasks",                                       0, cmdTasks         },
+    { "heap",          "heap",                                        0, cmdHeap          },
+    { "heaptrace",     "heaptrace <start|stop>",                      1, cmdHeapTrace     },
+    { "reboot",        "reboot",                                      0, cmdReboot        },
+    { "memdebug",      "memdebug <off|normal|fast>",                  1, cmdMemDebug      },
+    { "loglevel",      "loglevel <tag|*> <none|error|warn|info|debug|verbose>", 2, cmdLogLevel },
+    { "compressbench", "compressbench",                               0, cmdCompressBench },
+    { "bridge",        "bridge (ctrl-] to leave)",                    0, cmdBridge        },
+    { "p2pota",        "p2pota <serve|stop|abort|status> [running|staged] [mac|broadcast]", 1, cmdP2pOta },
+};
+
+Args::Args(std::string_view line)
+{
+    while (m_count < m_items.size())
+    {
+        const auto begin = line.find_first_not_of(' ');
+        if (begin == std::string_view::npos)
+            break;
+        line.remove_prefix(begin);
+
+        const auto end = line.find(' ');
+        m_items[m_count++] = line.substr(0, end);
+        if (end == std::string_view::npos)
+            break;
+        line.remove_prefix(end);
+    }
+}
+} // namespace
+
+void handleConsoleCommand(std::string_view line)
+{
+    const Args args{line};
+    if (!args.size())
+        return;
+
+    for (const auto &command : commands)
+    {
+        if (command.name != args[0])
+            continue;
+
+        if (args.size() - 1 < command.minArgs)
+        {
+            print("usage: {}\r\n", command.usage);
+            return;
+        }
+
+        if (const auto result = command.handler(args); !result)
+            print("error: {}\r\n", result.error());
+        return;
+    }
+
+    print("unknown command {}, try help\r\n", args[0]);
+}
+
+void consoleWrite(std::string_view text)
+{
+    uart_write_bytes(UART_NUM_0, text.data(), text.size());
+}
+
+namespace {
+tl::expected<wifi_stack::mac_t, std::string> parseMac(std::string_view text)
+{
+    if (text == "broadcast")
+        return wifi_stack::mac_t{broadcastAddress};
+    return wifi_stack::fromString<wifi_stack::mac_t>(text);
+}
+
+tl::expected<size_t, std::string> parseHex(std::string_view hex, uint8_t *data, size_t maxSize)
+{
+    if (hex.size() % 2 || hex.size() / 2 > maxSize)
+        return tl::make_unexpected(fmt::format("hex payload must have an even length of at most {} chars", maxSize * 2));
+
+    constexpr auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+
+    for (size_t i = 0; i < hex.size() / 2; i++)
+    {
+        const auto high = nibble(hex[i * 2]);
+        const auto low = nibble(hex[i * 2 + 1]);
+        if (high < 0 || low < 0)
+            return tl::make_unexpected(fmt::format("invalid hex at position {}", i * 2));
+        data[i] = (high << 4) | low;
+    }
+    return hex.size() / 2;
+}
+
+template<typename T>
+tl::expected<T, std::string> parseNumber(std::string_view text)
+{
+    if (auto parsed = cpputils::fromString<T>(text))
+        return *parsed;
+    return tl::make_unexpected(fmt::format("could not parse {}", text));
+}
+
+CommandResult cmdHelp(const Args &)
+{
+    for (const auto &command : commands)
+        print("  {}\r\n", command.usage);
+    return {};
+}
+
+CommandResult cmdSend(const Args &args)
+{
+    const auto mac = parseMac(args[1]);
+    if (!mac)
+        return tl::make_unexpected(mac.error());
+
+    std::array<uint8_t, espnow::MaxFramePayload> data;
+    const auto size = parseHex(args[2], data.data(), data.size());
+    if (!size)
+        return tl::make_unexpected(size.error());
+
+    if (const auto error = espnow::queueEspNow(espnow::FrameType::Text, data.data(), *size, mac->data(), pdMS_TO_TICKS(100)); error != ESP_OK)
+        return tl::make_unexpected(fmt::format("queueEspNow() failed with {}", esp_err_to_name(error)));
+
+    print("queued {} bytes for {}\r\n", *size, wifi_stack::toString(*mac));
+    return {};
+}
+
+CommandResult cmdRelay(const Args &args)
+{
+    const auto mac = parseMac(args[1]);
+    if (!mac)
+        return tl::make_unexpected(mac.error());
+
+    std::array<uint8_t, espnow::MaxRelayPayload> data;
+    const auto size = parseHex(args[2], data.data(), data.size());
+    if (!size)
+        return tl::make_unexpected(size.error());
+
+    if (const auto error = espnow::relay::send(espnow::FrameType::Text, data.data(), *size, mac->data(), pdMS_TO_TICKS(100)); error != ESP_OK)
+        return tl::make_unexpected(fmt::format("relay::send() failed with {}", esp_err_to_name(error)));
+
+    print("queued {} bytes for {} with ttl {}\r\n", *size, wifi_stack::toString(*mac), configs.espnowRelayTtl.value);
+    return {};
+}
+
+CommandResult cmdRoutes(const Args &)
+{
+    const auto now = esp_timer_get_time();
+    espnow::relay::forEachRoute([&](const espnow::relay::Route &route){
+        print("{} via {} hops={} age={}ms\r\n",
+              wifi_stack::toString(wifi_stack::mac_t{route.origin.data()}), wifi_stack::toString(wifi_stack::mac_t{route.nextHop.data()}),
+              route.hops, (now - route.lastSeenUs) / 1000);
+    });
+
+    const auto &stats = espnow::relay::stats;
+    print("relay: originated={} received={} duplicates={} delivered={} forwarded={} directed={} suppressed={} expired={} dropped={}\r\n",
+          stats.originated.load(), stats.received.load(), stats.duplicates.load(), stats.delivered.load(), stats.forwarded.load(),
+          stats.directed.load(), stats.suppressed.load(), stats.expired.load(), stats.dropped.load());
+    if (const uint32_t timed = stats.timedFrames)
+        print("per hop latency avg={}us, avg hops={:.1f}\r\n", stats.hopLatencySumUs / timed, float(stats.hopsSum) / timed);
+    return {};
+}
+
+CommandResult cmdRates(const Args &)
+{
+    namespace rate = espnow::rate;
+
+    print("auto rate {}\r\n", configs.espnowAutoRate.value ? "enabled" : "disabled");
+    rate::forEachRate([&](const rate::RateStatus &status){
+        if (!status.eligible && !status.attempts)
+            return;
+        print("{}{:>8} attempts={} success={} probability={} expected={:.1f}kbit/s\r\n",
+              status.selected ? '*' : ' ', status.rate.name, status.attempts, status.success,
+              status.probability ? fmt::format("{:.3f}", *status.probability) : "-", status.expectedKbps);
+    });
+
+    const auto now = esp_timer_get_time();
+    rate::forEachDecision([&](const rate::Decision &decision){
+        print("{}ms ago: {} -> {} ({}) {:.1f}kbit/s\r\n", (now - decision.timestampUs) / 1000,
+              decision.from == rate::NoRate ? "-" : espnow::phyRates[decision.from].name, espnow::phyRates[decision.to].name,
+              rate::toString(decision.reason), decision.expectedKbps);
+    });
+    return {};
+}
+
+CommandResult cmdTraces(const Args &args)
+{
+    namespace trace = espnow::trace;
+
+    if (args.size() > 1)
+    {
+        if (args[1] != "reset")
+            return tl::make_unexpected(fmt::format("unknown argument {}", args[1]));
+        trace::reset();
+        print("traces reset\r\n");
+        return {};
+    }
+
+    if (const auto every = configs.espnowTraceEvery.value)
+        print("tracing every {}. sent and received frame\r\n", every);
+    else
+        print("tracing disabled, set espnowTraceEvery\r\n");
+    const auto stats = trace::breakdown();
+    for (size_t i = 0; i < trace::StageCount; i++)
+        print("{:>14}: samples={} avg={}us max={}us\r\n", trace::stages[i].name, stats[i].samples, stats[i].avgUs, stats[i].maxUs);
+
+    // offsets from the first point of each trace
+    trace::forEachTrace([&](const trace::Trace &trace){
+        std::string points;
+        std::optional<uint32_t> first;
+        for (size_t i = 0; i < trace::PointCount; i++)
+        {
+            const auto timestamp = trace.timestampsUs[i];
+            if (!timestamp)
+                continue;
+            if (!first)
+                first = *timestamp;
+            points += fmt::format(" {}=+{}us", trace::toString(trace::Point(i)), *timestamp - *first);
+        }
+        print("#{} {} type={} seq={}{}\r\n", trace.id, wifi_stack::toString(wifi_stack::mac_t{trace.mac.data()}),
+              std::to_underlying(trace.type), trace.seq, points);
+    });
+    return {};
+}
+
+CommandResult cmdCycles(const Args &args)
+{
+    namespace cycles = espnow::cycles;
+
+    if (!cycles::Enabled)
+        return tl::make_unexpected("cycle accounting is disabled, enable CONFIG_ESPNOW_CYCLE_ACCOUNTING");
+
+    if (args.size() > 1)
+    {
+        if (args[1] != "reset")
+            return tl::make_unexpected(fmt::format("unknown argument {}", args[1]));
+        cycles::reset();
+        print("cycle counts reset\r\n");
+        return {};
+    }
+
+    print("cycles per 1000 frames: tx={} rx={}\r\n", cycles::cyclesPer1000Sent(), cycles::cyclesPer1000Received());
+    for (const auto path : {cycles::Path::Receive, cycles::Path::SendCallback, cycles::Path::Send})
+    {
+        const auto &stats = cycles::stats[size_t(path)];
+        std::string histogram;
+        for (size_t i = 0; i < cycles::Buckets; i++)
+            histogram += fmt::format(" {}{}={}", i < std::size(cycles::bucketLimits) ? "<" : ">=",
+                                     cycles::bucketLimits[std::min(i, std::size(cycles::bucketLimits) - 1)], stats.histogram[i].load());
+        print("{}: calls={} max={}{}\r\n", cycles::toString(path), stats.calls.load(), stats.maxCycles.load(), histogram);
+    }
+    return {};
+}
+
+// <rate/s> <secs> [mac] [size] of flood and qosprobe
+tl::expected<tester::FloodParams, std::string> parseFloodParams(const Args &args)
+{
+    const auto rate = parseNumber<uint32_t>(args[1]);
+    if (!rate)
+        return tl::make_unexpected(rate.error());
+
+    const auto seconds = parseNumber<uint32_t>(args[2]);
+    if (!seconds)
+        return tl::make_unexpected(seconds.error());
+
+    tester::FloodParams params{ .rate = *rate, .durationMs = *seconds * 1000, .payloadSize = espnow::MaxFramePayload };
+
+    if (args.size() > 3)
+    {
+        const auto mac = parseMac(args[3]);
+        if (!mac)
+            return tl::make_unexpected(mac.error());
+        params.destination = *mac;
+    }
+    else
+        params.destination = wifi_stack::mac_t{broadcastAddress};
+
+    if (args.size() > 4)
+    {
+        const auto size = parseNumber<uint8_t>(args[4]);
+        if (!size)
+            return tl::make_unexpected(size.error());
+        params.payloadSize = *size;
+    }
+
+    return params;
+}
+
+CommandResult cmdFlood(const Args &args)
+{
+    const auto params = parseFloodParams(args);
+    if (!params)
+        return tl::make_unexpected(params.error());
+
+    if (const auto result = tester::startFlood(*params); !result)
+        return result;
+
+    print("flood to {} started, see results\r\n", wifi_stack::toString(params->destination));
+    return {};
+}
+
+CommandResult cmdQosProbe(const Args &args)
+{
+    const auto params = parseFloodParams(args);
+    if (!params)
+        return tl::make_unexpected(params.error());
+
+    if (const auto result = tester::startQosProbe(*params); !result)
+        return result;
+
+    print("qos probe to {} started, see results\r\n", wifi_stack::toString(params->destination));
+    return {};
+}
+
+CommandResult cmdLoadGen(const Args &args)
+{
+    auto params = parseFloodParams(args);
+    if (!params)
+        return tl::make_unexpected(params.error());
+
+    if (args.size() <= 4)
+        params->payloadSize = espnow::MaxVirtualPayload;
+
+    params->virtualNodes = 8;
+    if (args.size() > 5)
+    {
+        const auto nodes = parseNumber<uint8_t>(args[5]);
+        if (!nodes)
+            return tl::make_unexpected(nodes.error());
+        params->virtualNodes = *nodes;
+    }
+
+    params->pattern = tester::Pattern::Mixed;
+    if (args.size() > 6)
+    {
+        const auto pattern = tester::parsePattern(args[6]);
+        if (!pattern)
+            return tl::make_unexpected(pattern.error());
+        params->pattern = *pattern;
+    }
+
+    if (const auto result = tester::startLoadGen(*params); !result)
+        return result;
+
+    print("load generator with {} nodes ({}) to {} started, see results\r\n", params->virtualNodes,
+          tester::toString(params->pattern), wifi_stack::toString(params->destination));
+    return {};
+}
+
+CommandResult cmdResults(const Args &)
+{
+    print("tester: {}\r\n", tester::toString(tester::mode()));
+
+    const auto &results = tester::results();
+    for (size_t i = 0; i < results.count; i++)
+    {
+        const auto &result = results.entries[i];
+        print("{:>10} sent={} errors={} success={} fail={} loss={:.2f}% {:.1f}kbit/s latency avg={}us max={}us\r\n",
+              result.label, result.sent, result.sendErrors, result.success, result.fail,
+              result.lossPercent(), result.throughputKbps(), result.avgLatencyUs, result.maxLatencyUs);
+        if (result.probeSent)
+            print("{:>10} ping {}/{} rtt avg={}us max={}us\r\n", "", result.probeReceived, result.probeSent, result.probeAvgRttUs, result.probeMaxRttUs);
+    }
+    return {};
+}
+
+CommandResult cmdAbort(const Args &)
+{
+    tester::abort();
+    return {};
+}
+
+CommandResult cmdPing(const Args &args)
+{
+    const auto mac = parseMac(args[1]);
+    if (!mac)
+        return tl::make_unexpected(mac.error());
+
+    const auto count = parseNumber<uint32_t>(args[2]);
+    if (!count)
+        return tl::make_unexpected(count.error());
+
+    uint32_t intervalMs = 1000;
+    if (args.size() > 3)
+    {
+        const auto parsed = parseNumber<uint32_t>(args[3]);
+        if (!parsed)
+            return tl::make_unexpected(parsed.error());
+        intervalMs = *parsed;
+    }
+
+    const auto result = espnow::ping::run(mac->data(), *count, intervalMs, [](uint32_t seq, const std::optional<espnow::ping::Reply> &reply){
+        if (!reply)
+            print("seq={} timeout\r\n", seq);
+        else if (reply->forwardUs && reply->backwardUs)
+            print("seq={} rtt={}us forward={}us backward={}us\r\n", seq, reply->rttUs, *reply->forwardUs, *reply->backwardUs);
+        else
+            print("seq={} rtt={}us\r\n", seq, reply->rttUs);
+    });
+    if (!result)
+        return tl::make_unexpected(result.error());
+
+    print("{} sent, {} received, {:.1f}% loss, rtt min/avg/max = {}/{}/{}us, jitter {}us\r\n",
+          result->sent, result->received, result->lossPercent(),
+          result->minRttUs, result->avgRttUs(), result->maxRttUs, result->jitterUs());
+
+    const auto printOneWay = [](const char *name, const espnow::ping::OneWay &oneWay){
+        if (oneWay.samples)
+            print("{} min/avg/max = {}/{}/{}us, jitter {}us\r\n",
+                  name, oneWay.minUs, oneWay.avgUs(), oneWay.maxUs, oneWay.jitterUs());
+    };
+    printOneWay("forward", result->forward);
+    printOneWay("backward", result->backward);
+
+    if (!result->forward.samples && result->received)
+        print("no one-way latency, the clocks are not synced (espnowTimeRef)\r\n");
+
+    const auto sync = espnow::timesync::status();
+    if (!sync.reference)
+        print("time sync: {} offset={}us drift={}ppb error=+-{}us residual={}us\r\n",
+              sync.synced ? "synced" : "not synced", sync.offsetUs, sync.driftPpb, sync.errorUs, sync.residualUs);
+    return {};
+}
+
+CommandResult cmdPeers(const Args &)
+{
+    for (const auto &peer : espnow::peersSnapshot())
+        print("{} encrypt={} ifidx={}\r\n", wifi_stack::toString(wifi_stack::mac_t{peer.peer_addr}), peer.encrypt, int(peer.ifidx));
+
+    for (size_t i = 0; i < espnow::peerStatus.size(); i++)
+    {
+        const auto &peerConfig = configs.espnow_peers[i];
+        if (!peerConfig.mac.value)
+            continue;
+        print("slot {}: {} {}\r\n", i, wifi_stack::toString(*peerConfig.mac.value), espnow::toString(espnow::peerStatus[i]));
+    }
+    return {};
+}
+
+CommandResult cmdStats(const Args &)
+{
+    const auto &tx = espnow::txStats;
+    print("tx: sent={} errors={} queueFull={} success={} fail={} latency max={}us\r\n",
+          tx.sent.load(), tx.sendErrors.load(), tx.queueFull.load(), tx.success.load(), tx.fail.load(), tx.latencyMaxUs.load());
+    print("tx pacing: inFlight={} limit={} noMem={} decreases={} unloggedErrors={}\r\n",
+          espnow::inFlight(), espnow::inFlightLimit(), tx.noMem.load(), tx.paceDecreases.load(), tx.unloggedErrors.load());
+    for (const auto trafficClass : {espnow::TrafficClass::Control, espnow::TrafficClass::Bulk})
+    {
+        const auto &stats = espnow::txClassStats[size_t(trafficClass)];
+        const uint32_t queued = stats.queued;
+        print("tx {}: queued={} waiting={} queueFull={} wait avg={}us max={}us\r\n",
+              espnow::toString(trafficClass), queued, espnow::txQueueLength(trafficClass), stats.queueFull.load(),
+              queued ? stats.waitSumUs / queued : 0, stats.waitMaxUs.load());
+    }
+
+    const auto &rx = espnow::rxStats;
+    print("rx: frames={} bytes={} decodeErrors={}\r\n", rx.frames.load(), rx.bytes.load(), rx.decodeErrors.load());
+
+    const auto &filter = espnow::filter::stats;
+    print("rx filter ({}, {} senders): rejected mac={} foreign={} type={}\r\n",
+          espnow::filter::toString(configs.espnowRxMacMode.value), espnow::filter::macCount(),
+          filter.rejectedMac.load(), filter.rejectedForeign.load(), filter.rejectedType.load());
+
+    for (size_t i = 0; i < espnow::peerRxStatsCount; i++)
+    {
+        const auto &peer = espnow::peerRxStats[i];
+        const auto avgRssi = peer.avgRssi();
+        print("  {}{} frames={} lost={} loss={:.2f}% rssi={}\r\n",
+              wifi_stack::toString(wifi_stack::mac_t{peer.mac.data()}), peer.virtualNode ? fmt::format(" node {}", peer.virtualNode) : "",
+              peer.frames, peer.lost, peer.lossPercent(),
+              avgRssi ? fmt::format("{:.1f}dBm", *avgRssi) : "n/a");
+    }
+
+    const auto &compression = espnow::compression::stats;
+    print("compression: compressed={} raw={} in={} out={}\r\n",
+          compression.compressedFrames.load(), compression.rawFrames.load(), compression.bytesIn.load(), compression.bytesOut.load());
+
+    const auto &output = espnow::output::stats;
+    print("output ({}): queued={} written={} dropped={}\r\n",
+          espnow::output::toString(configs.espnowOutputMode.value), output.queued.load(), output.written.load(), output.dropped.load());
+
+    print("bridge: uartBytes={} frames={} dropped={} overflows={}\r\n",
+          bridgeStats.uartBytes.load(), bridgeStats.frames.load(), bridgeStats.dropped.load(), bridgeStats.overflows.load());
+    return {};
+}
+
+CommandResult cmdTasks(const Args &)
+{
+    sched_pushStats(true);
+
+    for (const char *name : freertosTaskNames)
+    {
+        const auto handle = xTaskGetHandle(name);
+        if (!handle)
+            continue;
+        print("{:>14} prio={} stack free={}\r\n", name, uxTaskPriorityGet(handle), uxTaskGetStackHighWaterMark(handle));
+    }
+    return {};
+}
+
+CommandResult cmdHeap(const Args &)
+{
+    print("heap8={} (largest block: {}, minimum: {}) heap32={}\r\n",
+          heap_caps_get_free_size(MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT),
+          heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT),
+          heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT),
+          heap_caps_get_free_size(MALLOC_CAP_INTERNAL|MALLOC_CAP_32BIT));
+
+    std::optional<telemetry::HeapSample> first, lowest;
+    telemetry::forEachHeapSample([&](const telemetry::HeapSample &sample){
+        if (!first)
+            first = sample;
+        if (!lowest || sample.largest8 < lowest->largest8)
+            lowest = sample;
+    });
+    if (const auto last = telemetry::latestHeapSample(); first && last)
+        print("last {}s: heap8 {:+} largest block {:+}, smallest largest block {} at {}s\r\n",
+              last->uptimeS - first->uptimeS, int32_t(last->free8 - first->free8), int32_t(last->largest8 - first->largest8),
+              lowest->largest8, lowest->uptimeS);
+
+    const auto highWaterMarks = telemetry::stackHighWaterMarks();
+    for (size_t i = 0; i < freertosTaskNames.size(); i++)
+        if (highWaterMarks[i])
+            print("{:>14} stack free={}\r\n", freertosTaskNames[i], *highWaterMarks[i]);
+
+    // a task that keeps growing here allocates in every loop, in steady state all of them should stand still
+    size_t index{};
+    for (const auto &task : schedulerTasks)
+    {
+        if (index >= telemetry::MaxSubsystems)
+            break;
+        print("{:>14} allocations={}\r\n", task.name(), telemetry::schedulerAllocations(index++));
+    }
+
+    // the freertos tasks beside the scheduler, the tester floods and the load generator allocate in the tester task
+    for (size_t i = 0; i < freertosTaskNames.size(); i++)
+        if (const uint32_t count = telemetry::freertosTaskAllocations(i))
+            print("{:>14} task allocations={}\r\n", freertosTaskNames[i], count);
+
+    const auto &allocations = telemetry::allocationStats;
+    if (const uint32_t count = allocations.hotPathAllocations)
+        print("hot path allocations={} (last: {} bytes in {})\r\n",
+              count, allocations.lastSize.load(), allocations.lastTask.load() ? allocations.lastTask.load() : "?");
+    return {};
+}
+
+CommandResult cmdHeapTrace(const Args &args)
+{
+    if (args[1] == "start")
+    {
+        if (auto result = telemetry::startHeapTrace(); !result)
+            return result;
+        print("heap trace started, run the benchmark and stop it with heaptrace stop\r\n");
+        return {};
+    }
+
+    if (args[1] != "stop")
+        return tl::make_unexpected(fmt::format("unknown mode {}", args[1]));
+
+    if (auto result = telemetry::stopHeapTrace(); !result)
+        return result;
+
+    size_t index{};
+    for (const auto &task : schedulerTasks)
+    {
+        if (index >= telemetry::MaxSubsystems)
+            break;
+        const auto subsystem = telemetry::subsystemHeap(index++);
+        print("{:>14} net={} bytes growth events={} max growth={}\r\n",
+              task.name(), subsystem.netBytes, subsystem.growthEvents, subsystem.maxGrowth);
+    }
+    return {};
+}
+
+CommandResult cmdReboot(const Args &)
+{
+    ESP_LOGI(TAG, "Rebooting...");
+    esp_restart();
+    return {};
+}
+
+CommandResult cmdMemDebug(const Args &args)
+{
+    if (args[1] == "off")
+        memoryDebug = Off;
+    else if (args[1] == "normal")
+        memoryDebug = Normal;
+    else if (args[1] == "fast")
+        memoryDebug = Fast;
+    else
+        return tl::make_unexpected(fmt::format("unknown mode {}", args[1]));
+    return {};
+}
+
+CommandResult cmdLogLevel(const Args &args)
+{
+    constexpr std::pair<std::string_view, esp_log_level_t> levels[] {
+        { "none",    ESP_LOG_NONE    },
+        { "error",   ESP_LOG_ERROR   },
+        { "warn",    ESP_LOG_WARN    },
+        { "info",    ESP_LOG_INFO    },
+        { "debug",   ESP_LOG_DEBUG   },
+        { "verbose", ESP_LOG_VERBOSE },
+    };
+
+    for (const auto &[name, level] : levels)
+    {
+        if (name != args[2])
+            continue;
+
+        const std::string tag{args[1]};
+        esp_log_level_set(tag.c_str(), level);
+        print("{} loglevel set to {}\r\n", tag, espcpputils::toString(level));
+        return {};
+    }
+
+    return tl::make_unexpected(fmt::format("unknown level {}", args[2]));
+}
+
+CommandResult cmdCompressBench(const Args &)
+{
+    espnow::compression::runBenchmark();
+    return {};
+}
+
+CommandResult cmdBridge(const Args &)
+{
+    enterBridgeMode();
+    return {};
+}
+
+CommandResult cmdP2pOta(const Args &args)
+{
+    using namespace espnow::ota;
+
+    if (args[1] == "serve")
+    {
+        Source source{Source::Running};
+        if (args[2] == "staged")
+            source = Source::Staged;
+        else if (args.size() > 2 && args[2] != "running")
+            return tl::make_unexpected(fmt::format("unknown source {}", args[2]));
+
+        wifi_stack::mac_t destination{broadcastAddress};
+        if (args.size() > 3)
+        {
+            const auto mac = parseMac(args[3]);
+            if (!mac)
+                return tl::make_unexpected(mac.error());
+            destination = *mac;
+        }
+
+        return startServing(source, destination.data());
+    }
+
+    if (args[1] == "stop")
+    {
+        stopServing();
+        return {};
+    }
+
+    if (args[1] == "abort")
+    {
+        if (receiverStatus().state != ReceiverState::Receiving)
+            return tl::make_unexpected("not receiving");
+        abortReceiving();
+        return {};
+    }
+
+    if (args[1] != "status")
+        return tl::make_unexpected(fmt::format("unknown mode {}", args[1]));
+
+    const auto sender = senderStatus();
+    if (sender.serving)
+        print("serving {} image ({} bytes) to {}: requests={} chunks sent={} deduplicated={}\r\n",
+              toString(sender.source), sender.imageSize, wifi_stack::toString(wifi_stack::mac_t{sender.destination.data()}),
+              sender.requests, sender.chunksSent, sender.chunksDeduplicated);
+    else
+        print("not serving\r\n");
+
+    const auto receiver = receiverStatus();
+    print("receiver: {} {}/{} bytes requests={} hash failures={} resumes={} {}\r\n",
+          toString(receiver.state), receiver.written, receiver.imageSize,
+          receiver.requests, receiver.hashFailures, receiver.resumes, receiver.message);
+    return {};
+}
+} // namespace
@@ -0,0 +1,10 @@
+#pragma once
+
+// system includes
+#include <string_view>
+
+// runs one line entered on the debug console, called from the console task
+void handleConsoleCommand(std::string_view line);
+
+// writes to the console uart directly, command output should not depend on the log level
+void consoleWrite(std::string_view text);
@@ -1,27 +1,71 @@
 #include "debugconsole.h"
 
 // system includes
+#include <array>
+#include <atomic>
+#include <cstdarg>
+#include <string>
 #include <string_view>
+#include <vector>
 
 // esp-idf includes
 #include <driver/uart.h>
 #include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
 
 // 3rdparty lib includes
-#include <espstrutils.h>
+#include <fmt/core.h>
+
+// local includes
+#include "config.h"
+#include "consolecommands.h"
+#include "espnow.h"
+#include "espnowoutput.h"
+#include "espnowrelay.h"
+#include "telemetry.h"
 
 namespace {
 constexpr const char * const TAG = "DEBUG";
 
+// leaves bridge mode, like telnet
+constexpr const char BridgeEscapeChar = '\x1d'; // ctrl-]
+
+constexpr const std::string_view Prompt{"> "};
+constexpr const size_t MaxLineLength = 128;
+constexpr const size_t MaxHistory = 8;
+
+std::string line;
+size_t cursor{};
+bool lastCharWasCarriageReturn{};
+std::vector<std::string> history;
+size_t historyIndex{};
+
 uint8_t consoleControlCharsReceived{};
 bool uart0Initialized{};
+QueueHandle_t uartEvents{};
 
+std::atomic<bool> bridgeActive{};
+bool lastBridgeConfig{};
+vprintf_like_t logVprintfBeforeBridge{};
+std::array<uint8_t, espnow::MaxFramePayload> bridgeFrame;
+size_t bridgeFrameSize{};
+
+void consoleTask(void *);
+void handleConsoleInput(std::string_view data);
+void handleBridgeInput(std::string_view data, bool idle);
+void flushBridgeFrame();
+void setBridgeActive(bool active);
+int discardLog(const char *format, va_list args);
+void redrawLine();
 void handleNormalChar(char c);
 void handleSpecialChar(char c);
 } // namespace
 
 MemoryDebug memoryDebug{Off};
 espchrono::millis_clock::time_point lastMemoryDebug;
+BridgeStats bridgeStats;
 
 void init_debugconsole()
 {
@@ -30,96 +74,268 @@ void init_debugconsole()
         ESP_LOGE(TAG, "uart_set_pin() failed with %s", esp_err_to_name(result));
     }
 
-    if (const auto result = uart_driver_install(UART_NUM_0, SOC_UART_FIFO_LEN + 1, 0, 10, nullptr, 0); result != ESP_OK)
+    // large enough to buffer the uart at 115200 baud, or a faster configs.espnowOutputBaud, while the bridge waits for the radio
+    if (const auto result = uart_driver_install(UART_NUM_0, 4096, 0, 20, &uartEvents, 0); result != ESP_OK)
+    {
         ESP_LOGE(TAG, "uart_driver_install() failed with %s", esp_err_to_name(result));
-    else
-        uart0Initialized = true;
+        return;
+    }
+
+    uart0Initialized = true;
+    espnow::output::init();
+
+    // the commands run on this task, compressbench alone keeps about 3 KiB of buffers on the stack.
+    // the heap command reports how much of it is left
+    if (const auto result = xTaskCreatePinnedToCore(consoleTask, "console", 8192, nullptr, configs.consolePrio.value, nullptr, configs.appCore.value); result != pdPASS)
+        ESP_LOGE(TAG, "xTaskCreatePinnedToCore() failed with %i", result);
 }
 
-void update_debugconsole()
+bool bridgeModeActive()
 {
-    if (!uart0Initialized)
-        return;
+    return bridgeActive;
+}
 
-    size_t length{};
-    if (const auto result = uart_get_buffered_data_len(UART_NUM_0, &length); result != ESP_OK)
+void enterBridgeMode()
+{
+    setBridgeActive(true);
+}
+
+namespace {
+void consoleTask(void *)
+{
+    std::array<char, 512> data;
+    uart_event_t event;
+
+    while (true)
     {
-        ESP_LOGW(TAG, "uart_get_buffered_data_len() failed with %s", esp_err_to_name(result));
+        // the key toggles bridge mode at runtime, the config is only followed when it changes
+        if (configs.espnowBridge.value != lastBridgeConfig)
+        {
+            lastBridgeConfig = configs.espnowBridge.value;
+            setBridgeActive(lastBridgeConfig);
+        }
+
+        if (xQueueReceive(uartEvents, &event, pdMS_TO_TICKS(100)) != pdTRUE)
+        {
+            flushBridgeFrame();
+            continue;
+        }
+
+        switch (event.type)
+        {
+        case UART_DATA:
+        {
+            for (size_t remaining = event.size; remaining;)
+            {
+                const auto length = uart_read_bytes(UART_NUM_0, data.data(), std::min(remaining, data.size()), 0);
+                if (length <= 0)
+                    break;
+                remaining -= length;
+
+                const std::string_view view{data.data(), size_t(length)};
+                bridgeStats.uartBytes += length;
+                if (bridgeActive)
+                    handleBridgeInput(view, event.timeout_flag && !remaining);
+                else
+                    handleConsoleInput(view);
+            }
+            break;
+        }
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            bridgeStats.overflows++;
+            uart_flush_input(UART_NUM_0);
+            xQueueReset(uartEvents);
+            break;
+        default:
+            break;
+        }
     }
-    else if (length)
+}
+
+void handleConsoleInput(std::string_view data)
+{
+    for (size_t i = 0; i < data.size(); i++)
     {
-        char data[length];
-        length = uart_read_bytes(UART_NUM_0, data, length, 0);
+        const char c = data[i];
 
-        for (char c : std::string_view{data, length})
+        if (consoleControlCharsReceived < 2)
         {
-            if (consoleControlCharsReceived < 2)
+            switch (c)
             {
-                switch (c)
+            case '\x1b':
+                if (consoleControlCharsReceived == 0)
+                    consoleControlCharsReceived = 1;
+                else
+                    consoleControlCharsReceived = 0;
+                break;
+            case '\x5b':
+                if (consoleControlCharsReceived == 1)
                 {
-                case '\x1b':
-                    if (consoleControlCharsReceived == 0)
-                        consoleControlCharsReceived = 1;
-                    else
-                        consoleControlCharsReceived = 0;
-                    break;
-                case '\x5b':
-                    if (consoleControlCharsReceived == 1)
-                        consoleControlCharsReceived = 2;
-                    else
-                        consoleControlCharsReceived = 0;
+                    consoleControlCharsReceived = 2;
                     break;
-                default:
-                    consoleControlCharsReceived = 0;
-                    handleNormalChar(c);
                 }
-            }
-            else
-            {
+                [[fallthrough]];
+            default:
                 consoleControlCharsReceived = 0;
-                handleSpecialChar(c);
+                handleNormalChar(c);
             }
         }
+        else
+        {
+            consoleControlCharsReceived = 0;
+            handleSpecialChar(c);
+        }
+
+        // the bridge command was entered, the rest of the input belongs to the bridge
+        if (bridgeActive)
+        {
+            auto rest = data.substr(i + 1);
+            if (!rest.empty() && rest.front() == '\n')
+                rest.remove_prefix(1);
+            handleBridgeInput(rest, false);
+            return;
+        }
+    }
+}
+
+void handleBridgeInput(std::string_view data, bool idle)
+{
+    telemetry::HotPath hotPath;
+
+    for (char c : data)
+    {
+        if (c == BridgeEscapeChar)
+        {
+            flushBridgeFrame();
+            setBridgeActive(false);
+            return;
+        }
+
+        bridgeFrame[bridgeFrameSize++] = c;
+
+        // relayed frames lose room to the relay header
+        const size_t limit = configs.espnowRelay.value ? espnow::MaxRelayPayload : bridgeFrame.size();
+        if (bridgeFrameSize >= limit || (c == '\n' && configs.espnowBridgeLines.value))
+            flushBridgeFrame();
+    }
+
+    // the rx timeout of the uart marks a gap in the input
+    if (idle)
+        flushBridgeFrame();
+}
+
+void flushBridgeFrame()
+{
+    if (!bridgeFrameSize)
+        return;
+
+    const auto &peer = configs.espnowBridgePeer.value;
+    const uint8_t *destination = peer ? peer->data() : broadcastAddress;
+
+    // blocking here applies backpressure, the uart ring buffer keeps receiving meanwhile.
+    // with relaying enabled the bridge reaches nodes behind other nodes too
+    const auto result = configs.espnowRelay.value ?
+        espnow::relay::send(espnow::FrameType::Bridge, bridgeFrame.data(), bridgeFrameSize, destination, pdMS_TO_TICKS(100)) :
+        espnow::queueEspNow(espnow::FrameType::Bridge, bridgeFrame.data(), bridgeFrameSize, destination, pdMS_TO_TICKS(100));
+    if (result == ESP_OK)
+        bridgeStats.frames++;
+    else
+        bridgeStats.dropped++;
+
+    bridgeFrameSize = 0;
+}
+
+void setBridgeActive(bool active)
+{
+    if (active == bridgeActive)
+        return;
+
+    if (active)
+    {
+        ESP_LOGI(TAG, "bridge mode enabled, press ctrl-] to leave");
+        // log output would end up in the bridged stream of the other side. the output is dropped instead of
+        // lowering the levels, so the levels set with the loglevel command survive the bridge
+        logVprintfBeforeBridge = esp_log_set_vprintf(&discardLog);
+    }
+    else
+    {
+        esp_log_set_vprintf(logVprintfBeforeBridge);
+        ESP_LOGI(TAG, "bridge mode disabled");
+        consoleWrite(Prompt);
     }
+
+    bridgeFrameSize = 0;
+    bridgeActive = active;
 }
 
+int discardLog(const char *, va_list)
+{
+    return 0;
+}
+} // namespace
+
 namespace {
-void handleNormalChar(char c)
+void redrawLine()
 {
-    constexpr auto rotateLogLevel = [](const char *tag){
-        const auto oldLogLevel = esp_log_level_get(tag);
-        const auto newLogLevel = oldLogLevel == ESP_LOG_INFO ? ESP_LOG_DEBUG : (oldLogLevel == ESP_LOG_DEBUG ? ESP_LOG_VERBOSE : ESP_LOG_INFO);
-        esp_log_level_set(tag, newLogLevel);
-        ESP_LOGI(TAG, "%s loglevel set to %s (previous=%s)", tag, espcpputils::toString(newLogLevel).c_str(), espcpputils::toString(oldLogLevel).c_str());
-    };
+    // go back to the start of the line, redraw and move the cursor back to where it was
+    std::string out = fmt::format("\r\x1b[K{}{}", Prompt, line);
+    if (const auto behind = line.size() - cursor)
+        out += fmt::format("\x1b[{}D", behind);
+    consoleWrite(out);
+}
 
+void handleNormalChar(char c)
+{
     switch (c)
     {
-    case 'r': case 'R':
-        ESP_LOGI(TAG, "Rebooting...");
-        esp_restart();
-        break;
-    case 'm': case 'M':
-        switch (memoryDebug)
-        {
-        case Off:
-            memoryDebug = Normal;
-            ESP_LOGI(TAG, "memory debug set to %s", "Normal");
-            break;
-        case Normal:
-            memoryDebug = Fast;
-            ESP_LOGI(TAG, "memory debug set to %s", "Fast");
-            break;
-        case Fast:
-            memoryDebug = Off;
-            ESP_LOGI(TAG, "memory debug set to %s", "Off");
+    case '\n':
+        if (lastCharWasCarriageReturn)
             break;
+        [[fallthrough]];
+    case '\r':
+    {
+        consoleWrite("\r\n");
+        if (!line.empty() && (history.empty() || history.back() != line))
+        {
+            if (history.size() >= MaxHistory)
+                history.erase(std::begin(history));
+            history.push_back(line);
         }
+        historyIndex = history.size();
+
+        const auto command = std::move(line);
+        line.clear();
+        cursor = 0;
+        handleConsoleCommand(command);
+        if (!bridgeActive)
+            consoleWrite(Prompt);
         break;
-    case 'w': case 'W':
-        rotateLogLevel("WEBSERVER");
+    }
+    case '\x7f': // backspace
+    case '\b':
+        if (!cursor)
+            break;
+        line.erase(--cursor, 1);
+        redrawLine();
+        break;
+    case '\x03': // ctrl-c
+        line.clear();
+        cursor = 0;
+        consoleWrite("^C\r\n");
+        consoleWrite(Prompt);
         break;
+    default:
+        if (c < ' ' || line.size() >= MaxLineLength)
+            break;
+        line.insert(cursor++, 1, c);
+        if (cursor == line.size())
+            consoleWrite(std::string_view{&c, 1});
+        else
+            redrawLine();
     }
+
+    lastCharWasCarriageReturn = c == '\r';
 }
 
 void handleSpecialChar(char c)
@@ -127,12 +343,30 @@ void handleSpecialChar(char c)
     switch (c)
     {
     case 'A': // Up arrow pressed
+        if (!historyIndex)
+            break;
+        line = history[--historyIndex];
+        cursor = line.size();
+        redrawLine();
         break;
     case 'B': // Down arrow pressed
+        if (historyIndex >= history.size())
+            break;
+        line = ++historyIndex < history.size() ? history[historyIndex] : std::string{};
+        cursor = line.size();
+        redrawLine();
         break;
     case 'C': // Right arrow pressed
+        if (cursor >= line.size())
+            break;
+        cursor++;
+        consoleWrite("\x1b[C");
         break;
     case 'D': // Left arrow pressed
+        if (!cursor)
+            break;
+        cursor--;
+        consoleWrite("\x1b[D");
         break;
     default:
         ESP_LOGI(TAG, "unknown control char received: %hhx", c);
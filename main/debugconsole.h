@@ -1,5 +1,9 @@
 #pragma once
 
+// system includes
+#include <atomic>
+#include <cstdint>
+
 // 3rdparty lib includes
 #include <espchrono.h>
 
@@ -7,5 +11,16 @@ enum MemoryDebug {Off,Normal,Fast};
 extern MemoryDebug memoryDebug;
 extern espchrono::millis_clock::time_point lastMemoryDebug;
 
+struct BridgeStats
+{
+    std::atomic<uint32_t> uartBytes{};
+    std::atomic<uint32_t> frames{};
+    std::atomic<uint32_t> dropped{};
+    std::atomic<uint32_t> overflows{};
+};
+extern BridgeStats bridgeStats;
+
+bool bridgeModeActive();
+void enterBridgeMode(); // only from the console task
+
 void init_debugconsole();
-void update_debugconsole();
@@ -1,13 +1,37 @@
 #include "espnow.h"
 
+// system includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+
+// esp-idf includes
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
 // 3rdparty lib includes
 #include <esp_log.h>
 #include <espwifistack.h>
 #include <fmt/core.h>
-#include <driver/uart.h>
 
 // local includes
 #include "config.h"
+#include "espnowcompression.h"
+#include "espnowcycles.h"
+#include "espnowfilter.h"
+#include "espnowota.h"
+#include "espnowoutput.h"
+#include "espnowping.h"
+#include "espnowrate.h"
+#include "espnowrelay.h"
+#include "espnowtimesync.h"
+#include "espnowtrace.h"
+#include "telemetry.h"
 
 constexpr const char * const TAG = "ESP_NOW";
 
@@ -21,58 +45,449 @@ enum class InitState : uint8_t {
   INIT_DONE
 };
 InitState initState{InitState::UNINITIALIZED};
+
+// guards espnow::peers and txSequences, the tester modifies entries from its own task
+std::mutex peersMutex;
+
+// the receiver counts seq gaps as loss, so every destination gets its own counter
+struct TxSequence
+{
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> mac;
+    uint16_t next;
+};
+std::array<TxSequence, ESP_NOW_MAX_TOTAL_PEER_NUM> txSequences{};
+size_t txSequenceCount{};
+
+using key_t = std::array<uint8_t, ESP_NOW_KEY_LEN>;
+std::optional<key_t> appliedPmk;
+
+std::array<esp_now_peer_info_t, std::tuple_size_v<decltype(espnow::peerStatus)>> lastDesiredPeers{};
+size_t lastDesiredPeerCount{};
+
+// derived from the configs by subscriptions instead of reading them on every send
+bool configsSubscribed{};
+std::atomic<bool> interfaceUp{};
+std::atomic<wifi_interface_t> sendInterface{WIFI_IF_STA};
+std::atomic<bool> compressFrames{};
+std::atomic<bool> peerConfigChanged{true};
+
+// guards the radio settings below, the tester overrides the rate from its own task
+std::mutex radioMutex;
+std::optional<wifi_phy_rate_t> appliedRate;
+std::optional<wifi_phy_rate_t> rateOverride;
+std::optional<bool> appliedLongRange;
+std::optional<int8_t> appliedTxPower;
+
+// timestamps, rates and traces of frames handed to esp_now_send(), the send callback fires in the same order.
+// the slot of a frame is txStats.sent at the time of its send, sendMutex keeps concurrent senders from
+// taking the same slot between writing it and counting the frame
+std::mutex sendMutex;
+std::array<std::atomic<uint32_t>, 32> sendTimestamps;
+std::array<std::atomic<uint8_t>, 32> sendRates;
+std::array<std::atomic<espnow::trace::Id>, 32> sendTraceIds;
+std::atomic<uint8_t> appliedRateIndex{espnow::rate::NoRate};
+
+std::atomic<bool> rxStatsResetRequested{};
+
+struct TxItem
+{
+    espnow::FrameType type;
+    uint8_t size;
+    uint32_t queuedUs;
+    espnow::trace::Id traceId;
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> destination;
+    std::array<uint8_t, espnow::MaxFramePayload> data;
+};
+
+// one queue per traffic class, txPending counts the frames in all of them
+constexpr const std::array<UBaseType_t, espnow::TrafficClassCount> txQueueLengths{8, 16};
+std::array<QueueHandle_t, espnow::TrafficClassCount> txQueues{};
+SemaphoreHandle_t txPending{};
+TaskHandle_t txTaskHandle{};
+
+// bulk frames are held back while this many frames are in the driver queue,
+// so a control frame never waits behind a long burst that was already handed over
+constexpr uint32_t BulkInFlight = 4;
+
+// bounds of espnow::inFlightLimit(), the window is kept in 1/16 frames so acks can grow it gradually
+constexpr uint32_t MinInFlight = 2;
+constexpr uint32_t MaxInFlight = 16;
+std::atomic<uint32_t> paceWindowX16{8 * 16};
+std::atomic<uint32_t> completedSinceDecrease{MaxInFlight};
+
+// send errors come in bursts under load, they are logged at most once per interval and counted otherwise
+constexpr uint32_t SendErrorLogIntervalMs = 1000;
+std::atomic<uint32_t> lastSendErrorLogMs{};
+std::atomic<uint32_t> sendErrorsSinceLog{};
+
+void paceIncrease();
+void paceDecrease(uint32_t numerator, uint32_t denominator);
+void logSendError(esp_err_t error);
+
+std::optional<key_t> parseKey(std::string_view hex);
+bool isBroadcast(const uint8_t *mac);
+wifi_interface_t peerInterface();
+uint16_t nextSeqFor(const uint8_t *mac);
+void createTxQueue();
+void txTask(void *);
+void accountFrame(const espnow::RecvRecord &record);
+void syncPmk();
+void syncPeers();
+void syncRadio();
+void subscribeConfigs();
+void updateInterface();
 } // namespace
 
 namespace espnow {
+TxStats txStats;
+std::array<TxClassStats, TrafficClassCount> txClassStats{};
+RxStats rxStats;
+std::array<PeerRxStats, 32> peerRxStats{};
+size_t peerRxStatsCount{};
+std::array<RateRxStats, sniffer::RateCount> rateRxStats{};
+std::array<RssiBucket, 6> rssiBuckets{{ {-50}, {-60}, {-70}, {-80}, {-90}, {INT8_MIN} }};
+std::array<PeerStatus, 8> peerStatus{};
+static_assert(std::tuple_size_v<decltype(ConfigContainer::espnow_peers)> == std::tuple_size_v<decltype(peerStatus)>);
+
+std::string_view toString(PeerStatus status)
+{
+    switch (status)
+    {
+    case PeerStatus::Unused:       return "Unused";
+    case PeerStatus::Active:       return "Active";
+    case PeerStatus::InvalidMac:   return "InvalidMac";
+    case PeerStatus::InvalidKey:   return "InvalidKey";
+    case PeerStatus::EncryptLimit: return "EncryptLimit";
+    case PeerStatus::TotalLimit:   return "TotalLimit";
+    case PeerStatus::Failed:       return "Failed";
+    }
+    return "Unknown";
+}
+
+std::string_view toString(TrafficClass trafficClass)
+{
+    switch (trafficClass)
+    {
+    case TrafficClass::Control: return "control";
+    case TrafficClass::Bulk:    return "bulk";
+    }
+    return "unknown";
+}
+
+std::string_view toString(wifi_phy_rate_t rate)
+{
+    for (const auto &phyRate : phyRates)
+        if (phyRate.rate == rate)
+            return phyRate.name;
+    return "Unknown";
+}
+
+float PeerRxStats::lossPercent() const
+{
+    if (!frames && !lost)
+        return 0.f;
+    return float(lost) / (frames + lost) * 100;
+}
+
+std::optional<float> PeerRxStats::avgRssi() const
+{
+    if (!rssiFrames)
+        return std::nullopt;
+    return float(rssiSum) / rssiFrames;
+}
+
+void resetRxStats()
+{
+    rxStatsResetRequested = true;
+}
+
 bool initAllowed()
 {
     const auto wifi_mode = wifi_stack::get_wifi_mode();
     return (wifi_mode == WIFI_MODE_STA || wifi_mode == WIFI_MODE_AP || wifi_mode == WIFI_MODE_APSTA);
 }
-esp_err_t _sendEspNowImpl(uint8_t *data, size_t size, const uint8_t *destination)
+
+namespace {
+struct VirtualSender
+{
+    uint8_t node;
+    uint16_t seq;
+};
+
+// data of virtual frames starts with the VirtualHeader already
+esp_err_t sendFrame(FrameType type, const uint8_t *data, size_t size, const uint8_t *destination, const VirtualSender *virtualSender, trace::Id traceId)
 {
     if (initState != InitState::INIT_DONE)
         return ESP_ERR_ESPNOW_NOT_INIT;
 
-    if (!configs.wifiApEnabled.value && !configs.wifiStaEnabled.value)
+    if (size > MaxFramePayload)
+        return ESP_ERR_INVALID_SIZE;
+
+    if (!interfaceUp)
         return ESP_ERR_ESPNOW_IF;
 
+    // taken first, so the cycle count below does not include waiting for other senders
+    std::lock_guard sendLock{sendMutex};
+    std::unique_lock lock{peersMutex};
+
+    // frame build and esp_now_send() only
+    cycles::Scope cycleScope{cycles::Path::Send};
+
     if (peers.empty())
         return ESP_FAIL;
 
     for (auto &peer : peers)
     {
-        if (peer.peer_addr == destination)
+        if (std::memcmp(peer.peer_addr, destination, ESP_NOW_ETH_ALEN) == 0)
         {
-            if (configs.wifiApEnabled.value)
-                peer.ifidx = WIFI_IF_AP;
-            else if (configs.wifiStaEnabled.value)
-                peer.ifidx = WIFI_IF_STA;
+            peer.ifidx = sendInterface;
+
+            std::array<uint8_t, ESP_NOW_MAX_DATA_LEN> frame;
+            FrameHeader header{
+                .magic = FrameMagic,
+                .type = type,
+                .flags = uint8_t(isBroadcast(destination) ? FrameFlagBroadcast : 0),
+                .seq = virtualSender ? virtualSender->seq : nextSeqFor(peer.peer_addr)
+            };
+            trace::setSeq(traceId, header.seq);
+            if (virtualSender)
+                header.flags |= FrameFlagVirtual;
+
+            uint8_t * const payload = frame.data() + sizeof(FrameHeader);
+            size_t payloadSize = size;
+            if (const auto compressedSize = compressFrames ? compression::compressFrame(data, size, payload) : std::nullopt)
+            {
+                header.flags |= FrameFlagCompressed;
+                payloadSize = *compressedSize;
+            }
             else
-                return ESP_ERR_ESPNOW_IF;
+                std::memcpy(payload, data, size);
+
+            std::memcpy(frame.data(), &header, sizeof(header));
 
-            if (const auto error = esp_now_send(peer.peer_addr, data, size); error != ESP_OK)
+            uint8_t peerAddr[ESP_NOW_ETH_ALEN];
+            std::memcpy(peerAddr, peer.peer_addr, sizeof(peerAddr));
+            lock.unlock();
+
+            sendTimestamps[txStats.sent % sendTimestamps.size()] = uint32_t(esp_timer_get_time());
+            sendRates[txStats.sent % sendRates.size()] = appliedRateIndex.load();
+            sendTraceIds[txStats.sent % sendTraceIds.size()] = traceId;
+            trace::mark(traceId, trace::Point::DriverCall);
+            if (const auto error = esp_now_send(peerAddr, frame.data(), sizeof(FrameHeader) + payloadSize); error != ESP_OK)
             {
-                ESP_LOGE(TAG, "esp_now_send failed: %s", esp_err_to_name(error));
+                txStats.sendErrors++;
+                if (error == ESP_ERR_ESPNOW_NO_MEM)
+                {
+                    txStats.noMem++;
+                    paceDecrease(1, 2);
+                }
+                logSendError(error);
                 return error;
             }
+            trace::mark(traceId, trace::Point::DriverReturn);
+            txStats.sent++;
             return ESP_OK;
         }
     }
     return ESP_ERR_ESPNOW_NOT_FOUND;
 }
+} // namespace
+
+esp_err_t _sendEspNowImpl(FrameType type, const uint8_t *data, size_t size, const uint8_t *destination)
+{
+    return sendFrame(type, data, size, destination, nullptr, trace::begin(trace::Point::Submit, type, destination));
+}
+
+esp_err_t sendVirtual(uint8_t node, uint16_t seq, FrameType type, const uint8_t *data, size_t size, const uint8_t *destination)
+{
+    if (size > MaxVirtualPayload)
+        return ESP_ERR_INVALID_SIZE;
+
+    std::array<uint8_t, MaxFramePayload> payload;
+    const VirtualHeader header{ .node = node };
+    std::memcpy(payload.data(), &header, sizeof(header));
+    std::memcpy(payload.data() + sizeof(header), data, size);
+
+    const VirtualSender virtualSender{ .node = node, .seq = seq };
+    return sendFrame(type, payload.data(), sizeof(header) + size, destination, &virtualSender, trace::begin(trace::Point::Submit, type, destination));
+}
+
+esp_err_t queueEspNow(FrameType type, const uint8_t *data, size_t size, const uint8_t *destination, TickType_t timeout)
+{
+    return queueEspNow(type, data, size, destination, timeout, defaultTrafficClass(type));
+}
+
+esp_err_t queueEspNow(FrameType type, const uint8_t *data, size_t size, const uint8_t *destination, TickType_t timeout, TrafficClass trafficClass)
+{
+    if (!txPending)
+        return ESP_ERR_ESPNOW_NOT_INIT;
+
+    if (size > MaxFramePayload)
+        return ESP_ERR_INVALID_SIZE;
+
+    TxItem item{
+        .type = type,
+        .size = uint8_t(size),
+        .queuedUs = uint32_t(esp_timer_get_time()),
+        .traceId = trace::begin(trace::Point::Submit, type, destination)
+    };
+    std::copy(destination, destination + ESP_NOW_ETH_ALEN, std::begin(item.destination));
+    std::memcpy(item.data.data(), data, size);
+
+    auto &classStats = txClassStats[size_t(trafficClass)];
+    if (xQueueSend(txQueues[size_t(trafficClass)], &item, timeout) != pdTRUE)
+    {
+        txStats.queueFull++;
+        classStats.queueFull++;
+        return ESP_ERR_ESPNOW_NO_MEM;
+    }
+    classStats.queued++;
+    xSemaphoreGive(txPending);
+
+    return ESP_OK;
+}
+
+size_t txQueueLength()
+{
+    return txQueueLength(TrafficClass::Control) + txQueueLength(TrafficClass::Bulk);
+}
+
+size_t txQueueLength(TrafficClass trafficClass)
+{
+    const auto queue = txQueues[size_t(trafficClass)];
+    return queue ? uxQueueMessagesWaiting(queue) : 0;
+}
+
+uint32_t inFlight()
+{
+    return txStats.sent - (txStats.success + txStats.fail);
+}
+
+uint32_t inFlightLimit()
+{
+    return paceWindowX16 / 16;
+}
 
 extern "C" void _recvCb(const uint8_t *mac_addr, const uint8_t *data, int data_len)
 {
-    const std::string_view data_str{(const char*) data, size_t(data_len)};
-    char macStr[18] = {0};
-    sprintf(macStr, "%02x:%02x:%02x:%02x:%02x:%02x", mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-    const std::string out = fmt::format("\u001b[32m[{}] --> {}\u001b[0m\n", macStr, data_str);
-    uart_write_bytes(CONFIG_ESP_CONSOLE_UART_NUM, out.data(), out.size());
+    cycles::Scope cycleScope{cycles::Path::Receive};
+    telemetry::HotPath hotPath;
+
+    // before anything else looks at the frame, rejected frames are only counted
+    if (!filter::accept(mac_addr, data, data_len))
+        return;
+
+    std::string_view data_str{(const char*) data, size_t(data_len)};
+
+    RecvRecord record{ .timestamp = esp_timer_get_time(), .header = {}, .length = uint16_t(data_len) };
+    std::copy(mac_addr, mac_addr + ESP_NOW_ETH_ALEN, std::begin(record.mac));
+
+    // frames without our magic are output raw, they are from other esp-now senders
+    std::array<uint8_t, MaxFramePayload> decompressed;
+    if (data_len >= int(sizeof(FrameHeader)) && data[0] == FrameMagic)
+    {
+        std::memcpy(&record.header, data, sizeof(record.header));
+        record.traceId = trace::begin(trace::Point::Receive, record.header.type, mac_addr);
+        trace::setSeq(record.traceId, record.header.seq);
+        record.metadata = sniffer::lookup(mac_addr, record.header.seq, record.header.flags & FrameFlagBroadcast);
+        data_str.remove_prefix(sizeof(record.header));
+
+        if (record.header.flags & FrameFlagCompressed)
+        {
+            const auto size = compression::decompress((const uint8_t *)data_str.data(), data_str.size(), decompressed.data(), decompressed.size());
+            if (!size)
+            {
+                rxStats.decodeErrors++;
+                ESP_LOGW(TAG, "dropping compressed frame seq=%hu that failed to decompress", record.header.seq);
+                return;
+            }
+            data_str = std::string_view{(const char *)decompressed.data(), *size};
+        }
+
+        if (record.header.flags & FrameFlagVirtual)
+        {
+            if (data_str.size() < sizeof(VirtualHeader))
+            {
+                rxStats.decodeErrors++;
+                return;
+            }
+            record.virtualNode = uint8_t(data_str[0]);
+        }
+
+        rxStats.frames++;
+        rxStats.bytes += data_len;
+        accountFrame(record);
+
+        // load from a virtual node is only counted and output, with the VirtualHeader so captures keep the node
+        if (record.virtualNode)
+        {
+            output::enqueue(record, data_str);
+            return;
+        }
+
+        // the wrapped frame is handled like a direct one from the origin, forwarded frames end here
+        if (record.header.type == FrameType::Relay && !relay::handleFrame(record, data_str))
+            return;
+
+        switch (record.header.type)
+        {
+        case FrameType::Ping:
+        case FrameType::Pong:
+            ping::handleFrame(record, data_str);
+            break;
+        case FrameType::OtaOffer:
+        case FrameType::OtaRequest:
+        case FrameType::OtaChunk:
+            ota::handleFrame(record, data_str);
+            break;
+        case FrameType::TimeSyncRequest:
+        case FrameType::TimeSyncResponse:
+            timesync::handleFrame(record, data_str);
+            break;
+        default:
+            break;
+        }
+        trace::mark(record.traceId, trace::Point::Handled);
+    }
+
+    output::enqueue(record, data_str);
 }
 
 extern "C" void _sendCb(const uint8_t *mac_addr, esp_now_send_status_t status)
 {
+    cycles::Scope cycleScope{cycles::Path::SendCallback};
+    telemetry::HotPath hotPath;
+
+    const uint32_t completed = txStats.success + txStats.fail;
+    const uint32_t latency = uint32_t(esp_timer_get_time()) - sendTimestamps[completed % sendTimestamps.size()];
+    txStats.latencySumUs += latency;
+    // compare and store in one step, a concurrent update or reset must not be overwritten with a stale maximum
+    for (uint32_t max = txStats.latencyMaxUs; latency > max && !txStats.latencyMaxUs.compare_exchange_weak(max, latency);)
+        ;
+    txStats.latencyHistogram[std::upper_bound(std::begin(latencyBucketLimitsUs), std::end(latencyBucketLimitsUs), latency) - std::begin(latencyBucketLimitsUs)]++;
+
+    if (!isBroadcast(mac_addr))
+        rate::account(sendRates[completed % sendRates.size()], status == ESP_NOW_SEND_SUCCESS);
+
+    const auto traceId = sendTraceIds[completed % sendTraceIds.size()].load();
+    trace::mark(traceId, trace::Point::SendCallback);
+    trace::finish(traceId);
+
+    completedSinceDecrease++;
+    if (status == ESP_NOW_SEND_SUCCESS)
+    {
+        txStats.success++;
+        paceIncrease();
+    }
+    else
+    {
+        txStats.fail++;
+        paceDecrease(3, 4);
+    }
+
+    if (txTaskHandle)
+        xTaskNotifyGive(txTaskHandle);
+
     /*
     char macStr[18] = {0};
     sprintf(macStr, "%02x:%02x:%02x:%02x:%02x:%02x", mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
@@ -80,6 +495,78 @@ extern "C" void _sendCb(const uint8_t *mac_addr, esp_now_send_status_t status)
      */
 }
 
+std::optional<esp_now_peer_info_t> findPeer(const uint8_t *mac)
+{
+    std::lock_guard lock{peersMutex};
+
+    for (const auto &peer : peers)
+        if (std::memcmp(peer.peer_addr, mac, ESP_NOW_ETH_ALEN) == 0)
+            return peer;
+
+    return std::nullopt;
+}
+
+std::vector<esp_now_peer_info_t> peersSnapshot()
+{
+    std::lock_guard lock{peersMutex};
+    return peers;
+}
+
+bool peerHasKey(const uint8_t *mac)
+{
+    for (size_t i = 0; i < peerStatus.size(); i++)
+    {
+        const auto &peerConfig = configs.espnow_peers[i];
+        if (peerStatus[i] == PeerStatus::Active &&
+            peerConfig.encrypt.value &&
+            peerConfig.mac.value &&
+            std::equal(std::begin(*peerConfig.mac.value), std::end(*peerConfig.mac.value), mac))
+            return true;
+    }
+
+    return false;
+}
+
+esp_err_t setPeerEncrypted(const uint8_t *mac, bool encrypt)
+{
+    std::lock_guard lock{peersMutex};
+
+    for (auto &peer : peers)
+    {
+        if (std::memcmp(peer.peer_addr, mac, ESP_NOW_ETH_ALEN) != 0)
+            continue;
+
+        if (peer.encrypt == encrypt)
+            return ESP_OK;
+
+        auto modified = peer;
+        modified.encrypt = encrypt;
+        if (const auto error = esp_now_mod_peer(&modified); error != ESP_OK)
+        {
+            ESP_LOGE(TAG, "esp_now_mod_peer failed with %s", esp_err_to_name(error));
+            return error;
+        }
+        peer = modified;
+        return ESP_OK;
+    }
+
+    return ESP_ERR_ESPNOW_NOT_FOUND;
+}
+
+esp_err_t setPhyRateOverride(std::optional<wifi_phy_rate_t> rate)
+{
+    {
+        std::lock_guard lock{radioMutex};
+        rateOverride = rate;
+        appliedRate = std::nullopt;
+    }
+
+    syncRadio();
+
+    std::lock_guard lock{radioMutex};
+    return appliedRate == (rate ? *rate : rate::selected().value_or(configs.espnowRate.value)) ? ESP_OK : ESP_FAIL;
+}
+
 std::vector<esp_now_peer_info_t> peers{};
 } // namespace espnow
 
@@ -87,6 +574,18 @@ void initEspNow()
 {
     ESP_LOGI(TAG, "Initializing ESP-NOW");
 
+    if (!configsSubscribed)
+    {
+        subscribeConfigs();
+        configsSubscribed = true;
+    }
+
+    if (!txPending)
+        createTxQueue();
+
+    // the peer list never grows past the driver limit, so it never reallocates after boot
+    espnow::peers.reserve(ESP_NOW_MAX_TOTAL_PEER_NUM);
+
     switch (initState)
     {
     case InitState::UNINITIALIZED:
@@ -119,8 +618,7 @@ void initEspNow()
         initState = InitState::ADD_PEER;
     case InitState::ADD_PEER:
     {
-        espnow::peers.push_back(esp_now_peer_info_t{});
-        esp_now_peer_info_t &peer = espnow::peers.back();
+        esp_now_peer_info_t peer{};
         std::memcpy(peer.peer_addr, broadcastAddress, sizeof(peer.peer_addr));
         peer.channel = 0;
 
@@ -133,10 +631,29 @@ void initEspNow()
             return;
         }
 
-        if (const auto error = esp_now_add_peer(&espnow::peers.back()); error != ESP_OK) {
+        if (const auto error = esp_now_add_peer(&peer); error != ESP_OK && error != ESP_ERR_ESPNOW_EXIST) {
             ESP_LOGE(TAG, "esp_now_add_peer failed with %s", esp_err_to_name(error));
             return;
         }
+
+        {
+            std::lock_guard lock{peersMutex};
+            espnow::peers.push_back(peer);
+        }
+
+        appliedPmk = std::nullopt;
+        lastDesiredPeerCount = 0;
+        syncPmk();
+        syncPeers();
+
+        {
+            std::lock_guard lock{radioMutex};
+            appliedRate = std::nullopt;
+            appliedLongRange = std::nullopt;
+            appliedTxPower = std::nullopt;
+        }
+        syncRadio();
+
         initState = InitState::INIT_DONE;
     }
     case InitState::INIT_DONE:
@@ -155,6 +672,8 @@ void deinitEspNow()
     switch (initState)
     {
     case InitState::INIT_DONE:
+        espnow::sniffer::stop();
+
         // del all peers
         for (const auto &peer: espnow::peers) {
             if (const auto error = esp_now_del_peer(peer.peer_addr); error != ESP_OK) {
@@ -166,7 +685,11 @@ void deinitEspNow()
                 return;
             }
         }
-        espnow::peers.clear();
+        {
+            std::lock_guard lock{peersMutex};
+            espnow::peers.clear();
+        }
+        espnow::peerStatus.fill(espnow::PeerStatus::Unused);
         initState = InitState::ADD_PEER;
     case InitState::ADD_PEER:
         if (const auto error = esp_now_unregister_send_cb(); error != ESP_OK) {
@@ -223,24 +746,526 @@ void handleEspNow()
 
     if (initState != InitState::INIT_DONE)
         return;
+
+    // parsing the keys and building the peer list is only done after their configs changed
+    if (peerConfigChanged.exchange(false))
+    {
+        syncPmk();
+        syncPeers();
+    }
+    syncRadio();
+    espnow::sniffer::update();
+    espnow::ota::update();
+    espnow::timesync::update();
+    espnow::relay::update();
+    espnow::rate::update();
+    espnow::filter::update();
+    espnow::trace::update();
 }
 
-esp_err_t sendEspNow(std::string data)
+esp_err_t sendEspNow(std::string_view data)
 {
-    return espnow::_sendEspNowImpl(reinterpret_cast<uint8_t *>(data.data()), data.size(), broadcastAddress);
+    return espnow::_sendEspNowImpl(espnow::FrameType::Text, reinterpret_cast<const uint8_t *>(data.data()), data.size(), broadcastAddress);
 }
 
-esp_err_t sendEspNow(std::string data, uint8_t *destination)
+esp_err_t sendEspNow(std::string_view data, uint8_t *destination)
 {
-    return espnow::_sendEspNowImpl(reinterpret_cast<uint8_t *>(data.data()), data.size(), destination);
+    return espnow::_sendEspNowImpl(espnow::FrameType::Text, reinterpret_cast<const uint8_t *>(data.data()), data.size(), destination);
 }
 
 esp_err_t sendEspNow(uint8_t *data, size_t size)
 {
-    return espnow::_sendEspNowImpl(data, size, broadcastAddress);
+    return espnow::_sendEspNowImpl(espnow::FrameType::Text, data, size, broadcastAddress);
 }
 
 esp_err_t sendEspNow(uint8_t *data, size_t size, uint8_t *destination)
 {
-    return espnow::_sendEspNowImpl(data, size, destination);
+    return espnow::_sendEspNowImpl(espnow::FrameType::Text, data, size, destination);
+}
+
+namespace {
+std::optional<key_t> parseKey(std::string_view hex)
+{
+    if (hex.size() != ESP_NOW_KEY_LEN * 2)
+        return std::nullopt;
+
+    constexpr auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+
+    key_t key;
+    for (size_t i = 0; i < key.size(); i++)
+    {
+        const auto high = nibble(hex[i * 2]);
+        const auto low = nibble(hex[i * 2 + 1]);
+        if (high < 0 || low < 0)
+            return std::nullopt;
+        key[i] = (high << 4) | low;
+    }
+
+    return key;
+}
+
+void paceIncrease()
+{
+    // + 1/window per completed frame, one frame per window
+    const uint32_t window = paceWindowX16;
+    if (window >= MaxInFlight * 16)
+        return;
+    paceWindowX16 += std::max<uint32_t>(1, 256 / window);
+}
+
+void paceDecrease(uint32_t numerator, uint32_t denominator)
+{
+    // the frames of the current window fail together, only the first failure counts
+    uint32_t window = paceWindowX16;
+    if (completedSinceDecrease < window / 16)
+        return;
+
+    const uint32_t reduced = std::max(MinInFlight * 16, window * numerator / denominator);
+    if (reduced == window || !paceWindowX16.compare_exchange_strong(window, reduced))
+        return;
+
+    completedSinceDecrease = 0;
+    espnow::txStats.paceDecreases++;
+}
+
+void logSendError(esp_err_t error)
+{
+    const uint32_t now = esp_timer_get_time() / 1000;
+    uint32_t last = lastSendErrorLogMs;
+    if (now - last < SendErrorLogIntervalMs || !lastSendErrorLogMs.compare_exchange_strong(last, now))
+    {
+        sendErrorsSinceLog++;
+        espnow::txStats.unloggedErrors++;
+        return;
+    }
+
+    if (const uint32_t unlogged = sendErrorsSinceLog.exchange(0))
+        ESP_LOGE(TAG, "esp_now_send failed: %s (%u more errors in the last %ums)", esp_err_to_name(error), unlogged, now - last);
+    else
+        ESP_LOGE(TAG, "esp_now_send failed: %s", esp_err_to_name(error));
+}
+
+bool isBroadcast(const uint8_t *mac)
+{
+    return std::memcmp(mac, broadcastAddress, ESP_NOW_ETH_ALEN) == 0;
+}
+
+wifi_interface_t peerInterface()
+{
+    return sendInterface;
+}
+
+uint16_t nextSeqFor(const uint8_t *mac)
+{
+    const auto used = std::min(txSequenceCount, txSequences.size());
+    for (size_t i = 0; i < used; i++)
+        if (std::memcmp(txSequences[i].mac.data(), mac, ESP_NOW_ETH_ALEN) == 0)
+            return txSequences[i].next++;
+
+    // more destinations than the driver allows peers, the oldest counter restarts
+    auto &sequence = txSequences[txSequenceCount++ % txSequences.size()];
+    std::copy(mac, mac + ESP_NOW_ETH_ALEN, std::begin(sequence.mac));
+    sequence.next = 0;
+    return sequence.next++;
+}
+
+void createTxQueue()
+{
+    const auto cleanup = [](){
+        for (auto &queue : txQueues)
+            if (queue)
+            {
+                vQueueDelete(queue);
+                queue = nullptr;
+            }
+        if (txPending)
+        {
+            vSemaphoreDelete(txPending);
+            txPending = nullptr;
+        }
+    };
+
+    for (size_t i = 0; i < txQueues.size(); i++)
+        if (txQueues[i] = xQueueCreate(txQueueLengths[i], sizeof(TxItem)); !txQueues[i])
+        {
+            ESP_LOGE(TAG, "xQueueCreate() failed");
+            cleanup();
+            return;
+        }
+
+    txPending = xSemaphoreCreateCounting(txQueueLengths[0] + txQueueLengths[1], 0);
+    if (!txPending)
+    {
+        ESP_LOGE(TAG, "xSemaphoreCreateCounting() failed");
+        cleanup();
+        return;
+    }
+
+    if (const auto result = xTaskCreatePinnedToCore(txTask, "espnowTx", 4096, nullptr, configs.espnowTxPrio.value, &txTaskHandle, configs.radioCore.value); result != pdPASS)
+    {
+        ESP_LOGE(TAG, "xTaskCreatePinnedToCore() failed with %i", result);
+        cleanup();
+    }
+}
+
+void txTask(void *)
+{
+    using espnow::TrafficClass;
+    auto &txStats = espnow::txStats;
+
+    TxItem item;
+
+    while (true)
+    {
+        if (xSemaphoreTake(txPending, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        const auto controlQueue = txQueues[size_t(TrafficClass::Control)];
+
+        // bulk frames wait for the driver queue to drain, a control frame queued meanwhile overtakes them
+        if (!uxQueueMessagesWaiting(controlQueue))
+            for (int i = 0; i < 10 && !uxQueueMessagesWaiting(controlQueue) && espnow::inFlight() >= std::min(BulkInFlight, espnow::inFlightLimit()); i++)
+                ulTaskNotifyTake(pdTRUE, 1);
+
+        // strict priority, a bulk frame is only taken while no control frame waits
+        auto trafficClass = TrafficClass::Control;
+        if (xQueueReceive(controlQueue, &item, 0) != pdTRUE)
+        {
+            if (xQueueReceive(txQueues[size_t(TrafficClass::Bulk)], &item, 0) != pdTRUE)
+                continue;
+            trafficClass = TrafficClass::Bulk;
+        }
+
+        telemetry::HotPath hotPath;
+        espnow::trace::mark(item.traceId, espnow::trace::Point::Dequeue);
+
+        auto &classStats = espnow::txClassStats[size_t(trafficClass)];
+        const uint32_t waitUs = uint32_t(esp_timer_get_time()) - item.queuedUs;
+        classStats.waitSumUs += waitUs;
+        if (waitUs > classStats.waitMaxUs)
+            classStats.waitMaxUs = waitUs;
+
+        // bulk frames waited above already, control frames only wait for the pacing limit
+        for (int i = 0; i < 10 && espnow::inFlight() >= espnow::inFlightLimit(); i++)
+            ulTaskNotifyTake(pdTRUE, 1);
+
+        // the driver queue is full while frames are on the air, the send callback wakes us up
+        ulTaskNotifyTake(pdTRUE, 0);
+        for (int retries = 0; retries < 10; retries++)
+        {
+            const auto result = espnow::sendFrame(item.type, item.data.data(), item.size, item.destination.data(), nullptr, item.traceId);
+            if (result != ESP_ERR_ESPNOW_NO_MEM)
+                break;
+            ulTaskNotifyTake(pdTRUE, 1);
+        }
+    }
+}
+
+void accountFrame(const espnow::RecvRecord &record)
+{
+    using namespace espnow;
+
+    if (rxStatsResetRequested.exchange(false))
+    {
+        peerRxStatsCount = 0;
+        rateRxStats = {};
+        for (auto &bucket : rssiBuckets)
+            bucket.frames = bucket.lost = 0;
+    }
+
+    const auto begin = std::begin(peerRxStats);
+    const auto end = begin + peerRxStatsCount;
+    auto stats = std::find_if(begin, end, [&](const auto &entry){ return entry.mac == record.mac && entry.virtualNode == record.virtualNode; });
+    if (stats == end)
+    {
+        if (peerRxStatsCount >= peerRxStats.size())
+            return;
+
+        *stats = PeerRxStats{ .mac = record.mac, .virtualNode = record.virtualNode, .rssiMin = INT8_MAX, .rssiMax = INT8_MIN };
+        peerRxStatsCount++;
+    }
+
+    stats->frames++;
+
+    uint32_t lost{};
+    auto &lastSeq = stats->lastSeq[record.header.flags & FrameFlagBroadcast ? 1 : 0];
+    if (lastSeq)
+    {
+        // larger jumps are a restarted sender, not loss
+        if (const uint16_t gap = record.header.seq - *lastSeq - 1; gap < 1024)
+            lost = gap;
+    }
+    lastSeq = record.header.seq;
+    stats->lost += lost;
+
+    if (!record.metadata)
+        return;
+
+    const auto &metadata = *record.metadata;
+    stats->rssiFrames++;
+    stats->rssiSum += metadata.rssi;
+    stats->rssiMin = std::min(stats->rssiMin, metadata.rssi);
+    stats->rssiMax = std::max(stats->rssiMax, metadata.rssi);
+    stats->noiseFloor = metadata.noiseFloor;
+
+    if (metadata.rate < rateRxStats.size())
+    {
+        rateRxStats[metadata.rate].frames++;
+        rateRxStats[metadata.rate].rssiSum += metadata.rssi;
+    }
+
+    for (auto &bucket : rssiBuckets)
+    {
+        if (metadata.rssi < bucket.rssiMin)
+            continue;
+        bucket.frames++;
+        bucket.lost += lost;
+        break;
+    }
 }
+
+void syncPmk()
+{
+    const auto pmk = parseKey(configs.espnowPmk.value);
+    if (!pmk)
+    {
+        // empty or invalid pmk, the driver keeps its built-in default
+        return;
+    }
+
+    if (pmk == appliedPmk)
+        return;
+
+    if (const auto error = esp_now_set_pmk(pmk->data()); error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_now_set_pmk failed with %s", esp_err_to_name(error));
+        peerConfigChanged = true; // retried in the next loop
+        return;
+    }
+
+    ESP_LOGI(TAG, "pmk %s", appliedPmk ? "rotated" : "set");
+    appliedPmk = pmk;
+
+    // the lmks are stored encrypted with the pmk, re-apply all encrypted peers
+    lastDesiredPeerCount = 0;
+    std::lock_guard lock{peersMutex};
+    for (auto &peer : espnow::peers)
+        if (peer.encrypt)
+            if (const auto error = esp_now_mod_peer(&peer); error != ESP_OK)
+                ESP_LOGE(TAG, "esp_now_mod_peer failed with %s", esp_err_to_name(error));
+}
+
+void syncRadio()
+{
+    std::lock_guard lock{radioMutex};
+
+    const auto interface = peerInterface();
+
+    if (const bool longRange = configs.espnowLongRange.value; longRange != appliedLongRange)
+    {
+        const uint8_t protocols = WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N | (longRange ? WIFI_PROTOCOL_LR : 0);
+        if (const auto error = esp_wifi_set_protocol(interface, protocols); error != ESP_OK)
+            ESP_LOGE(TAG, "esp_wifi_set_protocol failed with %s", esp_err_to_name(error));
+        else
+        {
+            ESP_LOGI(TAG, "long range %s", longRange ? "enabled" : "disabled");
+            appliedLongRange = longRange;
+            appliedRate = std::nullopt;
+        }
+    }
+
+    const auto autoRate = espnow::rate::selected();
+    if (const auto rate = rateOverride ? *rateOverride : autoRate.value_or(configs.espnowRate.value); rate != appliedRate)
+    {
+        if (const auto error = esp_wifi_config_espnow_rate(interface, rate); error != ESP_OK)
+            ESP_LOGE(TAG, "esp_wifi_config_espnow_rate %.*s failed with %s",
+                     espnow::toString(rate).size(), espnow::toString(rate).data(), esp_err_to_name(error));
+        else
+        {
+            // the auto rate changes every few windows, its decisions are in the rate trace
+            if (autoRate && !rateOverride)
+                ESP_LOGD(TAG, "phy rate set to %.*s", espnow::toString(rate).size(), espnow::toString(rate).data());
+            else
+                ESP_LOGI(TAG, "phy rate set to %.*s", espnow::toString(rate).size(), espnow::toString(rate).data());
+            appliedRate = rate;
+            appliedRateIndex = espnow::rate::indexOf(rate).value_or(espnow::rate::NoRate);
+        }
+    }
+
+    if (const auto txPower = configs.espnowTxPower.value; txPower != appliedTxPower)
+    {
+        if (const auto error = esp_wifi_set_max_tx_power(txPower); error != ESP_OK)
+            ESP_LOGE(TAG, "esp_wifi_set_max_tx_power %hhd failed with %s", txPower, esp_err_to_name(error));
+        else
+        {
+            ESP_LOGI(TAG, "max tx power set to %.2fdBm", txPower / 4.f);
+            appliedTxPower = txPower;
+        }
+    }
+}
+
+void syncPeers()
+{
+    using espnow::PeerStatus;
+
+    std::array<esp_now_peer_info_t, std::tuple_size_v<decltype(espnow::peerStatus)>> desired{};
+    size_t desiredCount{};
+    size_t encryptedCount{};
+    decltype(espnow::peerStatus) status{};
+
+    for (size_t i = 0; i < status.size(); i++)
+    {
+        const auto &peerConfig = configs.espnow_peers[i];
+        if (!peerConfig.mac.value)
+            continue;
+
+        esp_now_peer_info_t peer{};
+        std::copy(std::begin(*peerConfig.mac.value), std::end(*peerConfig.mac.value), peer.peer_addr);
+        peer.channel = 0;
+        peer.ifidx = peerInterface();
+
+        if (isBroadcast(peer.peer_addr) ||
+            std::any_of(desired.begin(), desired.begin() + desiredCount, [&](const auto &other){
+                return std::memcmp(other.peer_addr, peer.peer_addr, ESP_NOW_ETH_ALEN) == 0;
+            }))
+        {
+            status[i] = PeerStatus::InvalidMac;
+            continue;
+        }
+
+        if (peerConfig.encrypt.value)
+        {
+            const auto lmk = parseKey(peerConfig.lmk.value);
+            if (!lmk)
+            {
+                status[i] = PeerStatus::InvalidKey;
+                continue;
+            }
+
+            if (encryptedCount >= ESP_NOW_MAX_ENCRYPT_PEER_NUM)
+            {
+                status[i] = PeerStatus::EncryptLimit;
+                continue;
+            }
+
+            peer.encrypt = true;
+            std::copy(std::begin(*lmk), std::end(*lmk), peer.lmk);
+            encryptedCount++;
+        }
+
+        // one slot is taken by the broadcast peer
+        if (desiredCount + 1 >= ESP_NOW_MAX_TOTAL_PEER_NUM)
+        {
+            status[i] = PeerStatus::TotalLimit;
+            continue;
+        }
+
+        status[i] = PeerStatus::Active;
+        desired[desiredCount++] = peer;
+    }
+
+    if (desiredCount == lastDesiredPeerCount &&
+        std::memcmp(desired.data(), lastDesiredPeers.data(), desiredCount * sizeof(esp_now_peer_info_t)) == 0)
+    {
+        // failed peers are only retried after their config changed
+        for (size_t i = 0; i < status.size(); i++)
+            if (status[i] != PeerStatus::Active || espnow::peerStatus[i] != PeerStatus::Failed)
+                espnow::peerStatus[i] = status[i];
+        return;
+    }
+
+    lastDesiredPeers = desired;
+    lastDesiredPeerCount = desiredCount;
+
+    std::lock_guard lock{peersMutex};
+    auto &peers = espnow::peers;
+
+    for (auto iter = std::begin(peers); iter != std::end(peers);)
+    {
+        const auto stillWanted = isBroadcast(iter->peer_addr) ||
+                                 std::any_of(desired.begin(), desired.begin() + desiredCount, [&](const auto &peer){
+                                     return std::memcmp(peer.peer_addr, iter->peer_addr, ESP_NOW_ETH_ALEN) == 0;
+                                 });
+        if (stillWanted)
+        {
+            ++iter;
+            continue;
+        }
+
+        if (const auto error = esp_now_del_peer(iter->peer_addr); error != ESP_OK && error != ESP_ERR_ESPNOW_NOT_FOUND)
+            ESP_LOGE(TAG, "esp_now_del_peer failed with %s", esp_err_to_name(error));
+        iter = peers.erase(iter);
+    }
+
+    for (size_t i = 0, d = 0; i < status.size(); i++)
+    {
+        if (status[i] != PeerStatus::Active)
+            continue;
+
+        const auto &peer = desired[d++];
+        const auto macStr = fmt::format("{:02x}:{:02x}:{:02x}:{:02x}:{:02x}:{:02x}",
+                                        peer.peer_addr[0], peer.peer_addr[1], peer.peer_addr[2],
+                                        peer.peer_addr[3], peer.peer_addr[4], peer.peer_addr[5]);
+
+        const auto existing = std::find_if(std::begin(peers), std::end(peers), [&](const auto &other){
+            return std::memcmp(other.peer_addr, peer.peer_addr, ESP_NOW_ETH_ALEN) == 0;
+        });
+
+        if (existing == std::end(peers))
+        {
+            if (const auto error = esp_now_add_peer(&peer); error != ESP_OK)
+            {
+                ESP_LOGE(TAG, "esp_now_add_peer %s failed with %s", macStr.c_str(), esp_err_to_name(error));
+                status[i] = PeerStatus::Failed;
+                continue;
+            }
+            ESP_LOGI(TAG, "added peer %s (%s)", macStr.c_str(), peer.encrypt ? "encrypted" : "plaintext");
+            peers.push_back(peer);
+        }
+        else if (std::memcmp(&*existing, &peer, sizeof(peer)) != 0)
+        {
+            if (const auto error = esp_now_mod_peer(&peer); error != ESP_OK)
+            {
+                ESP_LOGE(TAG, "esp_now_mod_peer %s failed with %s", macStr.c_str(), esp_err_to_name(error));
+                status[i] = PeerStatus::Failed;
+                continue;
+            }
+            ESP_LOGI(TAG, "peer %s %s", macStr.c_str(),
+                     existing->encrypt && peer.encrypt && std::memcmp(existing->lmk, peer.lmk, ESP_NOW_KEY_LEN) != 0 ? "lmk rotated" : "updated");
+            *existing = peer;
+        }
+    }
+
+    espnow::peerStatus = status;
+}
+
+void subscribeConfigs()
+{
+    // the peers are added on the interface of the wifi mode
+    const auto interface = subscribeConfigChanges([](){
+        updateInterface();
+        peerConfigChanged = true;
+    });
+    watchConfigs(interface, configs.wifiApEnabled, configs.wifiStaEnabled);
+    updateInterface();
+
+    const auto peers = subscribeConfigChanges([](){ peerConfigChanged = true; });
+    watchConfig(peers, configs.espnowPmk);
+    for (const auto &peerConfig : configs.espnow_peers)
+        watchConfigs(peers, peerConfig.mac, peerConfig.encrypt, peerConfig.lmk);
+
+    onConfigChange(configs.espnowCompression, [](const bool &enabled){ compressFrames = enabled; });
+    compressFrames = configs.espnowCompression.value;
+}
+
+void updateInterface()
+{
+    interfaceUp = configs.wifiApEnabled.value || configs.wifiStaEnabled.value;
+    sendInterface = configs.wifiApEnabled.value ? WIFI_IF_AP : WIFI_IF_STA;
+}
+} // namespace
@@ -1,25 +1,209 @@
 #pragma once
 
 // system includes
+#include <array>
+#include <atomic>
+#include <iterator>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+// esp-idf includes
+#include <freertos/FreeRTOS.h>
+
 // 3rdparty lib includes
 #include <esp_now.h>
 
+// local includes
+#include "espnowprotocol.h"
+#include "espnowsniffer.h"
+
 void initEspNow();
 void deinitEspNow();
 void handleEspNow();
 
 constexpr const uint8_t broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
-esp_err_t sendEspNow(std::string data);
-esp_err_t sendEspNow(std::string data, uint8_t *destination);
+esp_err_t sendEspNow(std::string_view data);
+esp_err_t sendEspNow(std::string_view data, uint8_t *destination);
 esp_err_t sendEspNow(uint8_t *data, size_t size);
 esp_err_t sendEspNow(uint8_t *data, size_t size, uint8_t *destination);
 
 namespace espnow {
+enum class PeerStatus : uint8_t {
+    Unused,
+    Active,
+    InvalidMac,
+    InvalidKey,
+    EncryptLimit,
+    TotalLimit,
+    Failed
+};
+
+std::string_view toString(PeerStatus status);
+std::string_view toString(TrafficClass trafficClass);
+
+struct PhyRate
+{
+    wifi_phy_rate_t rate;
+    const char *name;
+    bool longRange;
+    uint32_t kbps; // nominal, 20MHz long guard interval for the mcs rates
+};
+
+constexpr const PhyRate phyRates[] {
+    { WIFI_PHY_RATE_1M_L,      "1M",       false, 1000  },
+    { WIFI_PHY_RATE_2M,        "2M",       false, 2000  },
+    { WIFI_PHY_RATE_5M_L,      "5.5M",     false, 5500  },
+    { WIFI_PHY_RATE_11M_L,     "11M",      false, 11000 },
+    { WIFI_PHY_RATE_6M,        "6M",       false, 6000  },
+    { WIFI_PHY_RATE_9M,        "9M",       false, 9000  },
+    { WIFI_PHY_RATE_12M,       "12M",      false, 12000 },
+    { WIFI_PHY_RATE_18M,       "18M",      false, 18000 },
+    { WIFI_PHY_RATE_24M,       "24M",      false, 24000 },
+    { WIFI_PHY_RATE_36M,       "36M",      false, 36000 },
+    { WIFI_PHY_RATE_48M,       "48M",      false, 48000 },
+    { WIFI_PHY_RATE_54M,       "54M",      false, 54000 },
+    { WIFI_PHY_RATE_MCS0_LGI,  "MCS0",     false, 6500  },
+    { WIFI_PHY_RATE_MCS1_LGI,  "MCS1",     false, 13000 },
+    { WIFI_PHY_RATE_MCS2_LGI,  "MCS2",     false, 19500 },
+    { WIFI_PHY_RATE_MCS3_LGI,  "MCS3",     false, 26000 },
+    { WIFI_PHY_RATE_MCS4_LGI,  "MCS4",     false, 39000 },
+    { WIFI_PHY_RATE_MCS5_LGI,  "MCS5",     false, 52000 },
+    { WIFI_PHY_RATE_MCS6_LGI,  "MCS6",     false, 58500 },
+    { WIFI_PHY_RATE_MCS7_LGI,  "MCS7",     false, 65000 },
+    { WIFI_PHY_RATE_LORA_250K, "LR 250K",  true,  250   },
+    { WIFI_PHY_RATE_LORA_500K, "LR 500K",  true,  500   },
+};
+
+std::string_view toString(wifi_phy_rate_t rate);
+
+// upper bounds of the send latency histogram buckets, the last bucket takes everything above
+constexpr const uint32_t latencyBucketLimitsUs[] = {250, 500, 1000, 2000, 4000, 8000, 16000};
+constexpr const size_t LatencyBuckets = std::size(latencyBucketLimitsUs) + 1;
+
+struct TxStats
+{
+    std::atomic<uint32_t> sent{};
+    std::atomic<uint32_t> sendErrors{};
+    std::atomic<uint32_t> noMem{}; // part of sendErrors, the driver queue was full
+    std::atomic<uint32_t> unloggedErrors{}; // send errors not logged because of the log rate limit
+    std::atomic<uint32_t> paceDecreases{}; // in flight limit reductions, after noMem or failed sends
+    std::atomic<uint32_t> queueFull{};
+    std::atomic<uint32_t> success{};
+    std::atomic<uint32_t> fail{};
+    std::atomic<uint32_t> latencySumUs{};
+    std::atomic<uint32_t> latencyMaxUs{};
+    std::array<std::atomic<uint32_t>, LatencyBuckets> latencyHistogram{};
+};
+
+// time from queueEspNow() until the espnowTx task hands the frame to the driver
+struct TxClassStats
+{
+    std::atomic<uint32_t> queued{};
+    std::atomic<uint32_t> queueFull{};
+    std::atomic<uint32_t> waitSumUs{};
+    std::atomic<uint32_t> waitMaxUs{};
+};
+
+struct RxStats
+{
+    std::atomic<uint32_t> frames{};
+    std::atomic<uint32_t> bytes{};
+    std::atomic<uint32_t> decodeErrors{};
+};
+
+extern TxStats txStats;
+extern std::array<TxClassStats, TrafficClassCount> txClassStats; // indexed by TrafficClass
+extern RxStats rxStats;
+
+struct RecvRecord
+{
+    int64_t timestamp;
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> mac;
+    FrameHeader header; // zeroed for frames without our magic
+    uint8_t virtualNode; // 0 unless the header has FrameFlagVirtual
+    uint16_t traceId; // trace::NoTrace unless the frame was sampled by espnow::trace
+    uint16_t length;
+    std::optional<sniffer::RxMetadata> metadata; // only with configs.espnowRssiCapture
+    bool relayed; // mac is the origin from the unauthenticated relay header, not the neighbour that sent the frame
+};
+
+// only written from the wifi task, readers may see partially updated entries
+struct PeerRxStats
+{
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> mac;
+    uint8_t virtualNode; // virtual nodes of one board are counted separately
+    uint32_t frames;
+    uint32_t lost; // gaps in seq
+    std::array<std::optional<uint16_t>, 2> lastSeq; // unicast, broadcast
+    uint32_t rssiFrames;
+    int32_t rssiSum;
+    int8_t rssiMin;
+    int8_t rssiMax;
+    int8_t noiseFloor;
+
+    float lossPercent() const;
+    std::optional<float> avgRssi() const;
+};
+
+struct RateRxStats
+{
+    uint32_t frames;
+    int32_t rssiSum;
+};
+
+// frames and seq gaps by the rssi of the frame that ended the gap, 10dB per bucket
+struct RssiBucket
+{
+    int8_t rssiMin;
+    uint32_t frames;
+    uint32_t lost;
+};
+
+extern std::array<PeerRxStats, 32> peerRxStats;
+extern size_t peerRxStatsCount;
+extern std::array<RateRxStats, sniffer::RateCount> rateRxStats;
+extern std::array<RssiBucket, 6> rssiBuckets;
+
+// applied by the next received frame, the stats are only modified from the wifi task
+void resetRxStats();
+
 bool initAllowed();
-esp_err_t _sendEspNowImpl(uint8_t *data, size_t size, const uint8_t *destination);
+esp_err_t _sendEspNowImpl(FrameType type, const uint8_t *data, size_t size, const uint8_t *destination);
+
+// sends straight to the driver as virtual node 1..255 with its own seq, for the tester load generator
+esp_err_t sendVirtual(uint8_t node, uint16_t seq, FrameType type, const uint8_t *data, size_t size, const uint8_t *destination);
+
+// copies the frame into the tx queue of its class, the espnowTx task sends it and retries while the driver is busy.
+// without a class the default of the frame type is used
+esp_err_t queueEspNow(FrameType type, const uint8_t *data, size_t size, const uint8_t *destination, TickType_t timeout = 0);
+esp_err_t queueEspNow(FrameType type, const uint8_t *data, size_t size, const uint8_t *destination, TickType_t timeout, TrafficClass trafficClass);
+
+// frames waiting in the tx queues
+size_t txQueueLength();
+size_t txQueueLength(TrafficClass trafficClass);
+
+// frames handed to the driver whose send callback did not fire yet
+uint32_t inFlight();
+
+// aimd limit for inFlight(), grows by one per window of completed frames, halved on ESP_ERR_ESPNOW_NO_MEM
+// and reduced by a quarter on failed sends, at most once per window. senders should wait below it
+uint32_t inFlightLimit();
+
+// status of the configured peers in configs.espnow_peers, same order
+extern std::array<PeerStatus, 8> peerStatus;
+
+std::optional<esp_now_peer_info_t> findPeer(const uint8_t *mac);
+
+// copy of peers, taken under the lock that guards it, for readers outside of espnow.cpp
+std::vector<esp_now_peer_info_t> peersSnapshot();
+bool peerHasKey(const uint8_t *mac);
+esp_err_t setPeerEncrypted(const uint8_t *mac, bool encrypt);
+
+// temporarily replaces configs.espnowRate, used by the tester rate sweep
+esp_err_t setPhyRateOverride(std::optional<wifi_phy_rate_t> rate);
+
 extern std::vector<esp_now_peer_info_t> peers;
 } // namespace espnow
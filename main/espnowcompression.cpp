@@ -0,0 +1,253 @@
+#include "espnowcompression.h"
+
+// system includes
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string_view>
+
+// esp-idf includes
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+// local includes
+#include "espnowprotocol.h"
+
+namespace espnow::compression {
+namespace {
+constexpr const char * const TAG = "ESP_NOW_LZ";
+
+// prepended to every frame on both sides, so common words are encodable as
+// back references right from the first byte
+constexpr std::string_view dictionary{
+    "ESP-NOW esp-now tester ping pong flood send recv bridge seq= len= rssi= rate= "
+    "peer mac= --> <-- ok error failed success true false null "
+    "0123456789abcdef ABCDEFGHIJKLMNOPQRSTUVWXYZ abcdefghijklmnopqrstuvwxyz \r\n"
+};
+
+constexpr size_t MinMatch = 3;
+constexpr size_t MaxMatch = MinMatch + 15;
+constexpr size_t MaxDistance = 4096;
+constexpr size_t MaxChain = 16;
+constexpr size_t MinCompressSize = 16;
+
+constexpr size_t WindowSize = dictionary.size() + MaxFramePayload;
+
+static_assert(WindowSize <= MaxDistance);
+
+uint8_t hash3(const uint8_t *p)
+{
+    return (p[0] * 33u * 33u + p[1] * 33u + p[2]) & 0xFF;
+}
+} // namespace
+
+Stats stats;
+
+std::optional<size_t> compress(const uint8_t *in, size_t inSize, uint8_t *out, size_t outCapacity)
+{
+    if (inSize > MaxFramePayload)
+        return std::nullopt;
+
+    std::array<uint8_t, WindowSize> window;
+    std::memcpy(window.data(), dictionary.data(), dictionary.size());
+    std::memcpy(window.data() + dictionary.size(), in, inSize);
+
+    const size_t total = dictionary.size() + inSize;
+
+    std::array<int16_t, 256> head;
+    head.fill(-1);
+    std::array<int16_t, WindowSize> prev;
+
+    const auto insert = [&](size_t p){
+        if (p + MinMatch > total)
+            return;
+        const auto h = hash3(&window[p]);
+        prev[p] = head[h];
+        head[h] = p;
+    };
+
+    for (size_t p = 0; p < dictionary.size(); p++)
+        insert(p);
+
+    size_t outPos{};
+    size_t ctrlPos{};
+    uint8_t bit{8};
+
+    for (size_t pos = dictionary.size(); pos < total; bit++)
+    {
+        if (bit == 8)
+        {
+            if (outPos >= outCapacity)
+                return std::nullopt;
+            ctrlPos = outPos++;
+            out[ctrlPos] = 0;
+            bit = 0;
+        }
+
+        size_t bestLen{};
+        size_t bestDist{};
+
+        if (pos + MinMatch <= total)
+        {
+            const size_t maxLen = std::min(MaxMatch, total - pos);
+            int16_t candidate = head[hash3(&window[pos])];
+            for (size_t chain = 0; candidate >= 0 && chain < MaxChain; chain++, candidate = prev[candidate])
+            {
+                size_t len{};
+                while (len < maxLen && window[candidate + len] == window[pos + len])
+                    len++;
+
+                if (len > bestLen)
+                {
+                    bestLen = len;
+                    bestDist = pos - candidate;
+                    if (len == maxLen)
+                        break;
+                }
+            }
+        }
+
+        if (bestLen >= MinMatch)
+        {
+            if (outPos + 2 > outCapacity)
+                return std::nullopt;
+
+            out[ctrlPos] |= 1 << bit;
+            out[outPos++] = (bestDist - 1) >> 4;
+            out[outPos++] = (((bestDist - 1) & 0x0F) << 4) | (bestLen - MinMatch);
+
+            for (size_t i = 0; i < bestLen; i++)
+                insert(pos + i);
+            pos += bestLen;
+        }
+        else
+        {
+            if (outPos >= outCapacity)
+                return std::nullopt;
+
+            out[outPos++] = window[pos];
+            insert(pos);
+            pos++;
+        }
+    }
+
+    return outPos;
+}
+
+std::optional<size_t> decompress(const uint8_t *in, size_t inSize, uint8_t *out, size_t outCapacity)
+{
+    size_t pos{};
+    size_t outPos{};
+
+    while (pos < inSize)
+    {
+        const uint8_t ctrl = in[pos++];
+        for (uint8_t bit = 0; bit < 8 && pos < inSize; bit++)
+        {
+            if (ctrl & (1 << bit))
+            {
+                if (pos + 2 > inSize)
+                    return std::nullopt;
+
+                const size_t dist = ((size_t(in[pos]) << 4) | (in[pos + 1] >> 4)) + 1;
+                const size_t len = (in[pos + 1] & 0x0F) + MinMatch;
+                pos += 2;
+
+                if (dist > dictionary.size() + outPos || outPos + len > outCapacity)
+                    return std::nullopt;
+
+                for (size_t i = 0; i < len; i++, outPos++)
+                {
+                    const size_t src = dictionary.size() + outPos - dist;
+                    out[outPos] = src < dictionary.size() ? dictionary[src] : out[src - dictionary.size()];
+                }
+            }
+            else
+            {
+                if (outPos >= outCapacity)
+                    return std::nullopt;
+                out[outPos++] = in[pos++];
+            }
+        }
+    }
+
+    return outPos;
+}
+
+std::optional<size_t> compressFrame(const uint8_t *in, size_t inSize, uint8_t *out)
+{
+    if (inSize < MinCompressSize)
+    {
+        stats.rawFrames++;
+        return std::nullopt;
+    }
+
+    const auto before = esp_timer_get_time();
+    const auto result = compress(in, inSize, out, inSize - 1);
+    stats.compressMicros += esp_timer_get_time() - before;
+
+    if (!result)
+    {
+        stats.rawFrames++;
+        return std::nullopt;
+    }
+
+    stats.compressedFrames++;
+    stats.bytesIn += inSize;
+    stats.bytesOut += *result;
+    return result;
+}
+
+void runBenchmark()
+{
+    constexpr int iterations = 100;
+
+    std::array<uint8_t, MaxFramePayload> randomData;
+    esp_fill_random(randomData.data(), randomData.size());
+
+    std::array<uint8_t, MaxFramePayload> zeroData{};
+
+    const std::pair<const char *, std::string_view> samples[] {
+        { "short text", "ping seq=42" },
+        { "status text", "tester flood peer mac=ff:ff:ff:ff:ff:ff seq=000123 len=200 rssi=-67 rate=1M ok\r\n" },
+        { "bridge text", "[00:01:02] sensor reading temperature=21.5 humidity=43.2 pressure=1013.2\r\n"
+                         "[00:01:03] sensor reading temperature=21.5 humidity=43.1 pressure=1013.2\r\n" },
+        { "zeros", { (const char *)zeroData.data(), zeroData.size() } },
+        { "random", { (const char *)randomData.data(), randomData.size() } },
+    };
+
+    for (const auto &[name, sample] : samples)
+    {
+        const auto *in = reinterpret_cast<const uint8_t *>(sample.data());
+
+        std::array<uint8_t, MaxFramePayload> compressed;
+        std::optional<size_t> compressedSize;
+        const auto compressStart = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++)
+            compressedSize = compress(in, sample.size(), compressed.data(), sample.size() - 1);
+        const auto compressTime = (esp_timer_get_time() - compressStart) / iterations;
+
+        if (!compressedSize)
+        {
+            ESP_LOGI(TAG, "%-12s %3zu bytes: not compressible, compress attempt %lldus (sent raw)", name, sample.size(), compressTime);
+            continue;
+        }
+
+        std::array<uint8_t, MaxFramePayload> decompressed;
+        std::optional<size_t> decompressedSize;
+        const auto decompressStart = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++)
+            decompressedSize = decompress(compressed.data(), *compressedSize, decompressed.data(), decompressed.size());
+        const auto decompressTime = (esp_timer_get_time() - decompressStart) / iterations;
+
+        const bool roundtripOk = decompressedSize && *decompressedSize == sample.size() &&
+                                 std::equal(in, in + sample.size(), decompressed.data());
+
+        // 1 Mbit/s is the default esp-now phy rate, 8us per byte on air
+        ESP_LOGI(TAG, "%-12s %3zu -> %3zu bytes, compress %lldus, decompress %lldus, airtime saved %zuus @1Mbps%s",
+                 name, sample.size(), *compressedSize, compressTime, decompressTime,
+                 (sample.size() - *compressedSize) * 8, roundtripOk ? "" : " ROUNDTRIP FAILED");
+    }
+}
+} // namespace espnow::compression
@@ -0,0 +1,30 @@
+#pragma once
+
+// system includes
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+
+namespace espnow::compression {
+struct Stats
+{
+    std::atomic<uint32_t> compressedFrames{};
+    std::atomic<uint32_t> rawFrames{};
+    std::atomic<uint32_t> bytesIn{};
+    std::atomic<uint32_t> bytesOut{};
+    std::atomic<uint32_t> compressMicros{};
+};
+
+extern Stats stats;
+
+// LZSS with a shared static dictionary, returns std::nullopt when the result
+// would not fit into outCapacity (pass inSize - 1 to only accept real savings)
+std::optional<size_t> compress(const uint8_t *in, size_t inSize, uint8_t *out, size_t outCapacity);
+std::optional<size_t> decompress(const uint8_t *in, size_t inSize, uint8_t *out, size_t outCapacity);
+
+// tries to compress a frame payload and updates the stats, std::nullopt means send it raw
+std::optional<size_t> compressFrame(const uint8_t *in, size_t inSize, uint8_t *out);
+
+void runBenchmark();
+} // namespace espnow::compression
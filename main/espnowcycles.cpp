@@ -0,0 +1,76 @@
+#include "espnowcycles.h"
+
+// system includes
+#include <algorithm>
+
+// esp-idf includes
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+namespace espnow::cycles {
+std::array<PathStats, PathCount> stats;
+
+std::string_view toString(Path path)
+{
+    switch (path)
+    {
+    case Path::Receive:      return "receive";
+    case Path::SendCallback: return "send_callback";
+    case Path::Send:         return "send";
+    }
+    return "unknown";
+}
+
+static_assert(WindowCalls == 1000);
+
+uint32_t cyclesPer1000Sent()
+{
+    const uint32_t send = stats[size_t(Path::Send)].lastWindowCycles;
+    const uint32_t callback = stats[size_t(Path::SendCallback)].lastWindowCycles;
+    return send && callback ? send + callback : 0;
+}
+
+uint32_t cyclesPer1000Received()
+{
+    return stats[size_t(Path::Receive)].lastWindowCycles;
+}
+
+void reset()
+{
+    for (auto &path : stats)
+    {
+        path.calls = 0;
+        path.maxCycles = 0;
+        for (auto &bucket : path.histogram)
+            bucket = 0;
+        path.windowCalls = 0;
+        path.windowCycles = 0;
+        path.lastWindowCycles = 0;
+    }
+}
+
+void account(Path path, uint32_t cycles)
+{
+    auto &pathStats = stats[size_t(path)];
+    pathStats.calls++;
+    for (uint32_t max = pathStats.maxCycles; cycles > max && !pathStats.maxCycles.compare_exchange_weak(max, cycles);)
+        ;
+    pathStats.histogram[std::upper_bound(std::begin(bucketLimits), std::end(bucketLimits), cycles) - std::begin(bucketLimits)]++;
+
+    // sends run on several tasks at once. the call that completes a window takes its calls off the counter
+    // instead of zeroing it, so calls counted meanwhile stay in the next window
+    pathStats.windowCycles += cycles;
+    if (pathStats.windowCalls.fetch_add(1) + 1 == WindowCalls)
+    {
+        pathStats.windowCalls.fetch_sub(WindowCalls);
+        pathStats.lastWindowCycles = pathStats.windowCycles.exchange(0);
+    }
+}
+
+#ifdef CONFIG_ESPNOW_CYCLE_ACCOUNTING
+int Scope::currentCore()
+{
+    return xPortGetCoreID();
+}
+#endif
+} // namespace espnow::cycles
@@ -0,0 +1,100 @@
+#pragma once
+
+// system includes
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+// esp-idf includes
+#include <sdkconfig.h>
+#include <xtensa/hal.h>
+
+// cpu cycles spent in the esp-now callbacks and sends, with CONFIG_ESPNOW_CYCLE_ACCOUNTING disabled
+// the scopes are empty and compile to nothing. the counts are wall time on the core of the call, a higher
+// priority task or an interrupt preempting it is counted too. the counter is per core, calls from unpinned
+// tasks that migrate in between are dropped
+namespace espnow::cycles {
+#ifdef CONFIG_ESPNOW_CYCLE_ACCOUNTING
+constexpr const bool Enabled = true;
+#else
+constexpr const bool Enabled = false;
+#endif
+
+enum class Path : uint8_t {
+    Receive, // _recvCb
+    SendCallback, // _sendCb
+    Send // building the frame and esp_now_send() once the locks are held, for queued and direct sends
+};
+
+constexpr const size_t PathCount = 3;
+
+std::string_view toString(Path path);
+
+// upper bounds of the histogram buckets, the last bucket takes everything above
+constexpr const uint32_t bucketLimits[] = {1000, 2000, 4000, 8000, 16000, 32000, 64000, 128000};
+constexpr const size_t Buckets = std::size(bucketLimits) + 1;
+
+// the averages are over windows of this many calls
+constexpr const uint32_t WindowCalls = 1000;
+
+struct PathStats
+{
+    std::atomic<uint32_t> calls{};
+    std::atomic<uint32_t> maxCycles{};
+    std::array<std::atomic<uint32_t>, Buckets> histogram{};
+    std::atomic<uint32_t> windowCalls{};
+    std::atomic<uint32_t> windowCycles{};
+    std::atomic<uint32_t> lastWindowCycles{}; // cycles of the last WindowCalls calls, 0 before the first window
+};
+
+extern std::array<PathStats, PathCount> stats; // indexed by Path
+
+// cpu load of the radio path, 0 before the first window. a sent frame costs a send and a send callback
+uint32_t cyclesPer1000Sent();
+uint32_t cyclesPer1000Received();
+
+void reset();
+
+inline uint32_t now()
+{
+    return xthal_get_ccount();
+}
+
+void account(Path path, uint32_t cycles);
+
+#ifdef CONFIG_ESPNOW_CYCLE_ACCOUNTING
+class Scope
+{
+public:
+    explicit Scope(Path path) : m_path{path}, m_core{currentCore()}, m_start{now()} {}
+    ~Scope()
+    {
+        const uint32_t end = now();
+        if (currentCore() == m_core)
+            account(m_path, end - m_start);
+    }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    static int currentCore();
+
+    const Path m_path;
+    const int m_core;
+    const uint32_t m_start;
+};
+#else
+class Scope
+{
+public:
+    explicit Scope(Path) {}
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+};
+#endif
+} // namespace espnow::cycles
@@ -0,0 +1,200 @@
+#include "espnowfilter.h"
+
+// system includes
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+// esp-idf includes
+#include <esp_log.h>
+
+// 3rdparty lib includes
+#include <espwifiutils.h>
+
+// local includes
+#include "config.h"
+#include "espnowprotocol.h"
+
+namespace espnow::filter {
+namespace {
+constexpr const char * const TAG = "ESP_NOW_FILTER";
+
+constexpr const size_t MaxMacs = 16;
+
+// open addressing with linear probing, half full at most so a miss ends after a probe or two
+struct MacSet
+{
+    static constexpr size_t Bits = 5;
+    std::array<uint64_t, 1 << Bits> slots{};
+    size_t count{};
+
+    static uint64_t keyOf(const uint8_t *mac)
+    {
+        // the top bit marks used slots, so 00:00:00:00:00:00 is a valid entry
+        uint64_t key = 1ull << 63;
+        for (size_t i = 0; i < 6; i++)
+            key |= uint64_t(mac[i]) << (i * 8);
+        return key;
+    }
+
+    static size_t slotOf(uint64_t key)
+    {
+        return (key * 0x9E3779B97F4A7C15ull) >> (64 - Bits);
+    }
+
+    bool contains(const uint8_t *mac) const
+    {
+        const auto key = keyOf(mac);
+        for (size_t i = slotOf(key); slots[i]; i = (i + 1) % slots.size())
+            if (slots[i] == key)
+                return true;
+        return false;
+    }
+
+    void insert(const uint8_t *mac)
+    {
+        const auto key = keyOf(mac);
+        size_t i = slotOf(key);
+        for (; slots[i]; i = (i + 1) % slots.size())
+            if (slots[i] == key)
+                return;
+        slots[i] = key;
+        count++;
+    }
+};
+static_assert(MaxMacs * 2 <= std::tuple_size_v<decltype(MacSet::slots)>);
+
+// the receive callback reads the active set while update() fills the other one, config changes are rare
+// enough that a reader never sees a set being rebuilt
+std::array<MacSet, 2> macSets{};
+std::atomic<uint8_t> activeSet{};
+
+bool configsSubscribed{};
+std::atomic<bool> macsChanged{true};
+std::atomic<MacMode> macMode{MacMode::Off};
+std::atomic<bool> ownOnly{};
+std::atomic<uint32_t> typeMask{0xFFFFFFFF};
+
+void rebuildMacSet()
+{
+    const uint8_t next = !activeSet;
+    auto &set = macSets[next];
+    set = {};
+
+    std::string_view remaining{configs.espnowRxMacs.value};
+    while (!remaining.empty())
+    {
+        const auto end = std::min(remaining.find_first_of(", ;"), remaining.size());
+        const auto entry = remaining.substr(0, end);
+        remaining.remove_prefix(std::min(end + 1, remaining.size()));
+        if (entry.empty())
+            continue;
+
+        const auto mac = wifi_stack::fromString<wifi_stack::mac_t>(entry);
+        if (!mac)
+        {
+            ESP_LOGW(TAG, "ignoring %.*s in espnowRxMacs: %.*s", entry.size(), entry.data(), mac.error().size(), mac.error().data());
+            continue;
+        }
+
+        if (set.count == MaxMacs)
+        {
+            ESP_LOGW(TAG, "espnowRxMacs has more than %zu entries, ignoring the rest", MaxMacs);
+            break;
+        }
+
+        set.insert(mac->data());
+    }
+
+    activeSet = next;
+    ESP_LOGI(TAG, "%zu senders in the %.*s list", set.count, toString(macMode).size(), toString(macMode).data());
+}
+
+bool senderAllowed(const uint8_t *mac)
+{
+    const auto mode = macMode.load();
+    return mode == MacMode::Off || macSets[activeSet].contains(mac) == (mode == MacMode::Allow);
+}
+
+bool typeAllowed(uint8_t type)
+{
+    return type >= 32 || (typeMask & (1u << type));
+}
+
+bool count(Verdict verdict)
+{
+    switch (verdict)
+    {
+    case Verdict::Accept:  return true;
+    case Verdict::Mac:     stats.rejectedMac++; break;
+    case Verdict::Foreign: stats.rejectedForeign++; break;
+    case Verdict::Type:    stats.rejectedType++; break;
+    }
+    return false;
+}
+} // namespace
+
+Stats stats;
+
+std::string_view toString(MacMode mode)
+{
+    switch (mode)
+    {
+    case MacMode::Off:   return "Off";
+    case MacMode::Allow: return "Allow";
+    case MacMode::Deny:  return "Deny";
+    }
+    return "Unknown";
+}
+
+size_t macCount()
+{
+    return macMode == MacMode::Off ? 0 : macSets[activeSet].count;
+}
+
+Verdict check(const uint8_t *mac, const uint8_t *data, size_t length)
+{
+    if (!senderAllowed(mac))
+        return Verdict::Mac;
+
+    if (length < sizeof(FrameHeader) || data[0] != FrameMagic)
+        return ownOnly ? Verdict::Foreign : Verdict::Accept;
+
+    if (!typeAllowed(data[offsetof(FrameHeader, type)]))
+        return Verdict::Type;
+
+    return Verdict::Accept;
+}
+
+bool accept(const uint8_t *mac, const uint8_t *data, size_t length)
+{
+    return count(check(mac, data, length));
+}
+
+bool acceptRelayed(const uint8_t *origin, uint8_t type)
+{
+    if (!senderAllowed(origin))
+        return count(Verdict::Mac);
+    if (!typeAllowed(type))
+        return count(Verdict::Type);
+    return true;
+}
+
+void update()
+{
+    if (!configsSubscribed)
+    {
+        onConfigChange(configs.espnowRxMacs, [](const std::string &){ macsChanged = true; });
+        onConfigChange(configs.espnowRxMacMode, [](const MacMode &value){ macMode = value; });
+        onConfigChange(configs.espnowRxOwnOnly, [](const bool &value){ ownOnly = value; });
+        onConfigChange(configs.espnowRxTypes, [](const uint32_t &value){ typeMask = value; });
+        macMode = configs.espnowRxMacMode.value;
+        ownOnly = configs.espnowRxOwnOnly.value;
+        typeMask = configs.espnowRxTypes.value;
+        configsSubscribed = true;
+    }
+
+    if (macsChanged.exchange(false))
+        rebuildMacSet();
+}
+} // namespace espnow::filter
@@ -0,0 +1,58 @@
+#pragma once
+
+// system includes
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// drops unwanted frames before the receive path decodes, counts or outputs them.
+// in crowded places most frames on the channel are other people's esp-now traffic
+namespace espnow::filter {
+enum class MacMode : uint8_t {
+    Off,
+    Allow, // only senders in configs.espnowRxMacs
+    Deny // everything but the senders in configs.espnowRxMacs
+};
+
+std::string_view toString(MacMode mode);
+
+template<typename T>
+void iterateMacModes(T &&callback)
+{
+    for (const auto mode : {MacMode::Off, MacMode::Allow, MacMode::Deny})
+        callback(mode, toString(mode));
+}
+
+enum class Verdict : uint8_t {
+    Accept,
+    Mac, // sender rejected by the allow or deny list
+    Foreign, // no FrameMagic with configs.espnowRxOwnOnly
+    Type // frame type cleared in configs.espnowRxTypes
+};
+
+struct Stats
+{
+    std::atomic<uint32_t> rejectedMac{};
+    std::atomic<uint32_t> rejectedForeign{};
+    std::atomic<uint32_t> rejectedType{};
+};
+
+extern Stats stats;
+
+// senders in the active list, 0 without a list
+size_t macCount();
+
+// does not count, for the sniffer which sees the frames before the receive callback
+Verdict check(const uint8_t *mac, const uint8_t *data, size_t length);
+
+// check() and count the rejection, called first thing in the receive callback
+bool accept(const uint8_t *mac, const uint8_t *data, size_t length);
+
+// the origin and the wrapped type of a relayed frame, the relay frame itself passed accept() already.
+// counts the rejection like accept()
+bool acceptRelayed(const uint8_t *origin, uint8_t type);
+
+// rebuilds the sender list after config changes, called from the scheduler
+void update();
+} // namespace espnow::filter
@@ -0,0 +1,630 @@
+#include "espnowota.h"
+
+// system includes
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <optional>
+
+// esp-idf includes
+#include <esp_image_format.h>
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <mbedtls/sha256.h>
+
+// 3rdparty lib includes
+#include <fmt/core.h>
+
+// local includes
+#include "config.h"
+#include "espnow.h"
+#include "ota.h"
+
+namespace espnow::ota {
+namespace {
+constexpr const char * const TAG = "ESP_NOW_OTA";
+
+constexpr const size_t Window = 32;
+constexpr const int64_t OfferIntervalUs = 1000000;
+constexpr const int64_t RequestTimeoutUs = 200000;
+constexpr const int64_t StalledRequestIntervalUs = 2000000;
+constexpr const int64_t StallTimeoutUs = 10000000;
+// a sender that stays away this long is given up, the ota partition is free for the other updaters again
+constexpr const int64_t GiveUpTimeoutUs = 60000000;
+constexpr const int64_t MulticastDedupUs = 50000;
+
+struct Item
+{
+    FrameType type;
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> mac;
+    uint8_t length;
+    std::array<uint8_t, MaxFramePayload> data;
+};
+
+struct Serving
+{
+    const esp_partition_t *partition;
+    OtaOffer offer;
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> destination;
+    bool multicast;
+};
+
+struct Receiving
+{
+    const esp_partition_t *partition;
+    OtaOffer offer;
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> sender;
+    uint32_t totalChunks;
+    uint32_t nextChunk;
+    uint32_t erasedUntil;
+    uint32_t windowReceived; // bit i is chunk nextChunk + i
+    uint32_t requestedFrom;
+    int64_t lastRequestUs;
+    int64_t lastChunkUs;
+};
+
+struct SentChunk
+{
+    uint32_t index;
+    int64_t timestamp;
+};
+
+// the task is started from the scheduler and from the console or httpd task
+std::mutex taskMutex;
+QueueHandle_t queue{};
+TaskHandle_t taskHandle{};
+
+// guards serving and the published status, everything else is only touched by the ota task
+std::mutex mutex;
+std::optional<Serving> serving;
+SenderStatus sender{};
+ReceiverStatus receiver{ .message = "" };
+
+std::optional<Receiving> receiving;
+std::atomic<bool> abortRequested{};
+std::optional<uint32_t> abortedSession; // its offers keep coming every second, they are not taken again
+std::array<std::array<uint8_t, OtaChunkSize>, Window> windowChunks;
+std::array<uint8_t, 32> runningSha;
+std::array<SentChunk, 64> recentlySent;
+
+void otaTask(void *);
+tl::expected<void, std::string> ensureTask();
+void handleOffer(const Item &item);
+void handleRequest(const Item &item);
+void handleChunk(const Item &item);
+void sendOffer(int64_t now);
+void requestChunks(int64_t now);
+void flushWindow();
+void finishReceiving();
+void failReceiving(const char *message);
+void publishReceiver();
+bool isConfiguredPeer(const uint8_t *mac);
+uint32_t chunkLength(const OtaOffer &offer, uint32_t index);
+void chunkHash(const uint8_t *data, size_t length, uint8_t *hash);
+} // namespace
+
+std::string_view toString(Source source)
+{
+    switch (source)
+    {
+    case Source::Running: return "running";
+    case Source::Staged:  return "staged";
+    }
+    return "unknown";
+}
+
+std::string_view toString(ReceiverState state)
+{
+    switch (state)
+    {
+    case ReceiverState::Idle:      return "idle";
+    case ReceiverState::Receiving: return "receiving";
+    case ReceiverState::Verifying: return "verifying";
+    case ReceiverState::Done:      return "done, reboot to activate";
+    case ReceiverState::Failed:    return "failed";
+    }
+    return "unknown";
+}
+
+void update()
+{
+    if (configs.otaP2pAccept.value && !taskHandle)
+        if (const auto result = ensureTask(); !result)
+            ESP_LOGE(TAG, "%.*s", result.error().size(), result.error().data());
+}
+
+tl::expected<void, std::string> startServing(Source source, const uint8_t *destination)
+{
+    const esp_partition_t *partition = source == Source::Running ?
+                                           esp_ota_get_running_partition() :
+                                           esp_ota_get_next_update_partition(nullptr);
+    if (!partition)
+        return tl::make_unexpected(fmt::format("no {} partition", toString(source)));
+
+    // only valid images are offered, this also tells the size of the image in the partition
+    const esp_partition_pos_t position{ .offset = partition->address, .size = partition->size };
+    esp_image_metadata_t metadata{};
+    if (const auto result = esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &position, &metadata); result != ESP_OK)
+        return tl::make_unexpected(fmt::format("{} partition has no valid image: {}", toString(source), esp_err_to_name(result)));
+
+    Serving next{ .partition = partition, .offer = { .imageSize = metadata.image_len, .chunkSize = OtaChunkSize }, .destination = {} };
+
+    if (const auto result = esp_partition_get_sha256(partition, next.offer.sha256); result != ESP_OK)
+        return tl::make_unexpected(fmt::format("esp_partition_get_sha256() failed with {}", esp_err_to_name(result)));
+
+    esp_app_desc_t description;
+    if (esp_ota_get_partition_description(partition, &description) == ESP_OK)
+        std::copy(std::begin(description.version), std::end(description.version), next.offer.version);
+
+    do
+        esp_fill_random(&next.offer.session, sizeof(next.offer.session));
+    while (!next.offer.session);
+
+    std::copy(destination, destination + ESP_NOW_ETH_ALEN, std::begin(next.destination));
+    next.multicast = std::equal(std::begin(next.destination), std::end(next.destination), broadcastAddress);
+
+    if (auto result = ensureTask(); !result)
+        return result;
+
+    std::lock_guard lock{mutex};
+    serving = next;
+    sender = SenderStatus{
+        .serving = true,
+        .source = source,
+        .multicast = next.multicast,
+        .destination = next.destination,
+        .session = next.offer.session,
+        .imageSize = next.offer.imageSize
+    };
+
+    ESP_LOGI(TAG, "serving %s image (%u bytes) session %08x", toString(source).data(), next.offer.imageSize, next.offer.session);
+    return {};
+}
+
+void stopServing()
+{
+    std::lock_guard lock{mutex};
+    serving = std::nullopt;
+    sender.serving = false;
+}
+
+void abortReceiving()
+{
+    abortRequested = true;
+}
+
+SenderStatus senderStatus()
+{
+    std::lock_guard lock{mutex};
+    return sender;
+}
+
+ReceiverStatus receiverStatus()
+{
+    std::lock_guard lock{mutex};
+    return receiver;
+}
+
+void handleFrame(const RecvRecord &record, std::string_view payload)
+{
+    // any node can claim to relay for a configured peer, firmware is only taken from a direct neighbour
+    if (!queue || record.relayed || payload.size() > MaxFramePayload)
+        return;
+
+    Item item{ .type = record.header.type, .mac = record.mac, .length = uint8_t(payload.size()) };
+    std::memcpy(item.data.data(), payload.data(), payload.size());
+
+    // a full queue loses the frame, the receiver requests it again
+    xQueueSend(queue, &item, 0);
+}
+
+namespace {
+tl::expected<void, std::string> ensureTask()
+{
+    std::lock_guard lock{taskMutex};
+
+    if (taskHandle)
+        return {};
+
+    if (!queue)
+    {
+        queue = xQueueCreate(Window + 8, sizeof(Item));
+        if (!queue)
+            return tl::make_unexpected("xQueueCreate() failed");
+    }
+
+    // flash writes and reads are not latency critical, they stay away from the radio core
+    if (const auto result = xTaskCreatePinnedToCore(otaTask, "espnowOta", 4096, nullptr, 3, &taskHandle, configs.appCore.value); result != pdPASS)
+        return tl::make_unexpected(fmt::format("xTaskCreatePinnedToCore() failed with {}", result));
+
+    return {};
+}
+
+void otaTask(void *)
+{
+    if (const auto result = esp_partition_get_sha256(esp_ota_get_running_partition(), runningSha.data()); result != ESP_OK)
+        ESP_LOGW(TAG, "esp_partition_get_sha256() failed with %s", esp_err_to_name(result));
+
+    Item item;
+
+    while (true)
+    {
+        if (xQueueReceive(queue, &item, pdMS_TO_TICKS(50)) == pdTRUE)
+        {
+            switch (item.type)
+            {
+            case FrameType::OtaOffer:   handleOffer(item); break;
+            case FrameType::OtaRequest: handleRequest(item); break;
+            case FrameType::OtaChunk:   handleChunk(item); break;
+            default: break;
+            }
+        }
+
+        if (abortRequested.exchange(false) && receiving)
+        {
+            abortedSession = uint32_t{receiving->offer.session};
+            failReceiving("aborted");
+        }
+
+        const int64_t now = esp_timer_get_time();
+        sendOffer(now);
+        requestChunks(now);
+    }
+}
+
+void handleOffer(const Item &item)
+{
+    OtaOffer offer;
+    if (item.length != sizeof(offer))
+        return;
+    std::memcpy(&offer, item.data.data(), sizeof(offer));
+
+    if (!configs.otaP2pAccept.value || !isConfiguredPeer(item.mac.data()) || offer.chunkSize != OtaChunkSize)
+        return;
+    if (offer.session == abortedSession)
+        return;
+
+    if (std::equal(std::begin(offer.sha256), std::end(offer.sha256), std::begin(runningSha)))
+        return;
+
+    if (receiving)
+    {
+        if (!std::equal(std::begin(offer.sha256), std::end(offer.sha256), std::begin(receiving->offer.sha256)))
+            return;
+
+        // the same image from a new session or another sender, continue where we are
+        if (offer.session != receiving->offer.session || item.mac != receiving->sender)
+        {
+            ESP_LOGI(TAG, "resuming at chunk %u/%u", receiving->nextChunk, receiving->totalChunks);
+            receiving->offer = offer;
+            receiving->sender = item.mac;
+            receiving->windowReceived = 0;
+            receiving->lastRequestUs = 0;
+            receiving->lastChunkUs = esp_timer_get_time();
+            std::lock_guard lock{mutex};
+            receiver.sender = item.mac;
+            receiver.resumes++;
+        }
+        return;
+    }
+
+    {
+        std::lock_guard lock{mutex};
+        if (receiver.state == ReceiverState::Done)
+            return;
+    }
+
+    // offers repeat every second, they are taken once the other update is done
+    if (!claimOtaPartition(OtaPartitionOwner::P2p))
+        return;
+
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(nullptr);
+    if (!partition || offer.imageSize > partition->size || !offer.imageSize)
+    {
+        releaseOtaPartition(OtaPartitionOwner::P2p);
+        // offers repeat every second, only complain once
+        if (receiverStatus().state != ReceiverState::Failed)
+            failReceiving("image does not fit the ota partition");
+        return;
+    }
+
+    receiving = Receiving{
+        .partition = partition,
+        .offer = offer,
+        .sender = item.mac,
+        .totalChunks = (offer.imageSize + OtaChunkSize - 1) / OtaChunkSize,
+        .lastChunkUs = esp_timer_get_time()
+    };
+
+    {
+        std::lock_guard lock{mutex};
+        receiver = ReceiverStatus{
+            .state = ReceiverState::Receiving,
+            .sender = item.mac,
+            .imageSize = offer.imageSize,
+            .message = ""
+        };
+        std::copy(std::begin(offer.version), std::end(offer.version), std::begin(receiver.version));
+        receiver.version.back() = '\0';
+    }
+
+    ESP_LOGI(TAG, "receiving %.*s (%u bytes) into %s", int(sizeof(offer.version)), offer.version, offer.imageSize, partition->label);
+}
+
+void handleRequest(const Item &item)
+{
+    OtaRequest request;
+    if (item.length != sizeof(request))
+        return;
+    std::memcpy(&request, item.data.data(), sizeof(request));
+
+    std::optional<Serving> current;
+    {
+        std::lock_guard lock{mutex};
+        if (!serving || serving->offer.session != request.session)
+            return;
+        current = serving;
+        sender.requests++;
+    }
+
+    const auto &offer = current->offer;
+    const uint32_t totalChunks = (offer.imageSize + OtaChunkSize - 1) / OtaChunkSize;
+
+    // unicast answers go to the requester, receivers that are not our peers get broadcasts
+    const uint8_t *destination = current->multicast || !findPeer(item.mac.data()) ? broadcastAddress : item.mac.data();
+
+    std::array<uint8_t, sizeof(OtaChunkHeader) + OtaChunkSize> frame;
+    for (uint32_t bit = 0; bit < Window; bit++)
+    {
+        if (!(request.missing & (1u << bit)))
+            continue;
+
+        const uint32_t index = request.firstChunk + bit;
+        if (index >= totalChunks)
+            break;
+
+        const int64_t now = esp_timer_get_time();
+        auto &sent = recentlySent[index % recentlySent.size()];
+        if (current->multicast && sent.index == index && sent.timestamp && now - sent.timestamp < MulticastDedupUs)
+        {
+            std::lock_guard lock{mutex};
+            sender.chunksDeduplicated++;
+            continue;
+        }
+
+        const auto length = chunkLength(offer, index);
+        OtaChunkHeader header{ .session = offer.session, .index = index };
+        uint8_t * const data = frame.data() + sizeof(header);
+        if (const auto result = esp_partition_read(current->partition, index * OtaChunkSize, data, length); result != ESP_OK)
+        {
+            ESP_LOGE(TAG, "esp_partition_read() failed with %s", esp_err_to_name(result));
+            return;
+        }
+        chunkHash(data, length, header.hash);
+        std::memcpy(frame.data(), &header, sizeof(header));
+
+        if (queueEspNow(FrameType::OtaChunk, frame.data(), sizeof(header) + length, destination, pdMS_TO_TICKS(100)) != ESP_OK)
+            continue;
+
+        sent = SentChunk{ .index = index, .timestamp = now };
+        std::lock_guard lock{mutex};
+        sender.chunksSent++;
+    }
+}
+
+void handleChunk(const Item &item)
+{
+    if (!receiving || item.length < sizeof(OtaChunkHeader))
+        return;
+
+    OtaChunkHeader header;
+    std::memcpy(&header, item.data.data(), sizeof(header));
+    if (header.session != receiving->offer.session)
+        return;
+
+    // multicast chunks for other receivers outside our window are dropped
+    if (header.index < receiving->nextChunk || header.index >= receiving->nextChunk + Window || header.index >= receiving->totalChunks)
+        return;
+
+    const uint8_t *data = item.data.data() + sizeof(header);
+    const size_t length = item.length - sizeof(header);
+    if (length != chunkLength(receiving->offer, header.index))
+        return;
+
+    uint8_t hash[sizeof(header.hash)];
+    chunkHash(data, length, hash);
+    if (std::memcmp(hash, header.hash, sizeof(hash)) != 0)
+    {
+        std::lock_guard lock{mutex};
+        receiver.hashFailures++;
+        return;
+    }
+
+    receiving->lastChunkUs = esp_timer_get_time();
+    std::memcpy(windowChunks[header.index % Window].data(), data, length);
+    receiving->windowReceived |= 1u << (header.index - receiving->nextChunk);
+
+    flushWindow();
+}
+
+void sendOffer(int64_t now)
+{
+    static int64_t lastOfferUs{};
+    if (now - lastOfferUs < OfferIntervalUs)
+        return;
+
+    std::optional<Serving> current;
+    {
+        std::lock_guard lock{mutex};
+        current = serving;
+    }
+    if (!current)
+        return;
+
+    lastOfferUs = now;
+    if (const auto result = queueEspNow(FrameType::OtaOffer, (const uint8_t *)&current->offer, sizeof(current->offer), current->destination.data()); result != ESP_OK)
+        ESP_LOGW(TAG, "could not queue offer: %s", esp_err_to_name(result));
+}
+
+void requestChunks(int64_t now)
+{
+    if (!receiving)
+        return;
+
+    if (now - receiving->lastChunkUs >= GiveUpTimeoutUs)
+    {
+        failReceiving("sender disappeared");
+        return;
+    }
+
+    const bool stalled = now - receiving->lastChunkUs >= StallTimeoutUs;
+
+    // the next request is sent early once half of the last window arrived, that keeps the sender busy
+    const bool due = now - receiving->lastRequestUs >= (stalled ? StalledRequestIntervalUs : RequestTimeoutUs) ||
+                     receiving->nextChunk >= receiving->requestedFrom + Window / 2;
+    if (!due)
+        return;
+
+    const uint32_t remaining = receiving->totalChunks - receiving->nextChunk;
+    const uint32_t valid = remaining >= Window ? UINT32_MAX : (1u << remaining) - 1;
+
+    const OtaRequest request{
+        .session = receiving->offer.session,
+        .firstChunk = receiving->nextChunk,
+        .missing = ~receiving->windowReceived & valid
+    };
+
+    const uint8_t *destination = findPeer(receiving->sender.data()) ? receiving->sender.data() : broadcastAddress;
+    if (queueEspNow(FrameType::OtaRequest, (const uint8_t *)&request, sizeof(request), destination) != ESP_OK)
+        return;
+
+    receiving->lastRequestUs = now;
+    receiving->requestedFrom = receiving->nextChunk;
+
+    std::lock_guard lock{mutex};
+    receiver.requests++;
+    receiver.message = stalled ? "waiting for sender" : "";
+}
+
+void flushWindow()
+{
+    while (receiving->windowReceived & 1)
+    {
+        const uint32_t index = receiving->nextChunk;
+        const uint32_t offset = index * OtaChunkSize;
+        const uint32_t length = chunkLength(receiving->offer, index);
+
+        // erased a sector at a time as the image grows, an erase takes tens of ms and chunks are re-requested meanwhile
+        while (receiving->erasedUntil < offset + length)
+        {
+            if (const auto result = esp_partition_erase_range(receiving->partition, receiving->erasedUntil, SPI_FLASH_SEC_SIZE); result != ESP_OK)
+            {
+                ESP_LOGE(TAG, "esp_partition_erase_range() failed with %s", esp_err_to_name(result));
+                failReceiving("erasing the ota partition failed");
+                return;
+            }
+            receiving->erasedUntil += SPI_FLASH_SEC_SIZE;
+        }
+
+        if (const auto result = esp_partition_write(receiving->partition, offset, windowChunks[index % Window].data(), length); result != ESP_OK)
+        {
+            ESP_LOGE(TAG, "esp_partition_write() failed with %s", esp_err_to_name(result));
+            failReceiving("writing the ota partition failed");
+            return;
+        }
+
+        receiving->windowReceived >>= 1;
+        receiving->nextChunk++;
+    }
+
+    publishReceiver();
+
+    if (receiving->nextChunk == receiving->totalChunks)
+        finishReceiving();
+}
+
+void finishReceiving()
+{
+    {
+        std::lock_guard lock{mutex};
+        receiver.state = ReceiverState::Verifying;
+    }
+
+    std::array<uint8_t, 32> sha;
+    if (const auto result = esp_partition_get_sha256(receiving->partition, sha.data()); result != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_partition_get_sha256() failed with %s", esp_err_to_name(result));
+        failReceiving("hashing the received image failed");
+        return;
+    }
+
+    if (!std::equal(std::begin(sha), std::end(sha), std::begin(receiving->offer.sha256)))
+    {
+        failReceiving("sha256 of the received image does not match the offer");
+        return;
+    }
+
+    if (const auto result = esp_ota_set_boot_partition(receiving->partition); result != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_ota_set_boot_partition() failed with %s", esp_err_to_name(result));
+        failReceiving("the received image is not bootable");
+        return;
+    }
+
+    ESP_LOGI(TAG, "image received and verified, boots after the next reboot");
+    receiving = std::nullopt;
+    releaseOtaPartition(OtaPartitionOwner::P2p);
+
+    std::lock_guard lock{mutex};
+    receiver.state = ReceiverState::Done;
+    receiver.message = "";
+}
+
+void failReceiving(const char *message)
+{
+    ESP_LOGW(TAG, "%s", message);
+    if (receiving)
+        releaseOtaPartition(OtaPartitionOwner::P2p);
+    receiving = std::nullopt;
+
+    std::lock_guard lock{mutex};
+    receiver.state = ReceiverState::Failed;
+    receiver.message = message;
+}
+
+void publishReceiver()
+{
+    const uint32_t written = std::min(receiving->nextChunk * OtaChunkSize, receiving->offer.imageSize);
+
+    std::lock_guard lock{mutex};
+    receiver.written = written;
+}
+
+bool isConfiguredPeer(const uint8_t *mac)
+{
+    return std::any_of(std::begin(configs.espnow_peers), std::end(configs.espnow_peers), [&](const auto &peerConfig){
+        return peerConfig.mac.value && std::equal(std::begin(*peerConfig.mac.value), std::end(*peerConfig.mac.value), mac);
+    });
+}
+
+uint32_t chunkLength(const OtaOffer &offer, uint32_t index)
+{
+    return std::min<uint32_t>(OtaChunkSize, offer.imageSize - index * OtaChunkSize);
+}
+
+void chunkHash(const uint8_t *data, size_t length, uint8_t *hash)
+{
+    uint8_t sha[32];
+    mbedtls_sha256_ret(data, length, sha, 0);
+    std::memcpy(hash, sha, sizeof(OtaChunkHeader::hash));
+}
+} // namespace
+} // namespace espnow::ota
@@ -0,0 +1,78 @@
+#pragma once
+
+// system includes
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// esp-idf includes
+#include <esp_now.h>
+
+// 3rdparty lib includes
+#include <tl/expected.hpp>
+
+namespace espnow {
+struct RecvRecord;
+
+namespace ota {
+enum class Source : uint8_t {
+    Running,
+    Staged // the next ota partition, e.g. an image received before but not booted yet
+};
+
+std::string_view toString(Source source);
+
+enum class ReceiverState : uint8_t {
+    Idle,
+    Receiving,
+    Verifying,
+    Done, // the new image is set as boot partition, a reboot activates it
+    Failed
+};
+
+std::string_view toString(ReceiverState state);
+
+struct SenderStatus
+{
+    bool serving;
+    Source source;
+    bool multicast;
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> destination;
+    uint32_t session;
+    uint32_t imageSize;
+    uint32_t requests;
+    uint32_t chunksSent;
+    uint32_t chunksDeduplicated; // multicast chunks another receiver asked for just before
+};
+
+struct ReceiverStatus
+{
+    ReceiverState state;
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> sender;
+    std::array<char, 32> version;
+    uint32_t imageSize;
+    uint32_t written;
+    uint32_t requests;
+    uint32_t hashFailures;
+    uint32_t resumes;
+    const char *message;
+};
+
+// creates the ota task once configs.otaP2pAccept is enabled, called from the scheduler
+void update();
+
+// offers the image to destination, chunks are broadcast to all receivers if it is the broadcast address
+tl::expected<void, std::string> startServing(Source source, const uint8_t *destination);
+void stopServing();
+
+// gives up the running receive and ignores further offers of its session, the ota partition is released
+void abortReceiving();
+
+SenderStatus senderStatus();
+ReceiverStatus receiverStatus();
+
+// called from the esp-now receive callback for the ota frame types
+void handleFrame(const RecvRecord &record, std::string_view payload);
+} // namespace ota
+} // namespace espnow
@@ -0,0 +1,266 @@
+#include "espnowoutput.h"
+
+// system includes
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+// esp-idf includes
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <driver/uart.h>
+
+// 3rdparty lib includes
+#include <fmt/core.h>
+#include <futurecpp.h>
+
+// local includes
+#include "config.h"
+#include "espnow.h"
+#include "espnowtrace.h"
+#include "telemetry.h"
+
+namespace espnow::output {
+namespace {
+constexpr const char * const TAG = "ESP_NOW_OUT";
+
+constexpr const uart_port_t OutputUart = CONFIG_ESP_CONSOLE_UART_NUM;
+
+struct Item
+{
+    RecvRecord record;
+    uint8_t payloadLength;
+    std::array<uint8_t, ESP_NOW_MAX_DATA_LEN> payload; // foreign frames can use the full 250 bytes
+};
+
+QueueHandle_t queue{};
+uint32_t appliedBaudRate{};
+
+void outputTask(void *);
+void writeText(const Item &item);
+void writeBinary(const Item &item);
+void syncBaudRate();
+} // namespace
+
+Stats stats;
+
+std::string_view toString(Mode mode)
+{
+    switch (mode)
+    {
+    case Mode::Text:   return "Text";
+    case Mode::Binary: return "Binary";
+    case Mode::Off:    return "Off";
+    }
+    return "Unknown";
+}
+
+void init()
+{
+    if (queue)
+        return;
+
+    queue = xQueueCreate(32, sizeof(Item));
+    if (!queue)
+    {
+        ESP_LOGE(TAG, "xQueueCreate() failed");
+        return;
+    }
+
+    if (const auto result = xTaskCreatePinnedToCore(outputTask, "espnowOutput", 4096, nullptr, configs.espnowOutPrio.value, nullptr, configs.appCore.value); result != pdPASS)
+    {
+        ESP_LOGE(TAG, "xTaskCreatePinnedToCore() failed with %i", result);
+        vQueueDelete(queue);
+        queue = nullptr;
+    }
+}
+
+void enqueue(const RecvRecord &record, std::string_view payload)
+{
+    if (!queue)
+        return;
+
+    switch (configs.espnowOutputMode.value)
+    {
+    case Mode::Off:
+        trace::finish(record.traceId);
+        return;
+    case Mode::Text:
+        // benchmark traffic is only counted, printing it would not keep up
+        if (record.header.magic == FrameMagic && record.header.type != FrameType::Text && record.header.type != FrameType::Bridge)
+        {
+            trace::finish(record.traceId);
+            return;
+        }
+        break;
+    case Mode::Binary:
+        break;
+    }
+
+    Item item;
+    item.record = record;
+    item.payloadLength = std::min(payload.size(), item.payload.size());
+    std::memcpy(item.payload.data(), payload.data(), item.payloadLength);
+
+    // never block the wifi task, a full queue means the uart can not keep up
+    if (xQueueSend(queue, &item, 0) != pdTRUE)
+    {
+        stats.dropped++;
+        trace::finish(record.traceId);
+        return;
+    }
+    stats.queued++;
+}
+
+size_t queueLength()
+{
+    return queue ? uxQueueMessagesWaiting(queue) : 0;
+}
+
+namespace {
+void outputTask(void *)
+{
+    Item item;
+
+    while (true)
+    {
+        syncBaudRate();
+
+        if (xQueueReceive(queue, &item, pdMS_TO_TICKS(100)) != pdTRUE)
+            continue;
+
+        telemetry::HotPath hotPath;
+        trace::mark(item.record.traceId, trace::Point::OutputDequeue);
+
+        switch (configs.espnowOutputMode.value)
+        {
+        case Mode::Text:   writeText(item); break;
+        case Mode::Binary: writeBinary(item); break;
+        case Mode::Off:    continue;
+        }
+
+        stats.written++;
+        trace::mark(item.record.traceId, trace::Point::OutputDone);
+        trace::finish(item.record.traceId);
+    }
+}
+
+void writeText(const Item &item)
+{
+    if (item.record.header.magic == FrameMagic && item.record.header.type == FrameType::Bridge)
+    {
+        uart_write_bytes(OutputUart, item.payload.data(), item.payloadLength);
+        return;
+    }
+
+    const auto &mac = item.record.mac;
+    const std::string_view data{(const char *)item.payload.data(), item.payloadLength};
+    const auto &metadata = item.record.metadata;
+
+    // formatted into the stack, the output task runs for every received frame
+    std::array<char, ESP_NOW_MAX_DATA_LEN + 64> out;
+    const auto result = metadata ?
+        fmt::format_to_n(out.data(), out.size(), "\u001b[32m[{:02x}:{:02x}:{:02x}:{:02x}:{:02x}:{:02x} rssi={}] --> {}\u001b[0m\n",
+                         mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], metadata->rssi, data) :
+        fmt::format_to_n(out.data(), out.size(), "\u001b[32m[{:02x}:{:02x}:{:02x}:{:02x}:{:02x}:{:02x}] --> {}\u001b[0m\n",
+                         mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], data);
+    uart_write_bytes(OutputUart, out.data(), std::min(result.size, out.size()));
+}
+
+uint16_t crc16(const uint8_t *data, size_t size, uint16_t crc = 0xFFFF)
+{
+    // crc-16/ccitt-false, same as python's binascii.crc_hqx(data, 0xffff)
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= uint16_t(data[i]) << 8;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+void writeBinary(const Item &item)
+{
+    const auto &record = item.record;
+
+    BinaryRecordHeader header {
+        .version = BinaryRecordVersion,
+        .recordFlags = 0,
+        .timestampUs = uint64_t(record.timestamp),
+        .mac = {},
+        .frameType = std::to_underlying(record.header.type),
+        .frameFlags = record.header.flags,
+        .seq = record.header.seq,
+        .rssi = record.metadata ? record.metadata->rssi : int8_t{},
+        .noiseFloor = record.metadata ? record.metadata->noiseFloor : int8_t{},
+        .rate = record.metadata ? record.metadata->rate : uint8_t{},
+        .channel = record.metadata ? record.metadata->channel : uint8_t{},
+        .length = record.length,
+        .payloadLength = item.payloadLength
+    };
+    std::copy(std::begin(record.mac), std::end(record.mac), header.mac);
+    if (record.header.magic == FrameMagic)
+        header.recordFlags |= RecordFlagHasHeader;
+    if (record.metadata)
+        header.recordFlags |= RecordFlagHasMetadata;
+
+    std::array<uint8_t, sizeof(BinaryRecordHeader) + ESP_NOW_MAX_DATA_LEN + sizeof(uint16_t)> raw;
+    size_t rawSize{};
+    std::memcpy(raw.data(), &header, sizeof(header));
+    rawSize += sizeof(header);
+    std::memcpy(raw.data() + rawSize, item.payload.data(), item.payloadLength);
+    rawSize += item.payloadLength;
+    const uint16_t crc = crc16(raw.data(), rawSize);
+    raw[rawSize++] = crc & 0xFF;
+    raw[rawSize++] = crc >> 8;
+
+    // cobs, every 254 bytes need one overhead byte. the leading delimiter separates the record
+    // from log output the console printed in between
+    std::array<uint8_t, raw.size() + raw.size() / 254 + 4> encoded;
+    encoded[0] = 0;
+    size_t codeIndex{1};
+    size_t encodedSize{2};
+    uint8_t code{1};
+    for (size_t i = 0; i < rawSize; i++)
+    {
+        if (raw[i])
+        {
+            encoded[encodedSize++] = raw[i];
+            code++;
+        }
+
+        if (!raw[i] || code == 0xFF)
+        {
+            encoded[codeIndex] = code;
+            code = 1;
+            codeIndex = encodedSize++;
+        }
+    }
+    encoded[codeIndex] = code;
+    encoded[encodedSize++] = 0;
+
+    uart_write_bytes(OutputUart, encoded.data(), encodedSize);
+}
+
+void syncBaudRate()
+{
+    const uint32_t baudRate = configs.espnowOutputBaud.value;
+    if (baudRate == appliedBaudRate)
+        return;
+
+    uart_wait_tx_done(OutputUart, pdMS_TO_TICKS(100));
+
+    if (const auto result = uart_set_baudrate(OutputUart, baudRate); result != ESP_OK)
+    {
+        ESP_LOGE(TAG, "uart_set_baudrate() %u failed with %s", baudRate, esp_err_to_name(result));
+        appliedBaudRate = baudRate; // do not retry every loop, only after the config changes
+        return;
+    }
+
+    ESP_LOGI(TAG, "uart baud rate set to %u", baudRate);
+    appliedBaudRate = baudRate;
+}
+} // namespace
+} // namespace espnow::output
@@ -0,0 +1,69 @@
+#pragma once
+
+// system includes
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+namespace espnow {
+struct RecvRecord;
+
+namespace output {
+enum class Mode : uint8_t {
+    Text,   // received text frames in color, like before, bridge frames raw
+    Binary, // every received frame as cobs encoded record, see tools/espnow-capture
+    Off
+};
+
+std::string_view toString(Mode mode);
+
+template<typename T>
+void iterateModes(T &&callback)
+{
+    for (const auto mode : {Mode::Text, Mode::Binary, Mode::Off})
+        callback(mode, toString(mode));
+}
+
+// layout of a binary record before cobs encoding, little endian, followed by the payload and a crc16
+struct __attribute__((packed)) BinaryRecordHeader
+{
+    uint8_t version;
+    uint8_t recordFlags;
+    uint64_t timestampUs;
+    uint8_t mac[6];
+    uint8_t frameType;
+    uint8_t frameFlags;
+    uint16_t seq;
+    int8_t rssi;
+    int8_t noiseFloor;
+    uint8_t rate;
+    uint8_t channel;
+    uint16_t length; // of the received frame, the payload may be decompressed
+    uint8_t payloadLength;
+};
+
+constexpr const uint8_t BinaryRecordVersion = 1;
+
+enum BinaryRecordFlags : uint8_t {
+    RecordFlagHasHeader = 1 << 0, // false for frames from other esp-now senders, they are passed through raw
+    RecordFlagHasMetadata = 1 << 1
+};
+
+struct Stats
+{
+    std::atomic<uint32_t> queued{};
+    std::atomic<uint32_t> dropped{};
+    std::atomic<uint32_t> written{};
+};
+
+extern Stats stats;
+
+void init();
+
+// called from the esp-now receive callback, the uart write happens in the output task
+void enqueue(const RecvRecord &record, std::string_view payload);
+
+// frames waiting for the uart
+size_t queueLength();
+} // namespace output
+} // namespace espnow
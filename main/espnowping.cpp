@@ -0,0 +1,225 @@
+#include "espnowping.h"
+
+// system includes
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+// esp-idf includes
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+// 3rdparty lib includes
+#include <fmt/core.h>
+
+// local includes
+#include "espnow.h"
+#include "espnowtimesync.h"
+
+namespace espnow::ping {
+namespace {
+constexpr const char * const TAG = "ESP_NOW_PING";
+
+constexpr uint32_t ReplyTimeoutMs = 1000;
+
+QueueHandle_t replies{};
+std::atomic<uint32_t> activeSession{};
+std::atomic<bool> running{};
+
+void addSample(OneWay &oneWay, int32_t latencyUs, std::optional<int32_t> lastLatencyUs);
+} // namespace
+
+int32_t OneWay::avgUs() const
+{
+    if (!samples)
+        return 0;
+    return sumUs / samples;
+}
+
+uint32_t OneWay::jitterUs() const
+{
+    if (!jitterSamples)
+        return 0;
+    return sumJitterUs / jitterSamples;
+}
+
+float Result::lossPercent() const
+{
+    if (!sent)
+        return 0.f;
+    return float(sent - received) / sent * 100;
+}
+
+uint32_t Result::avgRttUs() const
+{
+    if (!received)
+        return 0;
+    return sumRttUs / received;
+}
+
+uint32_t Result::jitterUs() const
+{
+    if (!jitterSamples)
+        return 0;
+    return sumJitterUs / jitterSamples;
+}
+
+tl::expected<Result, std::string> run(const uint8_t *mac, uint32_t count, uint32_t intervalMs, const ReplyCallback &callback, TrafficClass trafficClass)
+{
+    if (!replies)
+    {
+        replies = xQueueCreate(8, sizeof(Reply));
+        if (!replies)
+            return tl::make_unexpected("xQueueCreate() failed");
+    }
+
+    if (running.exchange(true))
+        return tl::make_unexpected("another ping is running");
+
+    uint32_t session;
+    do
+        esp_fill_random(&session, sizeof(session));
+    while (!session);
+
+    xQueueReset(replies);
+    activeSession = session;
+
+    Result result{ .minRttUs = UINT32_MAX };
+    std::optional<Reply> lastReply;
+
+    for (uint32_t seq = 0; seq < count; seq++)
+    {
+        const int64_t start = esp_timer_get_time();
+
+        const PingPayload payload{ .session = session, .seq = seq, .sentUs = start };
+        if (const auto error = queueEspNow(FrameType::Ping, (const uint8_t *)&payload, sizeof(payload), mac, pdMS_TO_TICKS(100), trafficClass); error != ESP_OK)
+        {
+            activeSession = 0;
+            running = false;
+            return tl::make_unexpected(fmt::format("queueEspNow() failed with {}", esp_err_to_name(error)));
+        }
+        result.sent++;
+
+        std::optional<Reply> received;
+        Reply reply;
+        while (!received)
+        {
+            const int64_t waitedMs = (esp_timer_get_time() - start) / 1000;
+            if (waitedMs >= ReplyTimeoutMs)
+                break;
+            if (xQueueReceive(replies, &reply, pdMS_TO_TICKS(ReplyTimeoutMs - waitedMs) + 1) != pdTRUE)
+                break;
+            // late replies of earlier pings are ignored
+            if (reply.seq == seq)
+                received = reply;
+        }
+
+        if (received)
+        {
+            const auto rttUs = received->rttUs;
+            result.received++;
+            result.minRttUs = std::min(result.minRttUs, rttUs);
+            result.maxRttUs = std::max(result.maxRttUs, rttUs);
+            result.sumRttUs += rttUs;
+
+            if (lastReply)
+            {
+                result.sumJitterUs += rttUs > lastReply->rttUs ? rttUs - lastReply->rttUs : lastReply->rttUs - rttUs;
+                result.jitterSamples++;
+            }
+
+            if (received->forwardUs)
+                addSample(result.forward, *received->forwardUs, lastReply ? lastReply->forwardUs : std::nullopt);
+            if (received->backwardUs)
+                addSample(result.backward, *received->backwardUs, lastReply ? lastReply->backwardUs : std::nullopt);
+        }
+        lastReply = received;
+
+        if (callback)
+            callback(seq, received);
+
+        if (const int64_t elapsedMs = (esp_timer_get_time() - start) / 1000; seq + 1 < count && elapsedMs < intervalMs)
+            vTaskDelay(pdMS_TO_TICKS(intervalMs - elapsedMs));
+    }
+
+    if (!result.received)
+        result.minRttUs = 0;
+
+    activeSession = 0;
+    running = false;
+    return result;
+}
+
+void handleFrame(const RecvRecord &record, std::string_view payload)
+{
+    PingPayload ping;
+    if (payload.size() != sizeof(ping))
+        return;
+    std::memcpy(&ping, payload.data(), sizeof(ping));
+
+    switch (record.header.type)
+    {
+    case FrameType::Ping:
+    {
+        // pingers that are not in our peer table get a broadcast pong, the session tells them apart
+        ping.pingRxUs = timesync::networkTime(record.timestamp).value_or(0);
+        ping.pongTxUs = timesync::networkTime(esp_timer_get_time()).value_or(0);
+
+        const uint8_t *destination = findPeer(record.mac.data()) ? record.mac.data() : broadcastAddress;
+        if (const auto error = queueEspNow(FrameType::Pong, (const uint8_t *)&ping, sizeof(ping), destination); error != ESP_OK)
+            ESP_LOGW(TAG, "could not queue pong: %s", esp_err_to_name(error));
+        break;
+    }
+    case FrameType::Pong:
+    {
+        if (!ping.session || ping.session != activeSession)
+            return;
+
+        Reply reply{ .seq = ping.seq, .rttUs = uint32_t(record.timestamp - ping.sentUs) };
+
+        // both ends in network time, the difference is the latency of each direction
+        if (ping.pingRxUs && ping.pongTxUs)
+        {
+            if (const auto sentUs = timesync::networkTime(ping.sentUs))
+                reply.forwardUs = ping.pingRxUs - *sentUs;
+            if (const auto receivedUs = timesync::networkTime(record.timestamp))
+                reply.backwardUs = *receivedUs - ping.pongTxUs;
+        }
+
+        xQueueSend(replies, &reply, 0);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+namespace {
+void addSample(OneWay &oneWay, int32_t latencyUs, std::optional<int32_t> lastLatencyUs)
+{
+    if (!oneWay.samples)
+    {
+        oneWay.minUs = latencyUs;
+        oneWay.maxUs = latencyUs;
+    }
+    else
+    {
+        oneWay.minUs = std::min(oneWay.minUs, latencyUs);
+        oneWay.maxUs = std::max(oneWay.maxUs, latencyUs);
+    }
+    oneWay.sumUs += latencyUs;
+    oneWay.samples++;
+
+    if (lastLatencyUs)
+    {
+        oneWay.sumJitterUs += std::abs(latencyUs - *lastLatencyUs);
+        oneWay.jitterSamples++;
+    }
+}
+} // namespace
+} // namespace espnow::ping
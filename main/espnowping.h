@@ -0,0 +1,70 @@
+#pragma once
+
+// system includes
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// 3rdparty lib includes
+#include <tl/expected.hpp>
+
+// local includes
+#include "espnowprotocol.h"
+
+namespace espnow {
+struct RecvRecord;
+
+namespace ping {
+// latency of one direction, needs the clocks of both nodes synced by espnow::timesync
+struct OneWay
+{
+    int32_t minUs;
+    int32_t maxUs;
+    int64_t sumUs;
+    uint32_t samples;
+    uint64_t sumJitterUs;
+    uint32_t jitterSamples;
+
+    int32_t avgUs() const;
+    uint32_t jitterUs() const;
+};
+
+struct Result
+{
+    uint32_t sent;
+    uint32_t received;
+    uint32_t minRttUs;
+    uint32_t maxRttUs;
+    uint64_t sumRttUs;
+    uint64_t sumJitterUs; // difference between the rtts of consecutive answered pings
+    uint32_t jitterSamples;
+    OneWay forward; // to the pinged node
+    OneWay backward;
+
+    float lossPercent() const;
+    uint32_t avgRttUs() const;
+    uint32_t jitterUs() const;
+};
+
+struct Reply
+{
+    uint32_t seq;
+    uint32_t rttUs;
+    std::optional<int32_t> forwardUs;
+    std::optional<int32_t> backwardUs;
+};
+
+// called for every ping, reply is empty if no pong arrived within the timeout
+using ReplyCallback = std::function<void(uint32_t seq, const std::optional<Reply> &reply)>;
+
+// blocks the calling task until all pings are answered or timed out, only one run at a time.
+// trafficClass selects the tx queue of the pings, the pongs are always sent as control frames
+tl::expected<Result, std::string> run(const uint8_t *mac, uint32_t count, uint32_t intervalMs, const ReplyCallback &callback = {},
+                                      TrafficClass trafficClass = TrafficClass::Control);
+
+// called from the esp-now receive callback for ping and pong frames
+void handleFrame(const RecvRecord &record, std::string_view payload);
+} // namespace ping
+} // namespace espnow
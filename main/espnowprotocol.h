@@ -0,0 +1,137 @@
+#pragma once
+
+// system includes
+#include <cstdint>
+#include <cstddef>
+
+// esp-idf includes
+#include <esp_now.h>
+
+namespace espnow {
+constexpr const uint8_t FrameMagic = 0xE5;
+
+enum class FrameType : uint8_t {
+    Text,
+    Flood,
+    Bridge, // uart data, written raw to the uart of the receiver
+    Ping,
+    Pong,
+    OtaOffer,
+    OtaRequest,
+    OtaChunk,
+    TimeSyncRequest,
+    TimeSyncResponse,
+    Relay // RelayHeader and the payload of the wrapped frame type, see espnow::relay
+};
+
+// scheduling class in the tx path, not sent. queued control frames are always sent before bulk frames
+enum class TrafficClass : uint8_t {
+    Control,
+    Bulk
+};
+constexpr const size_t TrafficClassCount = 2;
+
+constexpr TrafficClass defaultTrafficClass(FrameType type)
+{
+    switch (type)
+    {
+    case FrameType::Ping:
+    case FrameType::Pong:
+    case FrameType::TimeSyncRequest:
+    case FrameType::TimeSyncResponse:
+    case FrameType::OtaRequest:
+        return TrafficClass::Control;
+    default:
+        return TrafficClass::Bulk;
+    }
+}
+
+enum FrameFlags : uint8_t {
+    FrameFlagCompressed = 1 << 0,
+    FrameFlagBroadcast = 1 << 1, // seq is counted per destination, broadcasts have their own counter
+    FrameFlagVirtual = 1 << 2 // sent by a virtual node of the tester load generator, the payload starts with a VirtualHeader
+};
+
+struct __attribute__((packed)) FrameHeader
+{
+    uint8_t magic;
+    FrameType type;
+    uint8_t flags;
+    uint16_t seq;
+};
+
+struct __attribute__((packed)) PingPayload
+{
+    uint32_t session;
+    uint32_t seq;
+    int64_t sentUs; // sender clock, echoed back in the pong
+    // network time of the responder (espnow::timesync) at reception of the ping and queueing of the pong, 0 if it has none
+    int64_t pingRxUs;
+    int64_t pongTxUs;
+};
+
+// t1 to t3 of the ptp exchange, t4 is the arrival of the response
+struct __attribute__((packed)) TimeSyncPayload
+{
+    uint32_t session;
+    uint32_t seq;
+    int64_t requestTxUs; // requester clock
+    int64_t requestRxUs; // network time of the responder
+    int64_t responseTxUs; // network time of the responder
+};
+
+enum RelayFlags : uint8_t {
+    RelayFlagTimed = 1 << 0 // originUs is set, the origin had a synced network time
+};
+
+// in front of the payload of relayed frames, seq and origin identify the frame for the duplicate cache
+struct __attribute__((packed)) RelayHeader
+{
+    uint8_t origin[ESP_NOW_ETH_ALEN];
+    uint8_t destination[ESP_NOW_ETH_ALEN]; // broadcast address for floods
+    uint16_t seq; // counted per origin
+    uint8_t ttl; // hops left, a node receiving ttl 1 does not forward
+    uint8_t hops; // hops taken before the last transmission
+    FrameType type; // of the payload
+    uint8_t flags;
+    uint32_t originUs; // lower bits of the network time (espnow::timesync) when the origin queued it
+};
+
+// virtual nodes share the mac of the sending board, seq is counted per node
+struct __attribute__((packed)) VirtualHeader
+{
+    uint8_t node; // 1 to 255
+};
+
+// announced periodically by a node serving its firmware
+struct __attribute__((packed)) OtaOffer
+{
+    uint32_t session;
+    uint32_t imageSize;
+    uint16_t chunkSize;
+    uint8_t sha256[32]; // of the image, as esp_partition_get_sha256() reports it
+    char version[32];
+};
+
+// sent by a receiver for up to 32 chunks, the sender answers with the chunks of the set bits
+struct __attribute__((packed)) OtaRequest
+{
+    uint32_t session;
+    uint32_t firstChunk;
+    uint32_t missing; // bit i is chunk firstChunk + i
+};
+
+struct __attribute__((packed)) OtaChunkHeader
+{
+    uint32_t session;
+    uint32_t index;
+    uint8_t hash[8]; // first bytes of the sha256 of the chunk data
+};
+
+constexpr const size_t MaxFramePayload = ESP_NOW_MAX_DATA_LEN - sizeof(FrameHeader);
+constexpr const size_t MaxRelayPayload = MaxFramePayload - sizeof(RelayHeader);
+constexpr const size_t MaxVirtualPayload = MaxFramePayload - sizeof(VirtualHeader);
+
+constexpr const uint16_t OtaChunkSize = 224;
+static_assert(sizeof(OtaChunkHeader) + OtaChunkSize <= MaxFramePayload);
+} // namespace espnow
@@ -0,0 +1,309 @@
+#include "espnowrate.h"
+
+// system includes
+#include <algorithm>
+#include <mutex>
+
+// esp-idf includes
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+// local includes
+#include "config.h"
+
+namespace espnow::rate {
+namespace {
+constexpr const char * const TAG = "ESP_NOW_RATE";
+
+// a window ends after MinWindowUs with at least MinWindowFrames completions, or after MaxWindowUs with any
+constexpr const int64_t MinWindowUs = 100000;
+constexpr const int64_t MaxWindowUs = 1000000;
+constexpr const uint32_t MinWindowFrames = 16;
+
+// weight of the newest window in the delivery ratio
+constexpr const float EwmaWeight = 0.25f;
+
+// every n-th window is spent on another rate
+constexpr const uint32_t SampleEvery = 10;
+
+// rates below this delivery ratio are only sampled once every LowSampleEvery windows, the link may have improved
+constexpr const float MinSampleProbability = 0.1f;
+constexpr const uint32_t LowSampleEvery = 50;
+
+// throughput estimates are for frames of this size, close to the usual full esp-now frame
+constexpr const uint32_t ReferenceFrameBytes = 250;
+
+// written from the send callback, the windows are taken by update()
+std::array<std::atomic<uint32_t>, RateCount> attempts{};
+std::array<std::atomic<uint32_t>, RateCount> successes{};
+std::array<std::atomic<uint32_t>, RateCount> windowAttempts{};
+std::array<std::atomic<uint32_t>, RateCount> windowSuccesses{};
+
+bool configsSubscribed{};
+std::atomic<bool> enabled{};
+std::atomic<uint8_t> selectedIndex{NoRate};
+
+// guards the estimates and the trace, update() runs in the scheduler, the readers in the console and httpd
+std::mutex mutex;
+std::array<std::optional<float>, RateCount> probability{};
+std::array<Decision, 16> decisions{};
+size_t decisionCount{};
+
+// only touched by update()
+int64_t windowStartUs{};
+uint32_t windowsSinceSample{};
+uint32_t windowsSinceLowSample{};
+bool sampling{};
+
+bool eligible(size_t index)
+{
+    return !phyRates[index].longRange || configs.espnowLongRange.value;
+}
+
+// frame, ack and the gaps in between
+uint32_t airtimeUs(const PhyRate &rate)
+{
+    uint32_t overheadUs;
+    switch (rate.rate)
+    {
+    case WIFI_PHY_RATE_1M_L:
+    case WIFI_PHY_RATE_2M:
+    case WIFI_PHY_RATE_5M_L:
+    case WIFI_PHY_RATE_11M_L:
+        overheadUs = 560; // long preamble and an ack at 1M
+        break;
+    case WIFI_PHY_RATE_LORA_250K:
+    case WIFI_PHY_RATE_LORA_500K:
+        overheadUs = 600;
+        break;
+    default:
+        overheadUs = 120;
+    }
+    return overheadUs + ReferenceFrameBytes * 8 * 1000 / rate.kbps;
+}
+
+float expectedKbps(size_t index, float deliveryRatio)
+{
+    return deliveryRatio * ReferenceFrameBytes * 8 * 1000 / airtimeUs(phyRates[index]);
+}
+
+float expectedKbpsLocked(size_t index)
+{
+    return probability[index] ? expectedKbps(index, *probability[index]) : 0.f;
+}
+
+void selectLocked(uint8_t index, Reason reason)
+{
+    stats.decisions[size_t(reason)]++;
+
+    const uint8_t from = selectedIndex;
+    if (from == index)
+        return;
+
+    decisions[decisionCount++ % decisions.size()] = Decision{
+        .timestampUs = esp_timer_get_time(),
+        .from = from,
+        .to = index,
+        .reason = reason,
+        .expectedKbps = expectedKbpsLocked(index)
+    };
+    stats.changes++;
+    selectedIndex = index;
+
+    ESP_LOGD(TAG, "%s -> %s (%.*s)", from == NoRate ? "-" : phyRates[from].name, phyRates[index].name,
+             toString(reason).size(), toString(reason).data());
+}
+
+// a rate that would beat the best one if all its frames arrived, picked at random
+std::optional<uint8_t> pickSampleLocked(uint8_t best)
+{
+    const float bestKbps = expectedKbpsLocked(best);
+
+    std::array<uint8_t, RateCount> candidates, lowCandidates;
+    size_t count{}, lowCount{};
+    for (size_t i = 0; i < RateCount; i++)
+    {
+        if (i == best || !eligible(i) || expectedKbps(i, 1.f) <= bestKbps)
+            continue;
+        if (probability[i] && *probability[i] < MinSampleProbability)
+            lowCandidates[lowCount++] = i;
+        else
+            candidates[count++] = i;
+    }
+
+    if (lowCount && windowsSinceLowSample >= LowSampleEvery)
+    {
+        windowsSinceLowSample = 0;
+        return lowCandidates[esp_random() % lowCount];
+    }
+
+    if (!count)
+        return std::nullopt;
+    return candidates[esp_random() % count];
+}
+
+void evaluateWindow()
+{
+    std::lock_guard lock{mutex};
+
+    for (size_t i = 0; i < RateCount; i++)
+    {
+        const uint32_t windowAttempted = windowAttempts[i].exchange(0);
+        const uint32_t windowSucceeded = windowSuccesses[i].exchange(0);
+        if (!windowAttempted)
+            continue;
+
+        const float ratio = float(std::min(windowSucceeded, windowAttempted)) / windowAttempted;
+        probability[i] = probability[i] ? *probability[i] * (1.f - EwmaWeight) + ratio * EwmaWeight : ratio;
+    }
+
+    stats.windows++;
+    windowsSinceLowSample++;
+
+    uint8_t best = selectedIndex;
+    for (size_t i = 0; i < RateCount; i++)
+        if (eligible(i) && probability[i] && (best == NoRate || !eligible(best) || expectedKbpsLocked(i) > expectedKbpsLocked(best)))
+            best = i;
+
+    if (best == NoRate || !eligible(best))
+        return;
+
+    if (sampling)
+    {
+        sampling = false;
+        selectLocked(best, best == selectedIndex ? Reason::SampleWon : Reason::Best);
+        return;
+    }
+
+    if (++windowsSinceSample >= SampleEvery)
+        if (const auto sample = pickSampleLocked(best))
+        {
+            windowsSinceSample = 0;
+            sampling = true;
+            selectLocked(*sample, Reason::Sample);
+            return;
+        }
+
+    selectLocked(best, Reason::Best);
+}
+} // namespace
+
+Stats stats;
+
+std::string_view toString(Reason reason)
+{
+    switch (reason)
+    {
+    case Reason::Start:      return "start";
+    case Reason::Best:       return "best";
+    case Reason::Sample:     return "sample";
+    case Reason::SampleWon:  return "sample_won";
+    case Reason::Ineligible: return "ineligible";
+    }
+    return "unknown";
+}
+
+void forEachRate(const std::function<void(const RateStatus &)> &callback)
+{
+    std::lock_guard lock{mutex};
+    for (size_t i = 0; i < RateCount; i++)
+        callback(RateStatus{
+            .rate = phyRates[i],
+            .attempts = attempts[i],
+            .success = successes[i],
+            .probability = probability[i],
+            .expectedKbps = expectedKbpsLocked(i),
+            .eligible = eligible(i),
+            .selected = enabled && selectedIndex == i
+        });
+}
+
+void forEachDecision(const std::function<void(const Decision &)> &callback)
+{
+    std::lock_guard lock{mutex};
+    for (size_t i = decisionCount > decisions.size() ? decisionCount - decisions.size() : 0; i < decisionCount; i++)
+        callback(decisions[i % decisions.size()]);
+}
+
+std::optional<uint8_t> indexOf(wifi_phy_rate_t rate)
+{
+    for (size_t i = 0; i < RateCount; i++)
+        if (phyRates[i].rate == rate)
+            return i;
+    return std::nullopt;
+}
+
+std::optional<wifi_phy_rate_t> selected()
+{
+    if (!enabled)
+        return std::nullopt;
+    if (const uint8_t index = selectedIndex; index != NoRate)
+        return phyRates[index].rate;
+    return std::nullopt;
+}
+
+void account(uint8_t rateIndex, bool success)
+{
+    if (rateIndex >= RateCount)
+    {
+        stats.unattributed++;
+        return;
+    }
+
+    attempts[rateIndex]++;
+    windowAttempts[rateIndex]++;
+    if (success)
+    {
+        successes[rateIndex]++;
+        windowSuccesses[rateIndex]++;
+    }
+}
+
+void update()
+{
+    if (!configsSubscribed)
+    {
+        onConfigChange(configs.espnowAutoRate, [](const bool &value){ enabled = value; });
+        enabled = configs.espnowAutoRate.value;
+        configsSubscribed = true;
+    }
+
+    if (!enabled)
+    {
+        selectedIndex = NoRate;
+        return;
+    }
+
+    const auto now = esp_timer_get_time();
+
+    if (selectedIndex == NoRate || !eligible(selectedIndex))
+    {
+        const auto start = indexOf(configs.espnowRate.value).value_or(0);
+        std::lock_guard lock{mutex};
+        selectLocked(eligible(start) ? start : 0, selectedIndex == NoRate ? Reason::Start : Reason::Ineligible);
+        sampling = false;
+        windowStartUs = now;
+        return;
+    }
+
+    const auto elapsedUs = now - windowStartUs;
+    if (elapsedUs < MinWindowUs)
+        return;
+
+    uint32_t frames{};
+    for (const auto &count : windowAttempts)
+        frames += count;
+
+    // without unicast traffic there is nothing to learn, the rate stays
+    if (frames < MinWindowFrames && (elapsedUs < MaxWindowUs || !frames))
+    {
+        if (!frames)
+            windowStartUs = now;
+        return;
+    }
+
+    evaluateWindow();
+    windowStartUs = now;
+}
+} // namespace espnow::rate
@@ -0,0 +1,80 @@
+#pragma once
+
+// system includes
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string_view>
+
+// esp-idf includes
+#include <esp_wifi.h>
+
+// local includes
+#include "espnow.h"
+
+// minstrel like phy rate selection with configs.espnowAutoRate. the driver only has one esp-now rate per interface,
+// so the acked unicast frames to all peers are combined to pick it, broadcasts are never acked and not counted
+namespace espnow::rate {
+constexpr const size_t RateCount = std::size(phyRates);
+
+// marks frames sent before a rate was applied
+constexpr const uint8_t NoRate = 0xFF;
+
+enum class Reason : uint8_t {
+    Start, // auto rate enabled, starts at configs.espnowRate
+    Best, // highest expected throughput
+    Sample, // one window on a rate that could beat the best one
+    SampleWon, // the sampled rate became the best one
+    Ineligible // long range rates after configs.espnowLongRange was disabled
+};
+
+std::string_view toString(Reason reason);
+
+struct Stats
+{
+    std::atomic<uint32_t> windows{};
+    std::atomic<uint32_t> changes{};
+    std::atomic<uint32_t> unattributed{}; // completions of frames sent before a rate was applied
+    std::array<std::atomic<uint32_t>, 5> decisions{}; // indexed by Reason
+};
+
+extern Stats stats;
+
+struct RateStatus
+{
+    const PhyRate &rate;
+    uint32_t attempts;
+    uint32_t success;
+    std::optional<float> probability; // ewma of the delivery ratio, empty before the first frame at this rate
+    float expectedKbps; // goodput of a 250 byte frame at this probability
+    bool eligible;
+    bool selected;
+};
+
+void forEachRate(const std::function<void(const RateStatus &)> &callback);
+
+struct Decision
+{
+    int64_t timestampUs;
+    uint8_t from; // index into phyRates, NoRate before the first decision
+    uint8_t to;
+    Reason reason;
+    float expectedKbps; // of the rate switched to
+};
+
+// oldest first
+void forEachDecision(const std::function<void(const Decision &)> &callback);
+
+std::optional<uint8_t> indexOf(wifi_phy_rate_t rate);
+
+// empty while auto rate is disabled, configs.espnowRate applies then
+std::optional<wifi_phy_rate_t> selected();
+
+// called from the esp-now send callback for unicast frames, rateIndex is the rate the frame was sent with
+void account(uint8_t rateIndex, bool success);
+
+// evaluates the finished windows, called from the scheduler. a new rate is applied by the next radio sync
+void update();
+} // namespace espnow::rate
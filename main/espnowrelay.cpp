@@ -0,0 +1,420 @@
+#include "espnowrelay.h"
+
+// system includes
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+// esp-idf includes
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+// local includes
+#include "config.h"
+#include "espnow.h"
+#include "espnowfilter.h"
+#include "espnowtimesync.h"
+
+namespace espnow::relay {
+namespace {
+constexpr const char * const TAG = "ESP_NOW_RELAY";
+
+// a rebroadcast is cancelled when this many neighbours were heard forwarding the frame during the random delay
+constexpr const uint8_t SuppressCopies = 3;
+
+constexpr const int64_t RouteTimeoutUs = 30000000;
+
+using mac_t = std::array<uint8_t, ESP_NOW_ETH_ALEN>;
+
+// set associative cache of recently seen frames, a new frame replaces the oldest entry of its set
+constexpr const size_t CacheSets = 64;
+constexpr const size_t CacheWays = 4;
+
+struct CacheEntry
+{
+    uint64_t key; // origin mac and seq, 0 is unused
+    uint8_t copies;
+};
+
+struct Pending
+{
+    int64_t dueUs;
+    uint64_t key;
+    mac_t destination;
+    uint8_t size;
+    std::array<uint8_t, MaxFramePayload> frame;
+};
+
+// guards the cache, the routes and ownMac, they are used from the receive callback and the relay task
+std::mutex mutex;
+std::array<std::array<CacheEntry, CacheWays>, CacheSets> cache{};
+std::array<uint8_t, CacheSets> nextWay{};
+std::array<Route, 16> routes{};
+size_t routeCount{};
+mac_t ownMac{};
+uint16_t nextSeq{};
+
+QueueHandle_t queue{};
+bool configsSubscribed{};
+std::atomic<bool> enabled{};
+std::atomic<uint8_t> jitterMs{};
+
+// only touched by the relay task
+std::array<Pending, 8> pending;
+size_t pendingCount{};
+
+uint64_t keyOf(const uint8_t *origin, uint16_t seq);
+bool isBroadcast(const uint8_t *mac);
+CacheEntry *findLocked(uint64_t key);
+void insertLocked(uint64_t key);
+void learnRouteLocked(const uint8_t *origin, const uint8_t *nextHop, uint8_t hops, int64_t now);
+mac_t nextHopFor(const uint8_t *destination);
+void forward(RelayHeader header, std::string_view payload, uint64_t key);
+void forwardDue();
+void relayTask(void *);
+} // namespace
+
+Stats stats;
+
+void forEachRoute(const std::function<void(const Route &)> &callback)
+{
+    const auto now = esp_timer_get_time();
+    std::lock_guard lock{mutex};
+    for (size_t i = 0; i < routeCount; i++)
+        if (now - routes[i].lastSeenUs < RouteTimeoutUs)
+            callback(routes[i]);
+}
+
+esp_err_t send(FrameType type, const uint8_t *data, size_t size, const uint8_t *destination, TickType_t timeout)
+{
+    if (size > MaxRelayPayload)
+        return ESP_ERR_INVALID_SIZE;
+
+    RelayHeader header{
+        .origin = {},
+        .destination = {},
+        .seq = 0,
+        .ttl = configs.espnowRelayTtl.value,
+        .hops = 0,
+        .type = type,
+        .flags = 0,
+        .originUs = 0
+    };
+    std::memcpy(header.destination, destination, ESP_NOW_ETH_ALEN);
+
+    if (const auto now = timesync::networkTime(esp_timer_get_time()))
+    {
+        header.flags |= RelayFlagTimed;
+        header.originUs = uint32_t(*now);
+    }
+
+    {
+        // our own frames coming back from the neighbours are duplicates
+        std::lock_guard lock{mutex};
+        std::memcpy(header.origin, ownMac.data(), ESP_NOW_ETH_ALEN);
+        header.seq = nextSeq++;
+        insertLocked(keyOf(header.origin, header.seq));
+    }
+
+    std::array<uint8_t, MaxFramePayload> frame;
+    std::memcpy(frame.data(), &header, sizeof(header));
+    std::memcpy(frame.data() + sizeof(header), data, size);
+
+    if (const auto error = queueEspNow(FrameType::Relay, frame.data(), sizeof(header) + size, nextHopFor(destination).data(), timeout); error != ESP_OK)
+        return error;
+
+    stats.originated++;
+    return ESP_OK;
+}
+
+void update()
+{
+    if (!configsSubscribed)
+    {
+        onConfigChange(configs.espnowRelay, [](const bool &value){ enabled = value; });
+        onConfigChange(configs.espnowRelayJit, [](const uint8_t &value){ jitterMs = value; });
+        enabled = configs.espnowRelay.value;
+        jitterMs = configs.espnowRelayJit.value;
+        configsSubscribed = true;
+    }
+
+    // the origin of our frames is the address the neighbours see them from
+    {
+        mac_t mac;
+        if (esp_wifi_get_mac(configs.wifiApEnabled.value ? WIFI_IF_AP : WIFI_IF_STA, mac.data()) == ESP_OK)
+        {
+            std::lock_guard lock{mutex};
+            ownMac = mac;
+        }
+    }
+
+    if (queue || !enabled)
+        return;
+
+    queue = xQueueCreate(pending.size(), sizeof(Pending));
+    if (!queue)
+    {
+        ESP_LOGE(TAG, "xQueueCreate() failed");
+        return;
+    }
+
+    if (const auto result = xTaskCreatePinnedToCore(relayTask, "espnowRelay", 3072, nullptr, configs.espnowTxPrio.value, nullptr, configs.radioCore.value); result != pdPASS)
+    {
+        ESP_LOGE(TAG, "xTaskCreatePinnedToCore() failed with %i", result);
+        vQueueDelete(queue);
+        queue = nullptr;
+    }
+}
+
+bool handleFrame(RecvRecord &record, std::string_view &payload)
+{
+    RelayHeader header;
+    if (payload.size() < sizeof(header))
+    {
+        rxStats.decodeErrors++;
+        return false;
+    }
+    std::memcpy(&header, payload.data(), sizeof(header));
+    payload.remove_prefix(sizeof(header));
+
+    if (header.type == FrameType::Relay)
+    {
+        rxStats.decodeErrors++;
+        return false;
+    }
+
+    // the filter only saw the neighbour and the relay type, frames it rejects are neither delivered nor forwarded
+    if (!filter::acceptRelayed(header.origin, uint8_t(header.type)))
+        return false;
+
+    const auto key = keyOf(header.origin, header.seq);
+    bool forUs;
+    {
+        std::lock_guard lock{mutex};
+
+        if (std::equal(std::begin(ownMac), std::end(ownMac), header.origin))
+        {
+            stats.duplicates++;
+            return false;
+        }
+
+        learnRouteLocked(header.origin, record.mac.data(), header.hops + 1, record.timestamp);
+
+        if (auto entry = findLocked(key))
+        {
+            if (entry->copies < 0xFF)
+                entry->copies++;
+            stats.duplicates++;
+            return false;
+        }
+        insertLocked(key);
+
+        forUs = std::memcmp(header.destination, ownMac.data(), ESP_NOW_ETH_ALEN) == 0;
+    }
+    stats.received++;
+
+    // spread over the hops the frame took, only meaningful with both ends synced to the same reference
+    if (header.flags & RelayFlagTimed)
+        if (const auto now = timesync::networkTime(record.timestamp))
+        {
+            stats.timedFrames++;
+            stats.hopLatencySumUs += (uint32_t(*now) - header.originUs) / (header.hops + 1);
+            stats.hopsSum += header.hops + 1;
+        }
+
+    if (!forUs)
+        forward(header, payload, key);
+
+    if (!forUs && !isBroadcast(header.destination))
+        return false;
+
+    stats.delivered++;
+    std::copy(std::begin(header.origin), std::end(header.origin), std::begin(record.mac));
+    record.header.type = header.type;
+    record.relayed = true;
+    return true;
+}
+
+namespace {
+uint64_t keyOf(const uint8_t *origin, uint16_t seq)
+{
+    uint64_t key{};
+    for (size_t i = 0; i < ESP_NOW_ETH_ALEN; i++)
+        key = (key << 8) | origin[i];
+    return (key << 16) | seq;
+}
+
+bool isBroadcast(const uint8_t *mac)
+{
+    return std::equal(mac, mac + ESP_NOW_ETH_ALEN, std::begin(broadcastAddress));
+}
+
+// fibonacci hashing, the upper bits select the set
+size_t setOf(uint64_t key)
+{
+    static_assert(CacheSets == 64);
+    return (key * 0x9E3779B97F4A7C15ull) >> 58;
+}
+
+CacheEntry *findLocked(uint64_t key)
+{
+    for (auto &entry : cache[setOf(key)])
+        if (entry.key == key)
+            return &entry;
+    return nullptr;
+}
+
+void insertLocked(uint64_t key)
+{
+    const auto set = setOf(key);
+    cache[set][nextWay[set]] = CacheEntry{ .key = key, .copies = 0 };
+    nextWay[set] = (nextWay[set] + 1) % CacheWays;
+}
+
+void learnRouteLocked(const uint8_t *origin, const uint8_t *nextHop, uint8_t hops, int64_t now)
+{
+    auto end = std::begin(routes) + routeCount;
+    auto route = std::find_if(std::begin(routes), end, [&](const Route &route){
+        return std::equal(std::begin(route.origin), std::end(route.origin), origin);
+    });
+
+    if (route == end)
+    {
+        if (routeCount < routes.size())
+            routeCount++;
+        else
+            route = std::min_element(std::begin(routes), end, [](const Route &a, const Route &b){
+                return a.lastSeenUs < b.lastSeenUs;
+            });
+        std::copy(origin, origin + ESP_NOW_ETH_ALEN, std::begin(route->origin));
+    }
+    // keep the shorter path while it is alive, copies over longer paths arrive all the time
+    else if (hops > route->hops && now - route->lastSeenUs < RouteTimeoutUs &&
+             !std::equal(std::begin(route->nextHop), std::end(route->nextHop), nextHop))
+        return;
+
+    std::copy(nextHop, nextHop + ESP_NOW_ETH_ALEN, std::begin(route->nextHop));
+    route->hops = hops;
+    route->lastSeenUs = now;
+}
+
+// unicasts need the next hop in the peer table, everything else is flooded
+mac_t nextHopFor(const uint8_t *destination)
+{
+    mac_t broadcast;
+    std::copy(std::begin(broadcastAddress), std::end(broadcastAddress), std::begin(broadcast));
+    if (isBroadcast(destination))
+        return broadcast;
+
+    mac_t nextHop;
+    {
+        const auto now = esp_timer_get_time();
+        std::lock_guard lock{mutex};
+        const auto end = std::begin(routes) + routeCount;
+        const auto route = std::find_if(std::begin(routes), end, [&](const Route &route){
+            return std::equal(std::begin(route.origin), std::end(route.origin), destination);
+        });
+        if (route == end || now - route->lastSeenUs >= RouteTimeoutUs)
+            return broadcast;
+        nextHop = route->nextHop;
+    }
+
+    return findPeer(nextHop.data()) ? nextHop : broadcast;
+}
+
+void forward(RelayHeader header, std::string_view payload, uint64_t key)
+{
+    if (!enabled || !queue)
+        return;
+
+    if (header.ttl <= 1)
+    {
+        stats.expired++;
+        return;
+    }
+    header.ttl--;
+    header.hops++;
+
+    Pending item{ .dueUs = esp_timer_get_time(), .key = key, .destination = {}, .size = uint8_t(sizeof(header) + payload.size()), .frame = {} };
+    if (const auto jitter = jitterMs.load())
+        item.dueUs += int64_t(esp_random() % (jitter * 1000u));
+
+    item.destination = nextHopFor(header.destination);
+    if (!isBroadcast(item.destination.data()))
+        stats.directed++;
+
+    std::memcpy(item.frame.data(), &header, sizeof(header));
+    std::memcpy(item.frame.data() + sizeof(header), payload.data(), payload.size());
+
+    if (xQueueSend(queue, &item, 0) != pdTRUE)
+        stats.dropped++;
+}
+
+void forwardDue()
+{
+    const auto now = esp_timer_get_time();
+    for (size_t i = 0; i < pendingCount;)
+    {
+        auto &item = pending[i];
+        if (item.dueUs > now)
+        {
+            i++;
+            continue;
+        }
+
+        uint8_t copies{};
+        {
+            std::lock_guard lock{mutex};
+            if (const auto entry = findLocked(item.key))
+                copies = entry->copies;
+        }
+
+        if (copies >= SuppressCopies)
+            stats.suppressed++;
+        else if (queueEspNow(FrameType::Relay, item.frame.data(), item.size, item.destination.data(), pdMS_TO_TICKS(10)) == ESP_OK)
+            stats.forwarded++;
+        else
+            stats.dropped++;
+
+        item = pending[--pendingCount];
+    }
+}
+
+void relayTask(void *)
+{
+    Pending incoming;
+
+    while (true)
+    {
+        // due frames go out on every pass, a queue that never runs empty must not hold them back
+        forwardDue();
+
+        // frames beyond the pending slots wait in the queue, forward() drops once that is full too
+        while (pendingCount < pending.size() && xQueueReceive(queue, &incoming, 0) == pdTRUE)
+            pending[pendingCount++] = incoming;
+
+        TickType_t wait = portMAX_DELAY;
+        if (pendingCount)
+        {
+            const auto due = std::min_element(std::begin(pending), std::begin(pending) + pendingCount, [](const Pending &a, const Pending &b){
+                return a.dueUs < b.dueUs;
+            })->dueUs;
+            const auto remainingUs = due - esp_timer_get_time();
+            if (remainingUs <= 0)
+                continue;
+            // rounded up, the resolution of the delay is one tick
+            wait = pdMS_TO_TICKS((remainingUs + 999) / 1000) + 1;
+        }
+
+        if (pendingCount == pending.size())
+            vTaskDelay(wait);
+        else if (xQueueReceive(queue, &incoming, wait) == pdTRUE)
+            pending[pendingCount++] = incoming;
+    }
+}
+} // namespace
+} // namespace espnow::relay
@@ -0,0 +1,63 @@
+#pragma once
+
+// system includes
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+// esp-idf includes
+#include <esp_err.h>
+#include <esp_now.h>
+#include <freertos/FreeRTOS.h>
+
+// local includes
+#include "espnowprotocol.h"
+
+namespace espnow {
+struct RecvRecord;
+
+// multi hop flooding. frames are wrapped in a RelayHeader and rebroadcast after a random delay by
+// every node with configs.espnowRelay, a cache of recently seen origin/seq pairs drops the copies
+namespace relay {
+struct Stats
+{
+    std::atomic<uint32_t> originated{};
+    std::atomic<uint32_t> received{}; // first copies
+    std::atomic<uint32_t> duplicates{}; // further copies, including our own frames coming back
+    std::atomic<uint32_t> delivered{}; // for this node
+    std::atomic<uint32_t> forwarded{};
+    std::atomic<uint32_t> directed{}; // forwarded to the next hop of a known route instead of broadcast
+    std::atomic<uint32_t> suppressed{}; // rebroadcast cancelled, enough neighbours forwarded it already
+    std::atomic<uint32_t> expired{}; // ttl used up
+    std::atomic<uint32_t> dropped{}; // forward queue full
+    std::atomic<uint32_t> timedFrames{}; // frames the hop latency below is taken from
+    std::atomic<uint32_t> hopLatencySumUs{};
+    std::atomic<uint32_t> hopsSum{};
+};
+
+extern Stats stats;
+
+// learned from the relay frames received, hops 1 are the direct neighbours
+struct Route
+{
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> origin;
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> nextHop;
+    uint8_t hops;
+    int64_t lastSeenUs;
+};
+
+void forEachRoute(const std::function<void(const Route &)> &callback);
+
+// wraps the frame and queues it for the first hop, destination is broadcast or the origin mac of a node
+esp_err_t send(FrameType type, const uint8_t *data, size_t size, const uint8_t *destination, TickType_t timeout = 0);
+
+// starts the forwarding task, called from the scheduler
+void update();
+
+// called from the esp-now receive callback for relay frames. returns true if the wrapped frame is for this node,
+// record and payload then describe it as if the origin had sent it directly, with record.relayed set
+bool handleFrame(RecvRecord &record, std::string_view &payload);
+} // namespace relay
+} // namespace espnow
@@ -0,0 +1,261 @@
+#include "espnowsniffer.h"
+
+// system includes
+#include <array>
+#include <atomic>
+#include <cstring>
+
+// esp-idf includes
+#include <esp_log.h>
+#include <esp_wifi.h>
+
+// local includes
+#include "config.h"
+#include "espnowfilter.h"
+#include "espnowprotocol.h"
+#include "telemetry.h"
+
+namespace espnow::sniffer {
+namespace {
+constexpr const char * const TAG = "ESP_NOW_SNIFF";
+
+// offsets into the vendor specific action frame esp-now uses
+constexpr size_t MacHeaderSize = 24;
+constexpr size_t CategoryOffset = MacHeaderSize;
+constexpr size_t ElementIdOffset = CategoryOffset + 1 + 3 + 4;
+constexpr size_t ElementTypeOffset = ElementIdOffset + 2 + 3;
+constexpr size_t BodyOffset = ElementTypeOffset + 2;
+
+constexpr uint8_t ActionFrameControl = 0xD0;
+constexpr uint8_t AckFrameControl = 0xD4;
+constexpr uint8_t ProtectedFlag = 0x40;
+constexpr uint8_t VendorSpecificCategory = 127;
+constexpr uint8_t VendorSpecificElement = 0xDD;
+constexpr uint8_t EspNowType = 4;
+constexpr uint8_t EspressifOui[] = {0x18, 0xFE, 0x34};
+
+struct CacheSlot
+{
+    std::atomic<uint32_t> key;
+    std::atomic<uint32_t> metadata;
+};
+
+// written by the promiscuous callback and read by the receive callback, both run in the wifi task,
+// the key is re-checked after reading so a slot overwritten in between is detected anyway
+std::array<CacheSlot, 32> cache;
+
+bool enabled{};
+
+// frames to other receivers would overwrite cache slots with unrelated metadata
+std::array<std::array<uint8_t, 6>, 2> ownMacs{};
+
+bool addressedToUs(const uint8_t *destination)
+{
+    constexpr uint8_t broadcast[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    if (std::memcmp(destination, broadcast, sizeof(broadcast)) == 0)
+        return true;
+    for (const auto &mac : ownMacs)
+        if (std::memcmp(destination, mac.data(), mac.size()) == 0)
+            return true;
+    return false;
+}
+
+uint32_t makeKey(const uint8_t *mac, uint16_t seq, bool broadcast)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 6; i++)
+        hash = (hash ^ mac[i]) * 16777619u;
+    hash = (hash ^ (seq & 0xFF)) * 16777619u;
+    hash = (hash ^ (seq >> 8)) * 16777619u;
+    hash = (hash ^ broadcast) * 16777619u;
+    return hash | 1; // 0 marks an empty slot
+}
+
+uint32_t packMetadata(const RxMetadata &metadata)
+{
+    uint32_t packed;
+    std::memcpy(&packed, &metadata, sizeof(packed));
+    return packed;
+}
+
+RxMetadata unpackMetadata(uint32_t packed)
+{
+    RxMetadata metadata;
+    std::memcpy(&metadata, &packed, sizeof(metadata));
+    return metadata;
+}
+
+static_assert(sizeof(RxMetadata) == sizeof(uint32_t));
+
+void promiscuousCb(void *buf, wifi_promiscuous_pkt_type_t type)
+{
+    telemetry::HotPath hotPath;
+
+    const auto *packet = static_cast<const wifi_promiscuous_pkt_t *>(buf);
+    const uint8_t *frame = packet->payload;
+    const size_t length = packet->rx_ctrl.sig_len;
+
+    if (type == WIFI_PKT_CTRL)
+    {
+        if (length >= 10 && frame[0] == AckFrameControl && addressedToUs(&frame[4]))
+        {
+            ackStats.frames++;
+            ackStats.rssiSum += packet->rx_ctrl.rssi;
+        }
+        return;
+    }
+
+    if (type != WIFI_PKT_MGMT)
+        return;
+
+    if (length < BodyOffset + sizeof(FrameHeader) ||
+        frame[0] != ActionFrameControl ||
+        frame[1] & ProtectedFlag ||
+        frame[CategoryOffset] != VendorSpecificCategory ||
+        std::memcmp(&frame[CategoryOffset + 1], EspressifOui, sizeof(EspressifOui)) != 0 ||
+        frame[ElementIdOffset] != VendorSpecificElement ||
+        frame[ElementTypeOffset] != EspNowType)
+        return;
+
+    FrameHeader header;
+    std::memcpy(&header, &frame[BodyOffset], sizeof(header));
+    if (header.magic != FrameMagic)
+        return;
+
+    if (!addressedToUs(&frame[4]))
+        return;
+
+    const uint8_t *sender = &frame[10];
+
+    // frames the receive callback drops anyway would only evict the metadata of wanted ones
+    if (filter::check(sender, &frame[BodyOffset], length - BodyOffset) != filter::Verdict::Accept)
+        return;
+
+    const RxMetadata metadata {
+        .rssi = int8_t(packet->rx_ctrl.rssi),
+        .noiseFloor = int8_t(packet->rx_ctrl.noise_floor),
+        .rate = uint8_t(packet->rx_ctrl.sig_mode ? 32 + (packet->rx_ctrl.mcs & 0x07) : packet->rx_ctrl.rate),
+        .channel = uint8_t(packet->rx_ctrl.channel)
+    };
+
+    const auto key = makeKey(sender, header.seq, header.flags & FrameFlagBroadcast);
+    auto &slot = cache[key % cache.size()];
+    slot.key.store(0, std::memory_order_relaxed);
+    slot.metadata.store(packMetadata(metadata), std::memory_order_relaxed);
+    slot.key.store(key, std::memory_order_release);
+}
+} // namespace
+
+AckStats ackStats;
+
+void update()
+{
+    const bool shouldRun = configs.espnowRssiCapture.value;
+    if (shouldRun == enabled)
+        return;
+
+    if (!shouldRun)
+    {
+        stop();
+        return;
+    }
+
+    for (const auto interface : {WIFI_IF_STA, WIFI_IF_AP})
+        if (const auto error = esp_wifi_get_mac(interface, ownMacs[interface].data()); error != ESP_OK)
+            ESP_LOGW(TAG, "esp_wifi_get_mac failed with %s", esp_err_to_name(error));
+
+    const wifi_promiscuous_filter_t filter { .filter_mask = WIFI_PROMIS_FILTER_MASK_MGMT | WIFI_PROMIS_FILTER_MASK_CTRL };
+    if (const auto error = esp_wifi_set_promiscuous_filter(&filter); error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_wifi_set_promiscuous_filter failed with %s", esp_err_to_name(error));
+        return;
+    }
+
+    const wifi_promiscuous_filter_t ctrlFilter { .filter_mask = WIFI_PROMIS_CTRL_FILTER_MASK_ACK };
+    if (const auto error = esp_wifi_set_promiscuous_ctrl_filter(&ctrlFilter); error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_wifi_set_promiscuous_ctrl_filter failed with %s", esp_err_to_name(error));
+        return;
+    }
+
+    if (const auto error = esp_wifi_set_promiscuous_rx_cb(promiscuousCb); error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_wifi_set_promiscuous_rx_cb failed with %s", esp_err_to_name(error));
+        return;
+    }
+
+    if (const auto error = esp_wifi_set_promiscuous(true); error != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_wifi_set_promiscuous failed with %s", esp_err_to_name(error));
+        return;
+    }
+
+    ESP_LOGI(TAG, "rssi capture enabled");
+    enabled = true;
+}
+
+void stop()
+{
+    if (!enabled)
+        return;
+
+    if (const auto error = esp_wifi_set_promiscuous(false); error != ESP_OK)
+        ESP_LOGE(TAG, "esp_wifi_set_promiscuous failed with %s", esp_err_to_name(error));
+
+    ESP_LOGI(TAG, "rssi capture disabled");
+    enabled = false;
+}
+
+bool running()
+{
+    return enabled;
+}
+
+std::optional<RxMetadata> lookup(const uint8_t *mac, uint16_t seq, bool broadcast)
+{
+    if (!enabled)
+        return std::nullopt;
+
+    const auto key = makeKey(mac, seq, broadcast);
+    auto &slot = cache[key % cache.size()];
+    if (slot.key.load(std::memory_order_acquire) != key)
+        return std::nullopt;
+
+    const auto metadata = slot.metadata.load(std::memory_order_relaxed);
+    if (slot.key.load(std::memory_order_acquire) != key)
+        return std::nullopt;
+
+    return unpackMetadata(metadata);
+}
+
+std::string_view rateName(uint8_t rate)
+{
+    switch (rate)
+    {
+    case 0x00: return "1M";
+    case 0x01: return "2M";
+    case 0x02: return "5.5M";
+    case 0x03: return "11M";
+    case 0x05: return "2M short";
+    case 0x06: return "5.5M short";
+    case 0x07: return "11M short";
+    case 0x08: return "48M";
+    case 0x09: return "24M";
+    case 0x0A: return "12M";
+    case 0x0B: return "6M";
+    case 0x0C: return "54M";
+    case 0x0D: return "36M";
+    case 0x0E: return "18M";
+    case 0x0F: return "9M";
+    case 32:   return "MCS0";
+    case 33:   return "MCS1";
+    case 34:   return "MCS2";
+    case 35:   return "MCS3";
+    case 36:   return "MCS4";
+    case 37:   return "MCS5";
+    case 38:   return "MCS6";
+    case 39:   return "MCS7";
+    }
+    return "Unknown";
+}
+} // namespace espnow::sniffer
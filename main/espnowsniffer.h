@@ -0,0 +1,37 @@
+#pragma once
+
+// system includes
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace espnow::sniffer {
+struct RxMetadata
+{
+    int8_t rssi;
+    int8_t noiseFloor;
+    uint8_t rate; // index into rateName(), legacy rates 0-31, HT mcs 32+
+    uint8_t channel;
+};
+
+constexpr const uint8_t RateCount = 40;
+
+// acks addressed to us, their rssi is the best guess for the link quality while we are the sender
+struct AckStats
+{
+    std::atomic<uint32_t> frames{};
+    std::atomic<int32_t> rssiSum{};
+};
+
+extern AckStats ackStats;
+
+void update();
+void stop();
+bool running();
+
+// called from the esp-now receive callback, matches the action frame seen in promiscuous mode
+std::optional<RxMetadata> lookup(const uint8_t *mac, uint16_t seq, bool broadcast);
+
+std::string_view rateName(uint8_t rate);
+} // namespace espnow::sniffer
@@ -0,0 +1,275 @@
+#include "espnowtimesync.h"
+
+// system includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+
+// esp-idf includes
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+// 3rdparty lib includes
+#include <ring-buffer.h>
+
+// local includes
+#include "config.h"
+#include "espnow.h"
+
+namespace espnow::timesync {
+namespace {
+constexpr const char * const TAG = "ESP_NOW_TIME";
+
+// samples with a longer round trip were queued or retried somewhere, their offset is worthless
+constexpr const int64_t MaxDelayUs = 50000;
+
+// the sample with the shortest round trip of the last few is used, like the ntp clock filter
+constexpr const size_t FilterLength = 8;
+
+// filtered offsets the drift is fitted over
+constexpr const size_t FitLength = 16;
+
+// missed responses before the clock counts as unsynced
+constexpr const uint32_t MaxMissedIntervals = 10;
+
+struct Sample
+{
+    int64_t localUs; // arrival of the response
+    int64_t offsetUs;
+    int64_t delayUs;
+};
+
+QueueHandle_t samples{};
+std::mutex mutex;
+Status currentStatus{ .reference = true };
+uint32_t session{};
+uint32_t seq{};
+int64_t lastRequestUs{};
+int64_t lastResponseUs{};
+
+// only touched from update()
+ring_buffer<Sample, FilterLength> filter;
+ring_buffer<Sample, FitLength> fit;
+
+void reset(const wifi_stack::mac_t &reference);
+void addSample(const Sample &sample);
+} // namespace
+
+Status status()
+{
+    std::lock_guard lock{mutex};
+    return currentStatus;
+}
+
+std::optional<int64_t> networkTime(int64_t localUs)
+{
+    std::lock_guard lock{mutex};
+    if (currentStatus.reference)
+        return localUs;
+    if (!currentStatus.synced)
+        return std::nullopt;
+    return localUs + currentStatus.offsetUs + (localUs - currentStatus.lastSyncUs) * currentStatus.driftPpb / 1000000000;
+}
+
+void update()
+{
+    if (!samples)
+    {
+        samples = xQueueCreate(4, sizeof(Sample));
+        if (!samples)
+        {
+            ESP_LOGE(TAG, "xQueueCreate() failed");
+            return;
+        }
+    }
+
+    const auto &reference = configs.espnowTimeRef.value;
+    {
+        std::lock_guard lock{mutex};
+        if (!reference)
+        {
+            currentStatus.reference = true;
+            currentStatus.synced = true;
+            return;
+        }
+    }
+
+    if (const auto status = timesync::status(); status.reference || wifi_stack::mac_t{status.referenceMac.data()} != *reference)
+        reset(*reference);
+
+    for (Sample sample; xQueueReceive(samples, &sample, 0) == pdTRUE;)
+    {
+        lastResponseUs = sample.localUs;
+        addSample(sample);
+    }
+
+    const auto now = esp_timer_get_time();
+
+    {
+        std::lock_guard lock{mutex};
+        if (currentStatus.synced && now - lastResponseUs > int64_t(MaxMissedIntervals) * configs.espnowSyncIntv.value * 1000)
+        {
+            ESP_LOGW(TAG, "no response from the time reference for %u intervals", MaxMissedIntervals);
+            currentStatus.synced = false;
+        }
+    }
+
+    if (now - lastRequestUs < int64_t(configs.espnowSyncIntv.value) * 1000)
+        return;
+    lastRequestUs = now;
+
+    const TimeSyncPayload request{ .session = session, .seq = ++seq, .requestTxUs = esp_timer_get_time() };
+    const uint8_t *destination = findPeer(reference->data()) ? reference->data() : broadcastAddress;
+    if (const auto error = queueEspNow(FrameType::TimeSyncRequest, (const uint8_t *)&request, sizeof(request), destination); error != ESP_OK)
+    {
+        ESP_LOGW(TAG, "could not queue request: %s", esp_err_to_name(error));
+        return;
+    }
+
+    std::lock_guard lock{mutex};
+    currentStatus.requests++;
+}
+
+void handleFrame(const RecvRecord &record, std::string_view payload)
+{
+    // the origin of a relayed frame is not verified, a spoofed reference would move the clock of the network
+    if (record.relayed)
+        return;
+
+    TimeSyncPayload sync;
+    if (payload.size() != sizeof(sync))
+        return;
+    std::memcpy(&sync, payload.data(), sizeof(sync));
+
+    switch (record.header.type)
+    {
+    case FrameType::TimeSyncRequest:
+    {
+        // a node that is not synced itself has nothing to offer
+        const auto rxUs = networkTime(record.timestamp);
+        if (!rxUs)
+            return;
+
+        sync.requestRxUs = *rxUs;
+        sync.responseTxUs = networkTime(esp_timer_get_time()).value_or(*rxUs);
+
+        const uint8_t *destination = findPeer(record.mac.data()) ? record.mac.data() : broadcastAddress;
+        if (const auto error = queueEspNow(FrameType::TimeSyncResponse, (const uint8_t *)&sync, sizeof(sync), destination); error != ESP_OK)
+            ESP_LOGW(TAG, "could not queue response: %s", esp_err_to_name(error));
+        break;
+    }
+    case FrameType::TimeSyncResponse:
+    {
+        {
+            std::lock_guard lock{mutex};
+            if (currentStatus.reference || sync.session != session ||
+                !std::equal(std::begin(record.mac), std::end(record.mac), std::begin(currentStatus.referenceMac)))
+                return;
+            currentStatus.responses++;
+        }
+
+        const Sample sample{
+            .localUs = record.timestamp,
+            .offsetUs = ((sync.requestRxUs - sync.requestTxUs) + (sync.responseTxUs - record.timestamp)) / 2,
+            .delayUs = (record.timestamp - sync.requestTxUs) - (sync.responseTxUs - sync.requestRxUs)
+        };
+
+        if (sample.delayUs < 0 || sample.delayUs > MaxDelayUs)
+        {
+            std::lock_guard lock{mutex};
+            currentStatus.rejected++;
+            return;
+        }
+
+        xQueueSend(samples, &sample, 0);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+namespace {
+void reset(const wifi_stack::mac_t &reference)
+{
+    ESP_LOGI(TAG, "syncing to %s", wifi_stack::toString(reference).c_str());
+
+    filter = {};
+    fit = {};
+    xQueueReset(samples);
+
+    std::lock_guard lock{mutex};
+    do
+        esp_fill_random(&session, sizeof(session));
+    while (!session);
+    currentStatus = Status{};
+    std::copy(std::begin(reference), std::end(reference), std::begin(currentStatus.referenceMac));
+}
+
+void addSample(const Sample &sample)
+{
+    filter.push_back(sample); // overwrites the oldest
+
+    const auto &best = *std::min_element(filter.begin(), filter.end(), [](const Sample &a, const Sample &b){
+        return a.delayUs < b.delayUs;
+    });
+
+    // the same sample stays the best for a while, it is only fitted once
+    if (!fit.empty() && fit.back().localUs == best.localUs)
+        return;
+    fit.push_back(best);
+
+    // least squares line through the filtered offsets, the slope is the drift of the local clock
+    double slope{};
+    double intercept = best.offsetUs;
+    double residual{};
+    if (fit.size() >= 2)
+    {
+        const auto x0 = fit.begin()->localUs;
+        double meanX{}, meanY{};
+        for (const auto &point : fit)
+        {
+            meanX += point.localUs - x0;
+            meanY += point.offsetUs;
+        }
+        meanX /= fit.size();
+        meanY /= fit.size();
+
+        double covariance{}, variance{};
+        for (const auto &point : fit)
+        {
+            covariance += (point.localUs - x0 - meanX) * (point.offsetUs - meanY);
+            variance += (point.localUs - x0 - meanX) * (point.localUs - x0 - meanX);
+        }
+        if (variance > 0)
+            slope = covariance / variance;
+
+        for (const auto &point : fit)
+        {
+            const auto deviation = point.offsetUs - (meanY + slope * (point.localUs - x0 - meanX));
+            residual += deviation * deviation;
+        }
+        residual = std::sqrt(residual / fit.size());
+        intercept = meanY + slope * (best.localUs - x0 - meanX);
+    }
+
+    std::lock_guard lock{mutex};
+    const bool wasSynced = currentStatus.synced;
+    currentStatus.synced = fit.size() >= 2;
+    currentStatus.offsetUs = std::llround(intercept);
+    currentStatus.driftPpb = std::lround(slope * 1e9);
+    currentStatus.delayUs = best.delayUs;
+    currentStatus.errorUs = best.delayUs / 2;
+    currentStatus.residualUs = std::lround(residual);
+    currentStatus.lastSyncUs = best.localUs;
+
+    if (currentStatus.synced && !wasSynced)
+        ESP_LOGI(TAG, "synced, offset=%lldus drift=%dppb error=%uus",
+                 currentStatus.offsetUs, currentStatus.driftPpb, currentStatus.errorUs);
+}
+} // namespace
+} // namespace espnow::timesync
@@ -0,0 +1,44 @@
+#pragma once
+
+// system includes
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// esp-idf includes
+#include <esp_now.h>
+
+namespace espnow {
+struct RecvRecord;
+
+// ptp style exchange with the node in configs.espnowTimeRef, nodes without one are a reference themselves
+namespace timesync {
+struct Status
+{
+    bool reference; // no espnowTimeRef configured, the local clock is the network time
+    bool synced;
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> referenceMac;
+    int64_t offsetUs; // network time - local time, at the last sync
+    int32_t driftPpb;
+    uint32_t delayUs; // round trip of the sample the offset is based on
+    uint32_t errorUs; // bound of the offset error from the path asymmetry, half the round trip
+    uint32_t residualUs; // rms deviation of the filtered offsets from the drift fit
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t rejected;
+    int64_t lastSyncUs;
+};
+
+Status status();
+
+// esp_timer time converted to the clock of the reference, empty while not synced
+std::optional<int64_t> networkTime(int64_t localUs);
+
+// sends the periodic requests and updates the clock model, called from the scheduler
+void update();
+
+// called from the esp-now receive callback for the time sync frame types
+void handleFrame(const RecvRecord &record, std::string_view payload);
+} // namespace timesync
+} // namespace espnow
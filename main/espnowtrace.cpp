@@ -0,0 +1,176 @@
+#include "espnowtrace.h"
+
+// system includes
+#include <algorithm>
+
+// esp-idf includes
+#include <esp_timer.h>
+
+// local includes
+#include "config.h"
+
+namespace espnow::trace {
+namespace {
+// written from the tx task, both callbacks and the output task, readers may see a slot that is being reused
+struct Slot
+{
+    std::atomic<Id> id{};
+    std::atomic<bool> finished{};
+    FrameType type{};
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> mac{};
+    std::atomic<uint16_t> seq{};
+    std::array<std::atomic<uint32_t>, PointCount> timestampsUs{}; // 0 for points not reached
+};
+
+std::array<Slot, 32> slots;
+std::atomic<Id> nextId{1};
+
+// sent and received frames are sampled separately, a receiver should not miss traces because it also sends
+std::atomic<uint32_t> txFrames{};
+std::atomic<uint32_t> rxFrames{};
+
+std::array<std::atomic<uint32_t>, StageCount> samples{};
+std::array<std::atomic<uint64_t>, StageCount> sumUs{}; // summed durations overflow 32 bit after ~72 minutes
+std::array<std::atomic<uint32_t>, StageCount> maxUs{};
+
+bool configsSubscribed{};
+std::atomic<uint32_t> every{};
+
+Slot *slotOf(Id id)
+{
+    if (id == NoTrace)
+        return nullptr;
+    auto &slot = slots[id % slots.size()];
+    return slot.id == id ? &slot : nullptr;
+}
+} // namespace
+
+std::string_view toString(Point point)
+{
+    switch (point)
+    {
+    case Point::Submit:        return "submit";
+    case Point::Dequeue:       return "dequeue";
+    case Point::DriverCall:    return "driver_call";
+    case Point::DriverReturn:  return "driver_return";
+    case Point::SendCallback:  return "send_callback";
+    case Point::Receive:       return "receive";
+    case Point::Handled:       return "handled";
+    case Point::OutputDequeue: return "output_dequeue";
+    case Point::OutputDone:    return "output_done";
+    }
+    return "unknown";
+}
+
+std::array<StageStats, StageCount> breakdown()
+{
+    std::array<StageStats, StageCount> result;
+    for (size_t i = 0; i < StageCount; i++)
+    {
+        const uint32_t count = samples[i];
+        result[i] = StageStats{ .samples = count, .avgUs = count ? uint32_t(sumUs[i] / count) : 0, .maxUs = maxUs[i] };
+    }
+    return result;
+}
+
+void forEachTrace(const std::function<void(const Trace &)> &callback)
+{
+    const Id newest = nextId;
+    for (size_t i = 1; i <= slots.size(); i++)
+    {
+        const auto &slot = slots[(newest + i) % slots.size()];
+        if (!slot.finished)
+            continue;
+
+        Trace trace{ .id = slot.id, .type = slot.type, .mac = slot.mac, .seq = slot.seq, .timestampsUs = {} };
+        for (size_t j = 0; j < PointCount; j++)
+            if (const uint32_t timestamp = slot.timestampsUs[j])
+                trace.timestampsUs[j] = timestamp;
+        callback(trace);
+    }
+}
+
+Id begin(Point point, FrameType type, const uint8_t *mac)
+{
+    const uint32_t n = every;
+    if (!n || (point == Point::Receive ? rxFrames : txFrames)++ % n)
+        return NoTrace;
+
+    Id id = nextId++;
+    if (id == NoTrace)
+        id = nextId++;
+
+    auto &slot = slots[id % slots.size()];
+    slot.id = NoTrace;
+    slot.finished = false;
+    slot.type = type;
+    std::copy(mac, mac + ESP_NOW_ETH_ALEN, std::begin(slot.mac));
+    slot.seq = 0;
+    for (auto &timestamp : slot.timestampsUs)
+        timestamp = 0;
+    slot.id = id;
+
+    mark(id, point);
+    return id;
+}
+
+void mark(Id id, Point point)
+{
+    if (auto slot = slotOf(id))
+        slot->timestampsUs[size_t(point)] = std::max(uint32_t(esp_timer_get_time()), uint32_t{1});
+}
+
+void setSeq(Id id, uint16_t seq)
+{
+    if (auto slot = slotOf(id))
+        slot->seq = seq;
+}
+
+void finish(Id id)
+{
+    auto slot = slotOf(id);
+    if (!slot)
+        return;
+
+    for (size_t i = 0; i < StageCount; i++)
+    {
+        const uint32_t from = slot->timestampsUs[size_t(stages[i].from)];
+        const uint32_t to = slot->timestampsUs[size_t(stages[i].to)];
+        if (!from || !to)
+            continue;
+
+        // the send callback may run on the other core before esp_now_send() returned
+        const uint32_t duration = int32_t(to - from) > 0 ? to - from : 0;
+        samples[i]++;
+        sumUs[i] += duration;
+
+        // finished from the send callback and the output task at the same time
+        for (uint32_t max = maxUs[i]; duration > max && !maxUs[i].compare_exchange_weak(max, duration);)
+            ;
+    }
+
+    slot->finished = true;
+}
+
+void reset()
+{
+    for (size_t i = 0; i < StageCount; i++)
+    {
+        samples[i] = 0;
+        sumUs[i] = 0;
+        maxUs[i] = 0;
+    }
+    for (auto &slot : slots)
+        slot.finished = false;
+}
+
+void update()
+{
+    if (configsSubscribed)
+        return;
+
+    onConfigChange(configs.espnowTraceEvery, [](const uint32_t &value){ every = value; });
+    every = configs.espnowTraceEvery.value;
+    configsSubscribed = true;
+}
+} // namespace espnow::trace
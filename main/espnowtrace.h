@@ -0,0 +1,97 @@
+#pragma once
+
+// system includes
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string_view>
+
+// esp-idf includes
+#include <esp_now.h>
+
+// local includes
+#include "espnowprotocol.h"
+
+// timestamps of every configs.espnowTraceEvery-th frame at each stage of the send and receive path.
+// the points run on different cores, so they are esp_timer microseconds and not cycle counts
+namespace espnow::trace {
+enum class Point : uint8_t {
+    Submit, // queueEspNow() or a send straight to the driver
+    Dequeue, // taken from the tx queue by the espnowTx task, not reached by direct sends
+    DriverCall, // about to call esp_now_send(), after the pacing wait
+    DriverReturn, // esp_now_send() returned ok
+    SendCallback, // the driver reported the ack or the failure
+    Receive, // receive callback, on the receiving board
+    Handled, // protocol handlers of the receive callback done
+    OutputDequeue, // taken from the output queue by the espnowOutput task
+    OutputDone // written to the uart
+};
+
+constexpr const size_t PointCount = 9;
+
+std::string_view toString(Point point);
+
+// the time between two points of the same trace
+struct Stage
+{
+    Point from;
+    Point to;
+    const char *name;
+};
+
+constexpr const Stage stages[] {
+    { Point::Submit,        Point::Dequeue,       "tx queue"        },
+    { Point::Dequeue,       Point::DriverCall,    "pacing"          },
+    { Point::DriverCall,    Point::DriverReturn,  "esp_now_send"    },
+    { Point::DriverReturn,  Point::SendCallback,  "air and ack"     },
+    { Point::Receive,       Point::Handled,       "rx handlers"     },
+    { Point::Handled,       Point::OutputDequeue, "output queue"    },
+    { Point::OutputDequeue, Point::OutputDone,    "uart write"      },
+};
+
+constexpr const size_t StageCount = std::size(stages);
+
+// 0 for frames that are not traced, the ids of the others wrap around
+using Id = uint16_t;
+constexpr const Id NoTrace = 0;
+
+struct StageStats
+{
+    uint32_t samples;
+    uint32_t avgUs;
+    uint32_t maxUs;
+};
+
+// over all finished traces since boot or reset()
+std::array<StageStats, StageCount> breakdown();
+
+struct Trace
+{
+    Id id;
+    FrameType type;
+    std::array<uint8_t, ESP_NOW_ETH_ALEN> mac; // destination or sender
+    uint16_t seq; // matches the trace of the same frame on the other board
+    std::array<std::optional<uint32_t>, PointCount> timestampsUs; // indexed by Point, empty for points not reached
+};
+
+// finished traces of the buffer, oldest first
+void forEachTrace(const std::function<void(const Trace &)> &callback);
+
+// starts a trace at its first point if the frame is sampled
+Id begin(Point point, FrameType type, const uint8_t *mac);
+
+// the calls below ignore NoTrace and traces whose slot was taken over by a newer frame meanwhile
+void mark(Id id, Point point);
+void setSeq(Id id, uint16_t seq);
+
+// adds the stages of the trace to the breakdown, frames dropped on the way are never finished
+void finish(Id id);
+
+void reset();
+
+// applies config changes, called from the scheduler
+void update();
+} // namespace espnow::trace
@@ -27,6 +27,7 @@
 #include "config.h"
 #include "debugconsole.h"
 #include "taskmanager.h"
+#include "telemetry.h"
 #include "ota.h"
 #include "wifi.h"
 
@@ -90,6 +91,11 @@ extern "C" void app_main()
     for (const auto &task : schedulerTasks)
         task.setup();
 
+    // input is handled by the console task as soon as the uart driver reports it, nothing runs in the scheduler
+    init_debugconsole();
+
+    telemetry::armHotPathCheck();
+
     while (true)
     {
         bool pushStats = espchrono::ago(lastLoopCount) >= 1s;
@@ -102,18 +108,26 @@ extern "C" void app_main()
 
         loopCountTemp++;
 
+        const bool attributeHeap = telemetry::heapTraceRunning();
+        size_t taskIndex{};
         for (auto &task : schedulerTasks)
         {
+            const auto freeBefore = attributeHeap ? heap_caps_get_free_size(MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT) : 0;
+            const auto allocationsBefore = telemetry::allocationsOnThisTask();
+
             task.loop();
 
+            telemetry::accountSchedulerAllocations(taskIndex, telemetry::allocationsOnThisTask() - allocationsBefore);
+            if (attributeHeap)
+                telemetry::accountSchedulerTask(taskIndex, int32_t(freeBefore - heap_caps_get_free_size(MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT)));
+            taskIndex++;
+
 #if defined(CONFIG_ESP_TASK_WDT_PANIC) || defined(CONFIG_ESP_TASK_WDT)
+            // the ota governor in ota_client_update() shares the cpu with the download now,
+            // no more delays between the scheduler tasks
             if (wasPreviouslyUpdating)
-            {
                 if (const auto result = esp_task_wdt_reset(); result != ESP_OK)
                     ESP_LOGE(TAG, "esp_task_wdt_reset() failed with %s", esp_err_to_name(result));
-                //vPortYield();
-                vTaskDelay(1);
-            }
 #endif
         }
 
@@ -1,21 +1,31 @@
 #include "ota.h"
 
 // system includes
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <mutex>
 #include <string>
 
 // esp-idf includes
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 // 3rdparty lib includes
 #include <fmt/core.h>
 #include <delayedconstruction.h>
+#include <espchrono.h>
 #include <espasyncota.h>
 #include <espwifistack.h>
 #include <recursivelockhelper.h>
 
 // local includes
 #include "config.h"
+#include "espnow.h"
+#include "espnowoutput.h"
+#include "otadelta.h"
 
 using namespace std::chrono_literals;
 
@@ -23,36 +33,253 @@ namespace {
 constexpr const char * const TAG = "OTA_CLIENT";
 
 cpputils::DelayedConstruction<EspAsyncOta> _otaClient;
+
+constexpr const char * const OtaTaskName = "asyncOtaTask";
+
+std::atomic<OtaPartitionOwner> partitionOwner{OtaPartitionOwner::None};
+
+// the ota client reports Updating only once trigger() returned, the claim of a cloud update is taken and
+// released under this mutex so ota_client_update() does not release it in between
+std::mutex cloudClaimMutex;
+
+// a paused download still has to make progress now and then, or the server times out
+constexpr const auto MaxPause = 1s;
+
+struct EspNowCounters
+{
+    uint32_t frames;
+    uint32_t lost;
+    uint32_t txFail;
+};
+
+struct
+{
+    espchrono::millis_clock::time_point start;
+    espchrono::millis_clock::time_point lastUpdate;
+    espchrono::millis_clock::time_point pausedSince;
+    espchrono::millis_clock::time_point windowStart;
+    int startProgress;
+    int windowProgress;
+    bool paused;
+    UBaseType_t priority; // of the download task before it was paused
+    EspNowCounters espnowBefore;
+} governor;
+
+EspNowCounters espnowCounters();
+bool espnowBacklogged();
+void governOta();
+void pauseOta(TaskHandle_t handle, bool pause);
 } // namespace
 
 EspAsyncOta &otaClient{_otaClient.getUnsafe()};
+OtaGovernorStats otaGovernorStats;
 
 void ota_client_init()
 {
     ESP_LOGI(TAG, "called");
 
-    _otaClient.construct("asyncOtaTask", 8192u);
+    _otaClient.construct(OtaTaskName, 8192u, configs.appCore.value ? espcpputils::CoreAffinity::Core1 : espcpputils::CoreAffinity::Core0);
 }
 
 void ota_client_update()
 {
     _otaClient->update();
+
+    if (partitionOwner == OtaPartitionOwner::Cloud)
+    {
+        std::lock_guard lock{cloudClaimMutex};
+        if (otaClient.status() != OtaCloudUpdateStatus::Updating)
+            releaseOtaPartition(OtaPartitionOwner::Cloud);
+    }
+
+    governOta();
 }
 
 tl::expected<void, std::string> otaClientTrigger(std::string_view url)
 {
+    if (otadelta::isContainerUrl(url))
+        return otadelta::trigger(url);
+
+    std::lock_guard lock{cloudClaimMutex};
+
+    if (auto result = claimOtaPartition(OtaPartitionOwner::Cloud); !result)
+        return result;
+
     if (auto result = _otaClient->trigger(url, {}, {}, {}); !result)
+    {
+        releaseOtaPartition(OtaPartitionOwner::Cloud);
         return tl::make_unexpected(std::move(result).error());
+    }
 
     wifi_stack::delete_scan_result();
 
     return {};
 }
 
+std::string_view toString(OtaPartitionOwner owner)
+{
+    switch (owner)
+    {
+    case OtaPartitionOwner::None:  return "none";
+    case OtaPartitionOwner::Cloud: return "ota client";
+    case OtaPartitionOwner::Delta: return "delta update";
+    case OtaPartitionOwner::P2p:   return "esp-now ota";
+    }
+    return "unknown";
+}
+
+tl::expected<void, std::string> claimOtaPartition(OtaPartitionOwner owner)
+{
+    // also fails for the owner itself, a second trigger of the same updater would release the claim of the first one
+    auto expected = OtaPartitionOwner::None;
+    if (!partitionOwner.compare_exchange_strong(expected, owner))
+        return tl::make_unexpected(fmt::format("the ota partition is busy with the {}", toString(expected)));
+    return {};
+}
+
+void releaseOtaPartition(OtaPartitionOwner owner)
+{
+    auto expected = owner;
+    partitionOwner.compare_exchange_strong(expected, OtaPartitionOwner::None);
+}
+
+OtaPartitionOwner otaPartitionOwner()
+{
+    return partitionOwner;
+}
+
+void OtaDownloadThrottle::account(size_t bytes)
+{
+    const auto now = esp_timer_get_time();
+    const auto elapsedUs = m_lastUs ? now - m_lastUs : 0;
+    m_lastUs = now;
+
+    // token bucket, at most half a second worth of bytes can be saved up for a burst
+    if (const uint32_t maxRate = configs.otaMaxRate.value * 1024)
+    {
+        m_credit = std::min<int64_t>(m_credit + int64_t(maxRate) * elapsedUs / 1000000 - bytes, maxRate / 2);
+        if (m_credit < 0)
+        {
+            // the sleep is not refilled here, the next call sees it as elapsed time
+            const auto sleepMs = std::min<int64_t>(-m_credit * 1000 / maxRate + 1, std::chrono::milliseconds{MaxPause}.count());
+            vTaskDelay(pdMS_TO_TICKS(sleepMs));
+        }
+    }
+    else
+        m_credit = 0;
+
+    // bounded by MaxPause like the governor
+    for (auto waited = 0ms; configs.otaYieldEspNow.value && espnowBacklogged() && waited < MaxPause; waited += 10ms)
+        vTaskDelay(pdMS_TO_TICKS(10));
+}
+
 tl::expected<void, std::string> otaClientAbort()
 {
+    if (otadelta::progress().status == otadelta::Status::Updating)
+        return otadelta::abort();
+
     if (auto result = _otaClient->abort(); !result)
         return tl::make_unexpected(std::move(result).error());
 
     return {};
 }
+
+namespace {
+EspNowCounters espnowCounters()
+{
+    EspNowCounters counters{ .txFail = espnow::txStats.fail };
+    for (size_t i = 0; i < espnow::peerRxStatsCount; i++)
+    {
+        counters.frames += espnow::peerRxStats[i].frames;
+        counters.lost += espnow::peerRxStats[i].lost;
+    }
+    return counters;
+}
+
+// the tx queue backs up when the air is busy, the output queue when the cpu is
+bool espnowBacklogged()
+{
+    return espnow::txQueueLength() >= 4 || espnow::output::queueLength() >= 8;
+}
+
+void governOta()
+{
+    const auto handle = xTaskGetHandle(OtaTaskName);
+
+    if (otaClient.status() != OtaCloudUpdateStatus::Updating || !handle)
+    {
+        if (governor.paused && handle)
+            pauseOta(handle, false);
+
+        if (otaGovernorStats.active)
+        {
+            otaGovernorStats.active = false;
+            ESP_LOGI(TAG, "update finished: avg %u B/s, paused %u times for %ums, esp-now frames=%u lost=%u tx fail=%u",
+                     otaGovernorStats.avgBytesPerSecond, otaGovernorStats.pauses, otaGovernorStats.pausedMs,
+                     otaGovernorStats.espnowFrames, otaGovernorStats.espnowLost, otaGovernorStats.espnowTxFail);
+        }
+        return;
+    }
+
+    const auto now = espchrono::millis_clock::now();
+    const int progress = otaClient.progress();
+
+    if (!otaGovernorStats.active)
+    {
+        governor = {};
+        governor.start = governor.lastUpdate = governor.windowStart = now;
+        governor.startProgress = governor.windowProgress = progress;
+        governor.espnowBefore = espnowCounters();
+        otaGovernorStats = { .active = true };
+        return;
+    }
+
+    const auto elapsed = now - governor.lastUpdate;
+    const auto elapsedMs = std::chrono::floor<std::chrono::milliseconds>(elapsed).count();
+    governor.lastUpdate = now;
+
+    if (governor.paused)
+        otaGovernorStats.pausedMs += elapsedMs;
+
+    if (const auto windowMs = std::chrono::floor<std::chrono::milliseconds>(now - governor.windowStart).count(); windowMs >= 1000)
+    {
+        otaGovernorStats.bytesPerSecond = int64_t(progress - governor.windowProgress) * 1000 / windowMs;
+        governor.windowStart = now;
+        governor.windowProgress = progress;
+    }
+
+    if (const auto totalMs = std::chrono::floor<std::chrono::milliseconds>(now - governor.start).count())
+        otaGovernorStats.avgBytesPerSecond = int64_t(progress - governor.startProgress) * 1000 / totalMs;
+
+    const auto counters = espnowCounters();
+    otaGovernorStats.espnowFrames = counters.frames - governor.espnowBefore.frames;
+    otaGovernorStats.espnowLost = counters.lost - governor.espnowBefore.lost;
+    otaGovernorStats.espnowTxFail = counters.txFail - governor.espnowBefore.txFail;
+
+    bool pause = configs.otaYieldEspNow.value && espnowBacklogged();
+
+    if (pause && governor.paused && now - governor.pausedSince >= MaxPause)
+        pause = false;
+
+    if (pause != governor.paused)
+        pauseOta(handle, pause);
+}
+
+void pauseOta(TaskHandle_t handle, bool pause)
+{
+    // the task belongs to the ota lib and may hold flash, tls or lwip locks at any point, so it is never
+    // suspended. at idle priority it only reads the socket while nothing else wants the core, tcp flow
+    // control then slows down the server. mutexes it holds still get priority inheritance
+    if (pause)
+    {
+        governor.priority = uxTaskPriorityGet(handle);
+        vTaskPrioritySet(handle, tskIDLE_PRIORITY);
+        governor.pausedSince = espchrono::millis_clock::now();
+        otaGovernorStats.pauses++;
+    }
+    else
+        vTaskPrioritySet(handle, governor.priority);
+
+    governor.paused = pause;
+}
+} // namespace
@@ -1,6 +1,8 @@
 #pragma once
 
 // system includes
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <map>
@@ -16,5 +18,51 @@ extern EspAsyncOta &otaClient;
 void ota_client_init();
 void ota_client_update();
 
+// the cloud client, the delta updater and the esp-now receiver all write the next ota partition, only the
+// owner of the claim may erase or write it
+enum class OtaPartitionOwner : uint8_t {
+    None,
+    Cloud,
+    Delta,
+    P2p
+};
+
+std::string_view toString(OtaPartitionOwner owner);
+
+// fails while any updater holds the partition, the one calling included
+tl::expected<void, std::string> claimOtaPartition(OtaPartitionOwner owner);
+void releaseOtaPartition(OtaPartitionOwner owner);
+OtaPartitionOwner otaPartitionOwner();
+
+// the ota client lib gives no hook inside its download loop, the governor can only drop its task to idle
+// priority while esp-now traffic is queued. configs.otaMaxRate needs a blocking point in the download and
+// is only enforced for the downloads of this firmware, see OtaDownloadThrottle
+struct OtaGovernorStats
+{
+    bool active;
+    uint32_t bytesPerSecond; // over the last second
+    uint32_t avgBytesPerSecond;
+    uint32_t pauses;
+    uint32_t pausedMs;
+    // esp-now counters since the update started
+    uint32_t espnowFrames;
+    uint32_t espnowLost;
+    uint32_t espnowTxFail;
+};
+
+extern OtaGovernorStats otaGovernorStats;
+
+// called by the downloading task after every read, sleeps while the download is ahead of configs.otaMaxRate
+// and, with configs.otaYieldEspNow, while esp-now frames are queued. tcp flow control then slows down the server
+class OtaDownloadThrottle
+{
+public:
+    void account(size_t bytes);
+
+private:
+    int64_t m_lastUs{};
+    int64_t m_credit{}; // bytes that may still be read, negative while ahead of otaMaxRate
+};
+
 tl::expected<void, std::string> otaClientTrigger(std::string_view url);
 tl::expected<void, std::string> otaClientAbort();
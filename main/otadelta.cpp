@@ -0,0 +1,435 @@
+#include "otadelta.h"
+
+// system includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+// esp-idf includes
+#include <esp32/rom/miniz.h>
+#include <esp_crt_bundle.h>
+#include <esp_heap_caps.h>
+#include <esp_http_client.h>
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// 3rdparty lib includes
+#include <fmt/core.h>
+
+// local includes
+#include "config.h"
+#include "ota.h"
+
+namespace otadelta {
+namespace {
+constexpr const char * const TAG = "OTA_DELTA";
+
+// everything bigger than a few hundred bytes lives here, only allocated while an update runs
+struct Buffers
+{
+    tinfl_decompressor inflator;
+    std::array<uint8_t, TINFL_LZ_DICT_SIZE> dictionary; // also the output window of the inflator
+    std::array<uint8_t, 1024> input;
+    std::array<uint8_t, 1024> copy;
+};
+
+struct HeapDeleter
+{
+    void operator()(void *ptr) const { heap_caps_free(ptr); }
+};
+
+class Patcher
+{
+public:
+    Patcher(const ContainerHeader &header, const esp_partition_t *base, esp_ota_handle_t handle, std::array<uint8_t, 1024> &scratch) :
+        m_header{header}, m_base{base}, m_handle{handle}, m_scratch{scratch}
+    {}
+
+    tl::expected<void, std::string> feed(const uint8_t *data, size_t size);
+    bool complete() const { return m_written == m_header.targetSize && !m_addRemaining && !m_opHeaderSize; }
+    uint32_t written() const { return m_written; }
+
+private:
+    tl::expected<void, std::string> write(const uint8_t *data, size_t size);
+    tl::expected<void, std::string> copy(uint32_t offset, uint32_t length);
+
+    const ContainerHeader &m_header;
+    const esp_partition_t * const m_base;
+    const esp_ota_handle_t m_handle;
+    std::array<uint8_t, 1024> &m_scratch;
+
+    uint32_t m_written{};
+
+    // ops can be split over several inflated blocks
+    std::array<uint8_t, 1 + 2 * sizeof(uint32_t)> m_opHeader;
+    size_t m_opHeaderSize{};
+    uint32_t m_addRemaining{};
+};
+
+std::mutex progressMutex;
+Progress currentProgress{};
+std::string pendingUrl;
+std::atomic<bool> abortRequested{};
+
+void updateTask(void *);
+tl::expected<void, std::string> runUpdate(const std::string &url);
+} // namespace
+
+std::string_view toString(Status status)
+{
+    switch (status)
+    {
+    case Status::Idle:      return "idle";
+    case Status::Updating:  return "updating";
+    case Status::Succeeded: return "succeeded, reboot to activate";
+    case Status::Failed:    return "failed";
+    }
+    return "unknown";
+}
+
+bool isContainerUrl(std::string_view url)
+{
+    constexpr std::string_view extension{".eota"};
+    if (const auto query = url.find('?'); query != std::string_view::npos)
+        url = url.substr(0, query);
+    return url.size() >= extension.size() && url.substr(url.size() - extension.size()) == extension;
+}
+
+tl::expected<void, std::string> trigger(std::string_view url)
+{
+    if (auto result = claimOtaPartition(OtaPartitionOwner::Delta); !result)
+        return result;
+
+    {
+        std::lock_guard lock{progressMutex};
+        if (currentProgress.status == Status::Updating)
+        {
+            releaseOtaPartition(OtaPartitionOwner::Delta);
+            return tl::make_unexpected("an update is already running");
+        }
+        currentProgress = Progress{ .status = Status::Updating };
+        pendingUrl = url;
+    }
+
+    abortRequested = false;
+
+    // a tls handshake with the certificate bundle needs as much stack as asyncOtaTask has
+    if (const auto result = xTaskCreatePinnedToCore(updateTask, "otaDelta", 8192, nullptr, 5, nullptr, configs.appCore.value); result != pdPASS)
+    {
+        std::lock_guard lock{progressMutex};
+        currentProgress.status = Status::Failed;
+        currentProgress.message = "xTaskCreatePinnedToCore() failed";
+        releaseOtaPartition(OtaPartitionOwner::Delta);
+        return tl::make_unexpected(fmt::format("xTaskCreatePinnedToCore() failed with {}", result));
+    }
+
+    return {};
+}
+
+tl::expected<void, std::string> abort()
+{
+    {
+        std::lock_guard lock{progressMutex};
+        if (currentProgress.status != Status::Updating)
+            return tl::make_unexpected("no update is running");
+    }
+
+    abortRequested = true;
+    return {};
+}
+
+Progress progress()
+{
+    std::lock_guard lock{progressMutex};
+    return currentProgress;
+}
+
+namespace {
+tl::expected<void, std::string> Patcher::feed(const uint8_t *data, size_t size)
+{
+    if (m_header.kind == ContainerKind::Full)
+        return write(data, size);
+
+    while (size)
+    {
+        if (m_addRemaining)
+        {
+            const auto length = std::min<size_t>(size, m_addRemaining);
+            if (auto result = write(data, length); !result)
+                return result;
+            data += length;
+            size -= length;
+            m_addRemaining -= length;
+            continue;
+        }
+
+        if (!m_opHeaderSize)
+        {
+            if (*data != uint8_t(DeltaOp::Copy) && *data != uint8_t(DeltaOp::Add))
+                return tl::make_unexpected(fmt::format("unknown delta op {} at image offset {}", *data, m_written));
+            m_opHeader[m_opHeaderSize++] = *data++;
+            size--;
+            continue;
+        }
+
+        const auto op = DeltaOp(m_opHeader[0]);
+        const size_t needed = op == DeltaOp::Copy ? 1 + 2 * sizeof(uint32_t) : 1 + sizeof(uint32_t);
+        const auto length = std::min(size, needed - m_opHeaderSize);
+        std::memcpy(&m_opHeader[m_opHeaderSize], data, length);
+        m_opHeaderSize += length;
+        data += length;
+        size -= length;
+
+        if (m_opHeaderSize < needed)
+            continue;
+        m_opHeaderSize = 0;
+
+        uint32_t first, second;
+        std::memcpy(&first, &m_opHeader[1], sizeof(first));
+        if (op == DeltaOp::Add)
+            m_addRemaining = first;
+        else
+        {
+            std::memcpy(&second, &m_opHeader[1 + sizeof(first)], sizeof(second));
+            if (auto result = copy(first, second); !result)
+                return result;
+        }
+    }
+
+    return {};
+}
+
+tl::expected<void, std::string> Patcher::write(const uint8_t *data, size_t size)
+{
+    if (size > m_header.targetSize - m_written)
+        return tl::make_unexpected(fmt::format("image grows beyond its announced size of {} bytes", uint32_t(m_header.targetSize)));
+
+    if (const auto result = esp_ota_write(m_handle, data, size); result != ESP_OK)
+        return tl::make_unexpected(fmt::format("esp_ota_write() failed with {}", esp_err_to_name(result)));
+
+    m_written += size;
+    return {};
+}
+
+tl::expected<void, std::string> Patcher::copy(uint32_t offset, uint32_t length)
+{
+    if (offset > m_base->size || length > m_base->size - offset)
+        return tl::make_unexpected(fmt::format("copy of {} bytes at {} is outside of the running partition", length, offset));
+
+    while (length)
+    {
+        const auto chunk = std::min<uint32_t>(length, m_scratch.size());
+        if (const auto result = esp_partition_read(m_base, offset, m_scratch.data(), chunk); result != ESP_OK)
+            return tl::make_unexpected(fmt::format("esp_partition_read() failed with {}", esp_err_to_name(result)));
+        if (auto result = write(m_scratch.data(), chunk); !result)
+            return result;
+        offset += chunk;
+        length -= chunk;
+    }
+
+    return {};
+}
+
+void updateTask(void *)
+{
+    std::string url;
+    {
+        std::lock_guard lock{progressMutex};
+        url = pendingUrl;
+    }
+
+    const auto start = esp_timer_get_time();
+    const auto result = runUpdate(url);
+
+    {
+        std::lock_guard lock{progressMutex};
+        currentProgress.durationUs = esp_timer_get_time() - start;
+        if (result)
+        {
+            currentProgress.status = Status::Succeeded;
+            ESP_LOGI(TAG, "%s update done, %u bytes over the air for a %u byte image (%.1f%%) in %.1fs",
+                     currentProgress.delta ? "delta" : "compressed", currentProgress.downloaded, currentProgress.targetSize,
+                     currentProgress.targetSize ? 100.f * currentProgress.downloaded / currentProgress.targetSize : 0.f,
+                     currentProgress.durationUs / 1000000.f);
+        }
+        else
+        {
+            currentProgress.status = Status::Failed;
+            currentProgress.message = result.error();
+            ESP_LOGE(TAG, "update failed: %s", result.error().c_str());
+        }
+    }
+
+    releaseOtaPartition(OtaPartitionOwner::Delta);
+    vTaskDelete(nullptr);
+}
+
+tl::expected<void, std::string> runUpdate(const std::string &url)
+{
+    const esp_http_client_config_t config{
+        .url = url.c_str(),
+        .timeout_ms = 10000,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+    };
+
+    const auto client = esp_http_client_init(&config);
+    if (!client)
+        return tl::make_unexpected("esp_http_client_init() failed");
+
+    struct ClientGuard
+    {
+        esp_http_client_handle_t client;
+        ~ClientGuard() { esp_http_client_close(client); esp_http_client_cleanup(client); }
+    } clientGuard{client};
+
+    if (const auto result = esp_http_client_open(client, 0); result != ESP_OK)
+        return tl::make_unexpected(fmt::format("esp_http_client_open() failed with {}", esp_err_to_name(result)));
+
+    const auto contentLength = esp_http_client_fetch_headers(client);
+    if (const auto status = esp_http_client_get_status_code(client); status != 200)
+        return tl::make_unexpected(fmt::format("server answered with http status {}", status));
+
+    if (contentLength > 0)
+    {
+        std::lock_guard lock{progressMutex};
+        currentProgress.contentLength = contentLength;
+    }
+
+    OtaDownloadThrottle throttle;
+    const auto read = [&](uint8_t *buf, size_t size) -> tl::expected<size_t, std::string> {
+        if (abortRequested)
+            return tl::make_unexpected("aborted");
+        const auto length = esp_http_client_read(client, (char *)buf, size);
+        if (length < 0)
+            return tl::make_unexpected("esp_http_client_read() failed");
+        throttle.account(length);
+        std::lock_guard lock{progressMutex};
+        currentProgress.downloaded += length;
+        return length;
+    };
+
+    ContainerHeader header;
+    for (size_t received = 0; received < sizeof(header);)
+    {
+        const auto length = read((uint8_t *)&header + received, sizeof(header) - received);
+        if (!length)
+            return tl::make_unexpected(length.error());
+        if (!*length)
+            return tl::make_unexpected("container ends within its header");
+        received += *length;
+    }
+
+    if (std::memcmp(header.magic, ContainerMagic, sizeof(header.magic)) != 0)
+        return tl::make_unexpected("not an ota container");
+    if (header.version != ContainerVersion)
+        return tl::make_unexpected(fmt::format("unsupported container version {}", header.version));
+    if (header.kind != ContainerKind::Full && header.kind != ContainerKind::Delta)
+        return tl::make_unexpected(fmt::format("unsupported container kind {}", uint8_t(header.kind)));
+
+    const auto running = esp_ota_get_running_partition();
+    const auto next = esp_ota_get_next_update_partition(nullptr);
+    if (!running || !next)
+        return tl::make_unexpected("no ota partition to update");
+    if (header.targetSize > next->size)
+        return tl::make_unexpected(fmt::format("image of {} bytes does not fit into {}", uint32_t(header.targetSize), next->label));
+
+    {
+        std::lock_guard lock{progressMutex};
+        currentProgress.delta = header.kind == ContainerKind::Delta;
+        currentProgress.targetSize = header.targetSize;
+    }
+
+    if (header.kind == ContainerKind::Delta)
+    {
+        uint8_t sha[32];
+        if (const auto result = esp_partition_get_sha256(running, sha); result != ESP_OK)
+            return tl::make_unexpected(fmt::format("esp_partition_get_sha256() failed with {}", esp_err_to_name(result)));
+        if (std::memcmp(sha, header.baseSha256, sizeof(sha)) != 0)
+            return tl::make_unexpected("delta was made against a different image than the running one");
+    }
+
+    std::unique_ptr<Buffers, HeapDeleter> buffers{(Buffers *)heap_caps_malloc(sizeof(Buffers), MALLOC_CAP_8BIT)};
+    if (!buffers)
+        return tl::make_unexpected(fmt::format("could not allocate {} bytes of buffers", sizeof(Buffers)));
+    tinfl_init(&buffers->inflator);
+
+    esp_ota_handle_t handle;
+    if (const auto result = esp_ota_begin(next, OTA_WITH_SEQUENTIAL_WRITES, &handle); result != ESP_OK)
+        return tl::make_unexpected(fmt::format("esp_ota_begin() failed with {}", esp_err_to_name(result)));
+
+    struct OtaGuard
+    {
+        esp_ota_handle_t handle;
+        bool ended{};
+        ~OtaGuard() { if (!ended) esp_ota_abort(handle); }
+    } otaGuard{handle};
+
+    Patcher patcher{header, running, handle, buffers->copy};
+
+    size_t inputOffset{}, inputSize{}, dictionaryOffset{};
+    bool endOfStream{};
+    for (auto status = TINFL_STATUS_NEEDS_MORE_INPUT; status != TINFL_STATUS_DONE;)
+    {
+        if (!inputSize && !endOfStream)
+        {
+            const auto length = read(buffers->input.data(), buffers->input.size());
+            if (!length)
+                return tl::make_unexpected(length.error());
+            inputOffset = 0;
+            inputSize = *length;
+            endOfStream = !*length;
+        }
+
+        size_t in = inputSize;
+        size_t out = buffers->dictionary.size() - dictionaryOffset;
+        status = tinfl_decompress(&buffers->inflator, &buffers->input[inputOffset], &in,
+                                  buffers->dictionary.data(), &buffers->dictionary[dictionaryOffset], &out,
+                                  TINFL_FLAG_PARSE_ZLIB_HEADER | (endOfStream ? 0 : TINFL_FLAG_HAS_MORE_INPUT));
+        inputOffset += in;
+        inputSize -= in;
+
+        if (status < TINFL_STATUS_DONE)
+            return tl::make_unexpected(fmt::format("inflate failed with {}", int(status)));
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT && endOfStream)
+            return tl::make_unexpected("container is truncated");
+
+        if (out)
+        {
+            if (auto result = patcher.feed(&buffers->dictionary[dictionaryOffset], out); !result)
+                return result;
+            dictionaryOffset = (dictionaryOffset + out) & (buffers->dictionary.size() - 1);
+
+            std::lock_guard lock{progressMutex};
+            currentProgress.written = patcher.written();
+        }
+    }
+
+    if (!patcher.complete())
+        return tl::make_unexpected(fmt::format("image ended after {} of {} bytes", patcher.written(), uint32_t(header.targetSize)));
+
+    buffers.reset();
+
+    otaGuard.ended = true;
+    if (const auto result = esp_ota_end(handle); result != ESP_OK)
+        return tl::make_unexpected(fmt::format("esp_ota_end() failed with {}", esp_err_to_name(result)));
+
+    uint8_t sha[32];
+    if (const auto result = esp_partition_get_sha256(next, sha); result != ESP_OK)
+        return tl::make_unexpected(fmt::format("esp_partition_get_sha256() failed with {}", esp_err_to_name(result)));
+    if (std::memcmp(sha, header.targetSha256, sizeof(sha)) != 0)
+        return tl::make_unexpected("sha256 of the written image does not match");
+
+    if (const auto result = esp_ota_set_boot_partition(next); result != ESP_OK)
+        return tl::make_unexpected(fmt::format("esp_ota_set_boot_partition() failed with {}", esp_err_to_name(result)));
+
+    return {};
+}
+} // namespace
+} // namespace otadelta
@@ -0,0 +1,66 @@
+#pragma once
+
+// system includes
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// 3rdparty lib includes
+#include <tl/expected.hpp>
+
+// streaming update from compressed images and binary deltas against the running partition,
+// the container is produced by tools/ota-delta
+namespace otadelta {
+constexpr const char ContainerMagic[4] = {'E', 'O', 'T', 'A'};
+constexpr const uint8_t ContainerVersion = 1;
+
+enum class ContainerKind : uint8_t {
+    Full, // the zlib body is the image
+    Delta // the zlib body is a list of DeltaOps against the running image
+};
+
+struct __attribute__((packed)) ContainerHeader
+{
+    char magic[4];
+    uint8_t version;
+    ContainerKind kind;
+    uint16_t reserved;
+    uint32_t targetSize;
+    uint8_t baseSha256[32]; // of the running image, as esp_partition_get_sha256() reports it, zero for full images
+    uint8_t targetSha256[32];
+};
+
+enum class DeltaOp : uint8_t {
+    Copy, // uint32_t baseOffset, uint32_t length
+    Add   // uint32_t length, followed by length bytes
+};
+
+enum class Status : uint8_t {
+    Idle,
+    Updating,
+    Succeeded, // the new image is set as boot partition, a reboot activates it
+    Failed
+};
+
+std::string_view toString(Status status);
+
+struct Progress
+{
+    Status status;
+    bool delta;
+    uint32_t downloaded; // bytes over the air
+    std::optional<uint32_t> contentLength;
+    uint32_t written; // bytes of the new image
+    uint32_t targetSize;
+    int64_t durationUs;
+    std::string message;
+};
+
+// urls of containers end with .eota, everything else goes to the regular ota client
+bool isContainerUrl(std::string_view url);
+
+tl::expected<void, std::string> trigger(std::string_view url);
+tl::expected<void, std::string> abort();
+Progress progress();
+} // namespace otadelta
@@ -0,0 +1,246 @@
+#include "resultstore.h"
+
+// system includes
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+
+// esp-idf includes
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <esp_spi_flash.h>
+
+// 3rdparty lib includes
+#include <fmt/core.h>
+
+namespace resultstore {
+namespace {
+constexpr const char * const TAG = "RESULTS";
+
+// partitions_*.csv
+constexpr const auto PartitionType = esp_partition_type_t(0x40);
+constexpr const auto PartitionSubtype = esp_partition_subtype_t(0x02);
+
+constexpr const uint32_t RecordsPerSector = SPI_FLASH_SEC_SIZE / sizeof(Record);
+static_assert(SPI_FLASH_SEC_SIZE % sizeof(Record) == 0);
+
+constexpr const uint32_t ErasedMagic = 0xFFFFFFFF;
+// written by clear() into the first slot, carries the next sequence over reboots
+constexpr const uint32_t MarkerMagic = 0x4B52414D; // "MARK"
+
+struct RecordHead
+{
+    uint32_t magic;
+    uint32_t sequence;
+};
+
+std::mutex mutex;
+bool initialized{};
+const esp_partition_t *partition{};
+uint32_t sectorCount{};
+
+// write position, sectors are filled round robin so every one is erased equally often
+uint32_t currentSector{};
+uint32_t nextSlot{};
+uint32_t nextSequence{};
+uint32_t oldestSequence{};
+
+uint32_t crcOf(const Record &record)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)&record, offsetof(Record, crc));
+}
+
+std::optional<RecordHead> readHead(uint32_t sector, uint32_t slot)
+{
+    RecordHead head;
+    if (const auto result = esp_partition_read(partition, (sector * RecordsPerSector + slot) * sizeof(Record), &head, sizeof(head)); result != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_partition_read() failed with %s", esp_err_to_name(result));
+        return std::nullopt;
+    }
+    return head;
+}
+
+bool hasSequence(const RecordHead &head)
+{
+    return head.magic == RecordMagic || head.magic == MarkerMagic;
+}
+
+// finds the sector with the newest record and the first free slot in it
+void initLocked()
+{
+    if (initialized)
+        return;
+    initialized = true;
+
+    partition = esp_partition_find_first(PartitionType, PartitionSubtype, nullptr);
+    if (!partition)
+    {
+        ESP_LOGW(TAG, "no results partition, benchmark results are not stored");
+        return;
+    }
+
+    sectorCount = partition->size / SPI_FLASH_SEC_SIZE;
+
+    std::optional<uint32_t> newest, oldest;
+    for (uint32_t sector = 0; sector < sectorCount; sector++)
+    {
+        const auto head = readHead(sector, 0);
+        if (!head || !hasSequence(*head))
+            continue;
+        if (!newest || head->sequence > *newest)
+        {
+            newest = head->sequence;
+            currentSector = sector;
+        }
+        if (!oldest || head->sequence < *oldest)
+            oldest = head->sequence;
+    }
+
+    nextSlot = 0;
+    nextSequence = 0;
+    if (newest)
+    {
+        for (; nextSlot < RecordsPerSector; nextSlot++)
+        {
+            const auto head = readHead(currentSector, nextSlot);
+            if (!head || head->magic == ErasedMagic)
+                break;
+            if (head->magic == RecordMagic)
+                nextSequence = head->sequence + 1;
+            else if (head->magic == MarkerMagic)
+                nextSequence = head->sequence;
+        }
+    }
+    else if (const auto head = readHead(currentSector, 0); head && head->magic != ErasedMagic)
+    {
+        // leftovers of an interrupted erase or foreign data
+        if (const auto result = esp_partition_erase_range(partition, 0, SPI_FLASH_SEC_SIZE); result != ESP_OK)
+            ESP_LOGE(TAG, "esp_partition_erase_range() failed with %s", esp_err_to_name(result));
+    }
+
+    oldestSequence = oldest.value_or(nextSequence);
+
+    ESP_LOGI(TAG, "%u records in %s, next sequence %u", nextSequence - oldestSequence, partition->label, nextSequence);
+}
+} // namespace
+
+Info info()
+{
+    std::lock_guard lock{mutex};
+    initLocked();
+
+    if (!partition)
+        return {};
+
+    return Info{
+        .available = true,
+        .capacity = sectorCount * RecordsPerSector,
+        .nextSequence = nextSequence,
+        .oldestSequence = oldestSequence
+    };
+}
+
+tl::expected<void, std::string> append(Record record)
+{
+    std::lock_guard lock{mutex};
+    initLocked();
+
+    if (!partition)
+        return tl::make_unexpected("no results partition");
+
+    if (nextSlot == RecordsPerSector)
+    {
+        currentSector = (currentSector + 1) % sectorCount;
+        nextSlot = 0;
+        if (const auto result = esp_partition_erase_range(partition, currentSector * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE); result != ESP_OK)
+            return tl::make_unexpected(fmt::format("esp_partition_erase_range() failed with {}", esp_err_to_name(result)));
+
+        // the records of the erased sector are gone, the sector after it holds the oldest now
+        if (const auto head = readHead((currentSector + 1) % sectorCount, 0); head && hasSequence(*head))
+            oldestSequence = head->sequence;
+    }
+
+    record.magic = RecordMagic;
+    record.sequence = nextSequence;
+    record.crc = crcOf(record);
+
+    const size_t offset = (currentSector * RecordsPerSector + nextSlot) * sizeof(Record);
+    // the slot is used even if the write fails, it is not erased anymore
+    nextSlot++;
+    if (const auto result = esp_partition_write(partition, offset, &record, sizeof(record)); result != ESP_OK)
+        return tl::make_unexpected(fmt::format("esp_partition_write() failed with {}", esp_err_to_name(result)));
+
+    nextSequence++;
+    return {};
+}
+
+void forEachRecord(uint32_t since, const std::function<bool(const Record &)> &callback)
+{
+    uint32_t firstSector, end;
+    {
+        std::lock_guard lock{mutex};
+        initLocked();
+        if (!partition)
+            return;
+        firstSector = (currentSector + 1) % sectorCount;
+        end = nextSequence;
+    }
+
+    // not locked while reading, records of a sector erased in the meantime fail the checks below
+    for (uint32_t i = 0; i < sectorCount; i++)
+    {
+        const uint32_t sector = (firstSector + i) % sectorCount;
+        for (uint32_t slot = 0; slot < RecordsPerSector; slot++)
+        {
+            Record record;
+            if (const auto result = esp_partition_read(partition, (sector * RecordsPerSector + slot) * sizeof(Record), &record, sizeof(record)); result != ESP_OK)
+            {
+                ESP_LOGE(TAG, "esp_partition_read() failed with %s", esp_err_to_name(result));
+                return;
+            }
+
+            if (record.magic == ErasedMagic)
+                break;
+            if (record.magic != RecordMagic || record.crc != crcOf(record))
+                continue;
+            if (record.sequence < since || record.sequence >= end)
+                continue;
+
+            if (!callback(record))
+                return;
+        }
+    }
+}
+
+tl::expected<void, std::string> clear()
+{
+    std::lock_guard lock{mutex};
+    initLocked();
+
+    if (!partition)
+        return tl::make_unexpected("no results partition");
+
+    for (uint32_t sector = 0; sector < sectorCount; sector++)
+    {
+        const auto head = readHead(sector, 0);
+        if (head && head->magic == ErasedMagic)
+            continue;
+        if (const auto result = esp_partition_erase_range(partition, sector * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE); result != ESP_OK)
+            return tl::make_unexpected(fmt::format("esp_partition_erase_range() failed with {}", esp_err_to_name(result)));
+    }
+
+    currentSector = 0;
+    nextSlot = 0;
+    oldestSequence = nextSequence;
+
+    // sequences continue after a reboot too, so downloads with ?since= do not see old numbers again
+    const RecordHead marker{ .magic = MarkerMagic, .sequence = nextSequence };
+    nextSlot++;
+    if (const auto result = esp_partition_write(partition, 0, &marker, sizeof(marker)); result != ESP_OK)
+        return tl::make_unexpected(fmt::format("esp_partition_write() failed with {}", esp_err_to_name(result)));
+    return {};
+}
+} // namespace resultstore
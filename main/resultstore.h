@@ -0,0 +1,73 @@
+#pragma once
+
+// system includes
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// 3rdparty lib includes
+#include <tl/expected.hpp>
+
+// append-only log of benchmark results in the results partition, survives reboots and updates
+namespace resultstore {
+constexpr const uint32_t RecordMagic = 0x544C5352; // "RSLT"
+
+enum RecordFlags : uint8_t {
+    RecordFlagUnixTime = 1 << 0, // sntp was synced when the record was written
+    RecordFlagAckRssi = 1 << 1
+};
+
+// little endian, the layout is read by tools outside the firmware, only append fields into reserved
+// slots without RecordMagic are no records (clear() leaves a marker in the first one)
+struct __attribute__((packed)) Record
+{
+    uint32_t magic;
+    uint32_t sequence; // counts up, starts at 0 again only on a fresh partition
+    int64_t unixTime;
+    uint32_t uptimeS;
+    char firmware[16]; // app version, cut off
+
+    // config of the run
+    uint8_t mode; // tester::Mode
+    uint8_t payloadSize;
+    uint8_t destination[6];
+    uint32_t rate;
+    char label[12];
+
+    // result
+    uint32_t sent;
+    uint32_t sendErrors;
+    uint32_t success;
+    uint32_t fail;
+    uint32_t durationUs; // measured, the configured duration plus draining the queue
+    uint32_t avgLatencyUs;
+    uint32_t maxLatencyUs;
+    int8_t ackRssi;
+    uint8_t flags;
+    uint8_t reserved[2];
+    std::array<uint32_t, 8> latencyHistogram; // buckets of espnow::latencyBucketLimitsUs
+
+    uint32_t crc; // crc32 of everything before
+};
+static_assert(sizeof(Record) == 128);
+
+struct Info
+{
+    bool available; // false without a results partition
+    uint32_t capacity; // records, the oldest sector is erased when it is full
+    uint32_t nextSequence;
+    uint32_t oldestSequence;
+};
+
+Info info();
+
+// fills in magic, sequence and crc
+tl::expected<void, std::string> append(Record record);
+
+// valid records with a sequence >= since, oldest first, the callback returns false to stop
+void forEachRecord(uint32_t since, const std::function<bool(const Record &)> &callback);
+
+// erases all records, the sequence keeps counting
+tl::expected<void, std::string> clear();
+} // namespace resultstore
@@ -12,10 +12,10 @@
 
 // local includes
 #include "wifi.h"
-#include "debugconsole.h"
 #include "ota.h"
 #include "webserver.h"
 #include "espnow.h"
+#include "telemetry.h"
 
 using namespace std::chrono_literals;
 
@@ -26,10 +26,10 @@ void not_needed() {}
 
 espcpputils::SchedulerTask schedulerTasksArr[] {
     espcpputils::SchedulerTask { "wifi",         wifi_begin,        wifi_update,         100ms },
-    espcpputils::SchedulerTask { "debugconsole", init_debugconsole, update_debugconsole, 50ms  },
     espcpputils::SchedulerTask { "ota_client",   ota_client_init,   ota_client_update,   100ms },
     espcpputils::SchedulerTask { "webserver",    initWebserver,     handleWebserver,     100ms },
     espcpputils::SchedulerTask { "espnow",       initEspNow,        handleEspNow,        100ms },
+    espcpputils::SchedulerTask { "telemetry",    telemetry::init,   telemetry::update,   1s    },
 };
 } // namespace
 
@@ -1,5 +1,11 @@
 #pragma once
 
+#include "sdkconfig.h"
+
+// system includes
+#include <array>
+#include <cstdint>
+
 // 3rdparty lib includes
 #include <arrayview.h>
 
@@ -8,4 +14,16 @@ namespace espcpputils { class SchedulerTask; }
 
 extern cpputils::ArrayView<espcpputils::SchedulerTask> schedulerTasks;
 
+// freertos tasks running beside the scheduler, for stack and priority reports
+constexpr const std::array<const char *, 11> freertosTaskNames {
+    "main", "console", "espnowTx", "espnowOutput", "espnowOta", "espnowRelay", "tester", "qosProbe", "asyncOtaTask", "httpd", "wifi"
+};
+
+// core the wifi driver task is pinned to, the default for the radio side of the task placement
+#ifdef CONFIG_ESP32_WIFI_TASK_PINNED_TO_CORE_1
+constexpr const uint8_t WifiCore = 1;
+#else
+constexpr const uint8_t WifiCore = 0;
+#endif
+
 void sched_pushStats(bool printTasks);
@@ -0,0 +1,287 @@
+#include "telemetry.h"
+
+#include "sdkconfig.h"
+
+// system includes
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+// esp-idf includes
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+#include <esp_heap_trace.h>
+#endif
+
+// 3rdparty lib includes
+#include <ring-buffer.h>
+
+namespace telemetry {
+namespace {
+constexpr const char * const TAG = "TELEMETRY";
+
+// one sample every 5s, 10 minutes of history in about 5 KiB of dram
+constexpr const int64_t HeapSampleIntervalUs = 5000000;
+std::mutex heapHistoryMutex;
+ring_buffer<HeapSample, 120> heapHistory;
+int64_t lastHeapSampleUs{};
+
+std::array<SubsystemHeap, MaxSubsystems> subsystems{};
+bool traceRunning{};
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+std::array<heap_trace_record_t, 100> traceRecords;
+bool traceInitialized{};
+#endif
+
+std::atomic<bool> hotPathCheckArmed{};
+thread_local uint8_t hotPathDepth{};
+thread_local uint32_t taskAllocations{};
+std::array<uint32_t, MaxSubsystems> schedulerTaskAllocations{};
+uint32_t reportedHotPathAllocations{};
+
+// looked up on the first allocation of a task, -1 for tasks that are not in freertosTaskNames
+constexpr const int8_t TaskNotLookedUp = -2;
+thread_local int8_t freertosTaskIndex{TaskNotLookedUp};
+std::array<std::atomic<uint32_t>, freertosTaskNames.size()> freertosAllocations{};
+
+int8_t lookUpFreertosTask()
+{
+    const char *name = pcTaskGetTaskName(nullptr);
+    for (size_t i = 0; i < freertosTaskNames.size(); i++)
+        if (!std::strcmp(name, freertosTaskNames[i]))
+            return i;
+    return -1;
+}
+
+void countAllocation(std::size_t size)
+{
+    // static constructors allocate before there is a current task, neither thread_local nor the task name work then
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)
+        return;
+
+    taskAllocations++;
+
+    if (freertosTaskIndex == TaskNotLookedUp)
+        freertosTaskIndex = lookUpFreertosTask();
+    if (freertosTaskIndex >= 0)
+        freertosAllocations[freertosTaskIndex].fetch_add(1, std::memory_order_relaxed);
+
+    if (!hotPathDepth || !hotPathCheckArmed.load(std::memory_order_relaxed))
+        return;
+
+    // no logging in here, it could allocate itself. update() reports it
+    allocationStats.hotPathAllocations++;
+    allocationStats.lastSize = size;
+    allocationStats.lastTask = pcTaskGetTaskName(nullptr);
+}
+} // namespace
+
+AllocationStats allocationStats;
+
+void init()
+{
+    update();
+}
+
+void update()
+{
+    if (const auto now = esp_timer_get_time(); !lastHeapSampleUs || now - lastHeapSampleUs >= HeapSampleIntervalUs)
+    {
+        lastHeapSampleUs = now;
+
+        HeapSample sample {
+            .uptimeS = uint32_t(now / 1000000),
+            .free8 = heap_caps_get_free_size(MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT),
+            .largest8 = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT),
+            .minFree8 = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT),
+            .free32 = heap_caps_get_free_size(MALLOC_CAP_INTERNAL|MALLOC_CAP_32BIT),
+            .stackFree = {}
+        };
+
+        const auto highWaterMarks = stackHighWaterMarks();
+        for (size_t i = 0; i < highWaterMarks.size(); i++)
+            sample.stackFree[i] = std::min<uint32_t>(highWaterMarks[i].value_or(0), UINT16_MAX);
+
+        std::lock_guard lock{heapHistoryMutex};
+        heapHistory.push_back(sample);
+    }
+
+    if (const uint32_t allocations = allocationStats.hotPathAllocations; allocations != reportedHotPathAllocations)
+    {
+        const char *task = allocationStats.lastTask;
+        ESP_LOGW(TAG, "%u heap allocations on the hot path, the last one was %u bytes in task %s",
+                 allocations - reportedHotPathAllocations, allocationStats.lastSize.load(), task ? task : "?");
+        reportedHotPathAllocations = allocations;
+    }
+}
+
+std::optional<HeapSample> latestHeapSample()
+{
+    std::lock_guard lock{heapHistoryMutex};
+    if (heapHistory.empty())
+        return std::nullopt;
+    return heapHistory.back();
+}
+
+void forEachHeapSample(const std::function<void(const HeapSample &)> &callback)
+{
+    std::lock_guard lock{heapHistoryMutex};
+    for (const auto &sample : heapHistory)
+        callback(sample);
+}
+
+std::array<std::optional<uint32_t>, freertosTaskNames.size()> stackHighWaterMarks()
+{
+    std::array<std::optional<uint32_t>, freertosTaskNames.size()> result;
+
+    for (size_t i = 0; i < freertosTaskNames.size(); i++)
+        if (const auto handle = xTaskGetHandle(freertosTaskNames[i]))
+            result[i] = uxTaskGetStackHighWaterMark(handle);
+
+    return result;
+}
+
+void accountSchedulerTask(size_t index, int32_t heapDelta)
+{
+    if (index >= subsystems.size())
+        return;
+
+    auto &subsystem = subsystems[index];
+    subsystem.netBytes += heapDelta;
+    if (heapDelta > 0)
+    {
+        subsystem.growthEvents++;
+        subsystem.maxGrowth = std::max(subsystem.maxGrowth, heapDelta);
+    }
+}
+
+SubsystemHeap subsystemHeap(size_t index)
+{
+    if (index >= subsystems.size())
+        return {};
+    return subsystems[index];
+}
+
+uint32_t allocationsOnThisTask()
+{
+    return taskAllocations;
+}
+
+void accountSchedulerAllocations(size_t index, uint32_t allocations)
+{
+    if (index >= schedulerTaskAllocations.size())
+        return;
+    schedulerTaskAllocations[index] += allocations;
+}
+
+uint32_t schedulerAllocations(size_t index)
+{
+    if (index >= schedulerTaskAllocations.size())
+        return {};
+    return schedulerTaskAllocations[index];
+}
+
+uint32_t freertosTaskAllocations(size_t index)
+{
+    if (index >= freertosAllocations.size())
+        return {};
+    return freertosAllocations[index];
+}
+
+bool heapTraceRunning()
+{
+    return traceRunning;
+}
+
+tl::expected<void, std::string> startHeapTrace()
+{
+    if (traceRunning)
+        return tl::make_unexpected("heap trace is already running");
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+    if (!traceInitialized)
+    {
+        if (const auto result = heap_trace_init_standalone(traceRecords.data(), traceRecords.size()); result != ESP_OK)
+            return tl::make_unexpected(std::string{"heap_trace_init_standalone() failed with "} + esp_err_to_name(result));
+        traceInitialized = true;
+    }
+
+    if (const auto result = heap_trace_start(HEAP_TRACE_LEAKS); result != ESP_OK)
+        return tl::make_unexpected(std::string{"heap_trace_start() failed with "} + esp_err_to_name(result));
+#else
+    ESP_LOGW(TAG, "CONFIG_HEAP_TRACING_STANDALONE is off, only the per scheduler task attribution is collected");
+#endif
+
+    subsystems = {};
+    traceRunning = true;
+    return {};
+}
+
+tl::expected<void, std::string> stopHeapTrace()
+{
+    if (!traceRunning)
+        return tl::make_unexpected("heap trace is not running");
+
+    traceRunning = false;
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+    if (const auto result = heap_trace_stop(); result != ESP_OK)
+        return tl::make_unexpected(std::string{"heap_trace_stop() failed with "} + esp_err_to_name(result));
+#endif
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+    // the monitor resolves the caller addresses of the leaked allocations to functions
+    heap_trace_dump();
+#endif
+
+    return {};
+}
+
+void armHotPathCheck()
+{
+    hotPathCheckArmed = true;
+}
+
+HotPath::HotPath()
+{
+    hotPathDepth++;
+}
+
+HotPath::~HotPath()
+{
+    hotPathDepth--;
+}
+} // namespace telemetry
+
+void *operator new(std::size_t size)
+{
+    telemetry::countAllocation(size);
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    // built without exceptions, there is no bad_alloc to throw
+    std::abort();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    telemetry::countAllocation(size);
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    telemetry::countAllocation(size);
+    return std::malloc(size ? size : 1);
+}
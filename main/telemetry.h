@@ -0,0 +1,88 @@
+#pragma once
+
+// system includes
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+
+// 3rdparty lib includes
+#include <tl/expected.hpp>
+
+// local includes
+#include "taskmanager.h"
+
+namespace telemetry {
+struct HeapSample
+{
+    uint32_t uptimeS;
+    uint32_t free8;
+    uint32_t largest8;
+    uint32_t minFree8;
+    uint32_t free32;
+    std::array<uint16_t, freertosTaskNames.size()> stackFree; // bytes, indexed like freertosTaskNames, 0 for tasks that are not running
+};
+
+// net heap consumed by the loop() of one scheduler task while a heap trace runs, other tasks allocating
+// meanwhile add noise. the freertos tasks beside the scheduler, like the tester running the floods and the
+// load generator, only get allocation counts, malloc() inside the wifi driver is not attributed at all
+struct SubsystemHeap
+{
+    int64_t netBytes;
+    int32_t maxGrowth;
+    uint32_t growthEvents;
+};
+
+constexpr const size_t MaxSubsystems = 16;
+
+void init();
+void update();
+
+std::optional<HeapSample> latestHeapSample();
+void forEachHeapSample(const std::function<void(const HeapSample &)> &callback);
+
+// in bytes, empty for tasks that are not running
+std::array<std::optional<uint32_t>, freertosTaskNames.size()> stackHighWaterMarks();
+
+void accountSchedulerTask(size_t index, int32_t heapDelta);
+SubsystemHeap subsystemHeap(size_t index);
+
+// operator new calls made by the loop() of a scheduler task, always counted. malloc() inside esp-idf is not seen
+uint32_t allocationsOnThisTask();
+void accountSchedulerAllocations(size_t index, uint32_t allocations);
+uint32_t schedulerAllocations(size_t index);
+
+// operator new calls made by the freertos tasks of freertosTaskNames, indexed like them
+uint32_t freertosTaskAllocations(size_t index);
+
+// subsystems are the scheduler tasks, indexed like schedulerTasks
+bool heapTraceRunning();
+tl::expected<void, std::string> startHeapTrace();
+tl::expected<void, std::string> stopHeapTrace();
+
+// operator new is replaced to count allocations made while a HotPath is alive on the calling task,
+// the radio path is supposed to only use the buffers set up at boot
+struct AllocationStats
+{
+    std::atomic<uint32_t> hotPathAllocations{};
+    std::atomic<uint32_t> lastSize{};
+    std::atomic<const char *> lastTask{};
+};
+
+extern AllocationStats allocationStats;
+
+// called once all scheduler tasks are set up, allocations before are expected
+void armHotPathCheck();
+
+class HotPath
+{
+public:
+    HotPath();
+    ~HotPath();
+
+    HotPath(const HotPath &) = delete;
+    HotPath &operator=(const HotPath &) = delete;
+};
+} // namespace telemetry
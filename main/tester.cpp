@@ -0,0 +1,591 @@
+#include "tester.h"
+
+// system includes
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+
+// esp-idf includes
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// 3rdparty lib includes
+#include <fmt/core.h>
+
+// local includes
+#include "config.h"
+#include "espnow.h"
+#include "espnowping.h"
+#include "resultstore.h"
+#include "telemetry.h"
+
+namespace tester {
+namespace {
+constexpr const char * const TAG = "TESTER";
+
+static_assert(std::tuple_size_v<decltype(FloodResult::latencyHistogram)> == espnow::LatencyBuckets);
+static_assert(std::tuple_size_v<decltype(resultstore::Record::latencyHistogram)> == espnow::LatencyBuckets);
+
+// queued floods keep at most this many frames in the bulk queue
+constexpr uint32_t MaxQueued = 16;
+
+// ping interval of the qos probe
+constexpr uint32_t ProbeIntervalMs = 20;
+
+// Pattern::Bursty
+constexpr int64_t BurstOnUs = 100000;
+constexpr int64_t BurstOffUs = 300000;
+
+struct VirtualNode
+{
+    Pattern pattern;
+    uint16_t seq;
+    int64_t dueUs;
+    int64_t burstEndUs;
+    uint32_t sent;
+    uint32_t sendErrors;
+};
+
+// driver counters at the start of a run, the result is the difference at its end
+struct TxSnapshot
+{
+    uint32_t success;
+    uint32_t fail;
+    uint32_t latencySum;
+    uint32_t ackFrames;
+    int32_t ackRssiSum;
+    std::array<uint32_t, espnow::LatencyBuckets> histogram;
+};
+
+std::atomic<Mode> currentMode{Mode::Idle};
+std::atomic<bool> abortRequested{};
+FloodParams currentParams;
+Results currentResults;
+
+void testerTask(void *);
+FloodResult runFlood(const char *label, const FloodParams &params, bool queued = false);
+FloodResult runQosProbe(const char *label, const FloodParams &params, espnow::TrafficClass probeClass);
+FloodResult runLoadGen(const char *label, const FloodParams &params);
+resultstore::Record toRecord(const FloodResult &result);
+tl::expected<void, std::string> start(Mode mode, const FloodParams &params);
+} // namespace
+
+std::string_view toString(Mode mode)
+{
+    switch (mode)
+    {
+    case Mode::Idle:                return "Idle";
+    case Mode::Flood:               return "Flood";
+    case Mode::EncryptionBenchmark: return "EncryptionBenchmark";
+    case Mode::RateSweep:           return "RateSweep";
+    case Mode::QosProbe:            return "QosProbe";
+    case Mode::LoadGen:             return "LoadGen";
+    }
+    return "Unknown";
+}
+
+std::string_view toString(Pattern pattern)
+{
+    switch (pattern)
+    {
+    case Pattern::Constant: return "constant";
+    case Pattern::Poisson:  return "poisson";
+    case Pattern::Bursty:   return "bursty";
+    case Pattern::Mixed:    return "mixed";
+    }
+    return "unknown";
+}
+
+tl::expected<Pattern, std::string> parsePattern(std::string_view str)
+{
+    for (const auto pattern : {Pattern::Constant, Pattern::Poisson, Pattern::Bursty, Pattern::Mixed})
+        if (str == toString(pattern))
+            return pattern;
+    return tl::make_unexpected(fmt::format("unknown pattern {}, expected constant, poisson, bursty or mixed", str));
+}
+
+float FloodResult::throughputKbps() const
+{
+    if (!durationUs)
+        return 0.f;
+    return float(success) * payloadBytes * 8 / durationUs * 1000;
+}
+
+float FloodResult::lossPercent() const
+{
+    const auto completed = success + fail;
+    if (!completed)
+        return 0.f;
+    return float(fail) / completed * 100;
+}
+
+Mode mode()
+{
+    return currentMode;
+}
+
+const FloodParams &params()
+{
+    return currentParams;
+}
+
+const Results &results()
+{
+    return currentResults;
+}
+
+tl::expected<void, std::string> startFlood(const FloodParams &params)
+{
+    return start(Mode::Flood, params);
+}
+
+tl::expected<void, std::string> startEncryptionBenchmark(const FloodParams &params)
+{
+    if (!espnow::peerHasKey(params.destination.data()))
+        return tl::make_unexpected(fmt::format("{} is not an active encrypted peer, configure espnowPeerMac/Enc/Lmk first",
+                                               wifi_stack::toString(params.destination)));
+
+    return start(Mode::EncryptionBenchmark, params);
+}
+
+tl::expected<void, std::string> startRateSweep(const FloodParams &params)
+{
+    return start(Mode::RateSweep, params);
+}
+
+tl::expected<void, std::string> startQosProbe(const FloodParams &params)
+{
+    if (params.durationMs < ProbeIntervalMs)
+        return tl::make_unexpected(fmt::format("duration must be at least {}ms", ProbeIntervalMs));
+
+    return start(Mode::QosProbe, params);
+}
+
+tl::expected<void, std::string> startLoadGen(const FloodParams &params)
+{
+    if (params.virtualNodes < 1 || params.virtualNodes > MaxVirtualNodes)
+        return tl::make_unexpected(fmt::format("virtual nodes must be between 1 and {}", MaxVirtualNodes));
+
+    if (!params.rate)
+        return tl::make_unexpected("the load generator needs a rate per node");
+
+    if (params.payloadSize > espnow::MaxVirtualPayload)
+        return tl::make_unexpected(fmt::format("payload size must be between 1 and {} for virtual nodes", espnow::MaxVirtualPayload));
+
+    return start(Mode::LoadGen, params);
+}
+
+void abort()
+{
+    if (currentMode != Mode::Idle)
+        abortRequested = true;
+}
+
+namespace {
+tl::expected<void, std::string> start(Mode mode, const FloodParams &params)
+{
+    if (currentMode != Mode::Idle)
+        return tl::make_unexpected(fmt::format("tester is busy ({})", toString(currentMode)));
+
+    if (params.payloadSize < 1 || params.payloadSize > espnow::MaxFramePayload)
+        return tl::make_unexpected(fmt::format("payload size must be between 1 and {}", espnow::MaxFramePayload));
+
+    if (!espnow::findPeer(params.destination.data()))
+        return tl::make_unexpected(fmt::format("{} is not in the peer table", wifi_stack::toString(params.destination)));
+
+    currentParams = params;
+    currentResults.count = 0;
+    abortRequested = false;
+    currentMode = mode;
+
+    if (const auto result = xTaskCreatePinnedToCore(testerTask, "tester", 4096, nullptr, configs.testerPrio.value, nullptr, configs.radioCore.value); result != pdPASS)
+    {
+        currentMode = Mode::Idle;
+        return tl::make_unexpected(fmt::format("xTaskCreatePinnedToCore() failed with {}", result));
+    }
+
+    return {};
+}
+
+void addResult(const FloodResult &result)
+{
+    ESP_LOGI(TAG, "%s: sent=%u errors=%u success=%u fail=%u loss=%.2f%% throughput=%.1fkbit/s latency avg=%uus max=%uus ack rssi=%s",
+             result.label, result.sent, result.sendErrors, result.success, result.fail,
+             result.lossPercent(), result.throughputKbps(), result.avgLatencyUs, result.maxLatencyUs,
+             result.ackRssi ? std::to_string(*result.ackRssi).c_str() : "n/a");
+
+    if (currentResults.count < currentResults.entries.size())
+        currentResults.entries[currentResults.count++] = result;
+
+    if (const auto stored = resultstore::append(toRecord(result)); !stored)
+        ESP_LOGW(TAG, "could not store result: %s", stored.error().c_str());
+}
+
+resultstore::Record toRecord(const FloodResult &result)
+{
+    resultstore::Record record{
+        .uptimeS = uint32_t(esp_timer_get_time() / 1000000),
+        .mode = uint8_t(currentMode.load()),
+        .payloadSize = currentParams.payloadSize,
+        .rate = currentParams.rate,
+        .sent = result.sent,
+        .sendErrors = result.sendErrors,
+        .success = result.success,
+        .fail = result.fail,
+        .durationUs = result.durationUs,
+        .avgLatencyUs = result.avgLatencyUs,
+        .maxLatencyUs = result.maxLatencyUs,
+        .ackRssi = result.ackRssi.value_or(0),
+        .flags = uint8_t(result.ackRssi ? resultstore::RecordFlagAckRssi : 0),
+        .latencyHistogram = result.latencyHistogram
+    };
+
+    // before the first sntp sync the clock starts at 1970
+    if (const auto now = std::time(nullptr); now > 1600000000)
+    {
+        record.unixTime = now;
+        record.flags |= resultstore::RecordFlagUnixTime;
+    }
+
+    if (const auto *appDesc = esp_ota_get_app_description())
+        std::strncpy(record.firmware, appDesc->version, sizeof(record.firmware));
+    std::copy(std::begin(currentParams.destination), std::end(currentParams.destination), record.destination);
+    std::strncpy(record.label, result.label, sizeof(record.label));
+
+    return record;
+}
+
+void testerTask(void *)
+{
+    switch (currentMode)
+    {
+    case Mode::Idle:
+        break;
+    case Mode::Flood:
+        addResult(runFlood("flood", currentParams));
+        break;
+    case Mode::EncryptionBenchmark:
+    {
+        const auto *mac = currentParams.destination.data();
+
+        if (const auto error = espnow::setPeerEncrypted(mac, false); error == ESP_OK)
+            addResult(runFlood("plaintext", currentParams));
+
+        if (const auto error = espnow::setPeerEncrypted(mac, true); error == ESP_OK && !abortRequested)
+            addResult(runFlood("encrypted", currentParams));
+
+        if (currentResults.count == 2)
+        {
+            const auto &plain = currentResults.entries[0];
+            const auto &encrypted = currentResults.entries[1];
+            ESP_LOGI(TAG, "encryption cost: throughput %+.1f%%, latency %+dus",
+                     plain.throughputKbps() > 0 ? (encrypted.throughputKbps() / plain.throughputKbps() - 1) * 100 : 0.f,
+                     int(encrypted.avgLatencyUs) - int(plain.avgLatencyUs));
+        }
+        break;
+    }
+    case Mode::RateSweep:
+    {
+        for (const auto &phyRate : espnow::phyRates)
+        {
+            if (abortRequested)
+                break;
+
+            if (phyRate.longRange && !configs.espnowLongRange.value)
+                continue;
+
+            if (const auto error = espnow::setPhyRateOverride(phyRate.rate); error != ESP_OK)
+            {
+                ESP_LOGW(TAG, "skipping rate %s, could not be applied", phyRate.name);
+                continue;
+            }
+
+            addResult(runFlood(phyRate.name, currentParams));
+        }
+
+        espnow::setPhyRateOverride(std::nullopt);
+
+        const FloodResult *best{};
+        for (size_t i = 0; i < currentResults.count; i++)
+            if (!best || currentResults.entries[i].throughputKbps() > best->throughputKbps())
+                best = &currentResults.entries[i];
+        if (best)
+            ESP_LOGI(TAG, "best rate: %s with %.1fkbit/s at %.2f%% loss", best->label, best->throughputKbps(), best->lossPercent());
+        break;
+    }
+    case Mode::QosProbe:
+    {
+        addResult(runQosProbe("qos control", currentParams, espnow::TrafficClass::Control));
+
+        if (!abortRequested)
+            addResult(runQosProbe("qos bulk", currentParams, espnow::TrafficClass::Bulk));
+
+        if (currentResults.count == 2)
+        {
+            const auto &control = currentResults.entries[0];
+            const auto &bulk = currentResults.entries[1];
+            ESP_LOGI(TAG, "ping rtt under load: control %uus, bulk %uus", control.probeAvgRttUs, bulk.probeAvgRttUs);
+        }
+        break;
+    }
+    case Mode::LoadGen:
+        addResult(runLoadGen("loadgen", currentParams));
+        break;
+    }
+
+    currentMode = Mode::Idle;
+    vTaskDelete(nullptr);
+}
+
+TxSnapshot takeSnapshot()
+{
+    auto &txStats = espnow::txStats;
+
+    // wait for frames of a previous run to complete, so the counters below only see ours
+    for (int i = 0; i < 10 && txStats.sent != txStats.success + txStats.fail; i++)
+        vTaskDelay(1);
+
+    TxSnapshot snapshot{
+        .success = txStats.success,
+        .fail = txStats.fail,
+        .latencySum = txStats.latencySumUs,
+        .ackFrames = espnow::sniffer::ackStats.frames,
+        .ackRssiSum = espnow::sniffer::ackStats.rssiSum
+    };
+    txStats.latencyMaxUs = 0;
+    for (size_t i = 0; i < snapshot.histogram.size(); i++)
+        snapshot.histogram[i] = txStats.latencyHistogram[i];
+    return snapshot;
+}
+
+// waits for the frames of the run to complete and fills in the driver side of the result
+void finishResult(FloodResult &result, const TxSnapshot &before, int64_t start)
+{
+    auto &txStats = espnow::txStats;
+
+    for (int i = 0; i < 50 && espnow::txQueueLength(espnow::TrafficClass::Bulk); i++)
+        vTaskDelay(1);
+    for (int i = 0; i < 10 && txStats.sent != txStats.success + txStats.fail; i++)
+        vTaskDelay(1);
+
+    result.durationUs = esp_timer_get_time() - start;
+    result.success = txStats.success - before.success;
+    result.fail = txStats.fail - before.fail;
+    result.maxLatencyUs = txStats.latencyMaxUs;
+    for (size_t i = 0; i < result.latencyHistogram.size(); i++)
+        result.latencyHistogram[i] = txStats.latencyHistogram[i] - before.histogram[i];
+    if (const auto completed = result.success + result.fail)
+        result.avgLatencyUs = (txStats.latencySumUs - before.latencySum) / completed;
+    if (const uint32_t acks = espnow::sniffer::ackStats.frames - before.ackFrames)
+        result.ackRssi = (espnow::sniffer::ackStats.rssiSum - before.ackRssiSum) / int32_t(acks);
+}
+
+// queued floods go through the bulk tx queue like other background traffic, instead of straight to the driver
+FloodResult runFlood(const char *label, const FloodParams &params, bool queued)
+{
+    std::array<uint8_t, espnow::MaxFramePayload> payload;
+    for (size_t i = 0; i < payload.size(); i++)
+        payload[i] = i;
+
+    const auto before = takeSnapshot();
+
+    FloodResult result{ .label = label, .payloadBytes = params.payloadSize };
+
+    const int64_t start = esp_timer_get_time();
+    const int64_t end = start + int64_t(params.durationMs) * 1000;
+    const int64_t interval = params.rate ? 1000000 / params.rate : 0;
+
+    telemetry::HotPath hotPath;
+    for (int64_t now = start; now < end && !abortRequested; now = esp_timer_get_time())
+    {
+        // the tick is 10ms, frames that became due in the meantime are sent as a burst
+        const uint32_t due = interval ? (now - start) / interval + 1 : result.sent + result.sendErrors + 1;
+        // direct floods follow the pacing limit, esp_now_send() returns ESP_ERR_ESPNOW_NO_MEM above it
+        const bool full = queued ?
+            espnow::txQueueLength(espnow::TrafficClass::Bulk) >= MaxQueued :
+            espnow::inFlight() >= espnow::inFlightLimit();
+
+        if (result.sent + result.sendErrors >= due || full)
+        {
+            vTaskDelay(1);
+            continue;
+        }
+
+        const auto error = queued ?
+            espnow::queueEspNow(espnow::FrameType::Flood, payload.data(), params.payloadSize, params.destination.data(), pdMS_TO_TICKS(10), espnow::TrafficClass::Bulk) :
+            espnow::_sendEspNowImpl(espnow::FrameType::Flood, payload.data(), params.payloadSize, params.destination.data());
+        if (error == ESP_OK)
+            result.sent++;
+        else
+        {
+            result.sendErrors++;
+            vTaskDelay(1);
+        }
+    }
+
+    finishResult(result, before, start);
+    return result;
+}
+
+// random in [0, 1)
+float uniform()
+{
+    return esp_random() / 4294967296.f;
+}
+
+// next send time of a node after it sent at node.dueUs
+void scheduleNext(VirtualNode &node, int64_t intervalUs)
+{
+    switch (node.pattern)
+    {
+    case Pattern::Constant:
+    case Pattern::Mixed:
+        node.dueUs += intervalUs;
+        break;
+    case Pattern::Poisson:
+        node.dueUs += int64_t(-std::log(1.f - uniform()) * intervalUs);
+        break;
+    case Pattern::Bursty:
+    {
+        // the off time is made up by sending four times as often while on
+        constexpr int64_t Speedup = (BurstOnUs + BurstOffUs) / BurstOnUs;
+        node.dueUs += intervalUs / Speedup;
+        if (node.dueUs >= node.burstEndUs)
+        {
+            node.dueUs = node.burstEndUs + BurstOffUs;
+            node.burstEndUs = node.dueUs + BurstOnUs;
+        }
+        break;
+    }
+    }
+}
+
+// every node has its own seq and schedule, receivers count them as separate senders
+FloodResult runLoadGen(const char *label, const FloodParams &params)
+{
+    std::array<uint8_t, espnow::MaxVirtualPayload> payload;
+    for (size_t i = 0; i < payload.size(); i++)
+        payload[i] = i;
+
+    const auto before = takeSnapshot();
+
+    FloodResult result{ .label = label, .payloadBytes = params.payloadSize };
+
+    const int64_t start = esp_timer_get_time();
+    const int64_t end = start + int64_t(params.durationMs) * 1000;
+    const int64_t interval = 1000000 / params.rate;
+
+    std::array<VirtualNode, MaxVirtualNodes> nodes;
+    for (size_t i = 0; i < params.virtualNodes; i++)
+    {
+        auto &node = nodes[i];
+        const auto pattern = params.pattern == Pattern::Mixed ? Pattern(i % 3) : params.pattern;
+        // random phases, so the nodes do not send in lockstep
+        node = VirtualNode{
+            .pattern = pattern,
+            .seq = uint16_t(esp_random()),
+            .dueUs = start + int64_t(uniform() * (pattern == Pattern::Bursty ? BurstOnUs + BurstOffUs : interval)),
+            .burstEndUs = 0,
+            .sent = 0,
+            .sendErrors = 0
+        };
+        node.burstEndUs = node.dueUs + BurstOnUs;
+    }
+    const auto begin = std::begin(nodes);
+    const auto last = begin + params.virtualNodes;
+
+    telemetry::HotPath hotPath;
+    for (int64_t now = start; now < end && !abortRequested; now = esp_timer_get_time())
+    {
+        auto &node = *std::min_element(begin, last, [](const auto &a, const auto &b){ return a.dueUs < b.dueUs; });
+
+        // the tick is 10ms, frames that became due in the meantime are sent as a burst
+        if (node.dueUs > now || espnow::inFlight() >= espnow::inFlightLimit())
+        {
+            vTaskDelay(1);
+            continue;
+        }
+
+        // a rejected frame is sent again later with the same seq, receivers only see real loss
+        const uint8_t nodeId = &node - begin + 1;
+        if (espnow::sendVirtual(nodeId, node.seq, espnow::FrameType::Flood, payload.data(), params.payloadSize, params.destination.data()) != ESP_OK)
+        {
+            node.sendErrors++;
+            result.sendErrors++;
+            vTaskDelay(1);
+            continue;
+        }
+
+        node.seq++;
+        node.sent++;
+        result.sent++;
+        scheduleNext(node, interval);
+    }
+
+    finishResult(result, before, start);
+
+    for (auto iter = begin; iter != last; iter++)
+        ESP_LOGI(TAG, "node %u (%.*s): sent=%u errors=%u", unsigned(iter - begin + 1),
+                 toString(iter->pattern).size(), toString(iter->pattern).data(), iter->sent, iter->sendErrors);
+
+    return result;
+}
+
+struct ProbeRun
+{
+    uint8_t destination[ESP_NOW_ETH_ALEN];
+    uint32_t count;
+    espnow::TrafficClass trafficClass;
+    std::optional<espnow::ping::Result> result;
+    TaskHandle_t waiter;
+};
+
+void probeTask(void *arg)
+{
+    auto &run = *static_cast<ProbeRun *>(arg);
+
+    if (auto result = espnow::ping::run(run.destination, run.count, ProbeIntervalMs, {}, run.trafficClass))
+        run.result = *result;
+    else
+        ESP_LOGW(TAG, "qos probe: %s", result.error().c_str());
+
+    xTaskNotifyGive(run.waiter);
+    vTaskDelete(nullptr);
+}
+
+// pings the destination while a queued flood runs, the pongs also count in the flood's success counters
+FloodResult runQosProbe(const char *label, const FloodParams &params, espnow::TrafficClass probeClass)
+{
+    ProbeRun run{ .count = params.durationMs / ProbeIntervalMs, .trafficClass = probeClass, .waiter = xTaskGetCurrentTaskHandle() };
+    std::copy(std::begin(params.destination), std::end(params.destination), run.destination);
+
+    ulTaskNotifyTake(pdTRUE, 0);
+    if (const auto result = xTaskCreatePinnedToCore(probeTask, "qosProbe", 3072, &run, configs.testerPrio.value, nullptr, configs.appCore.value); result != pdPASS)
+    {
+        ESP_LOGE(TAG, "xTaskCreatePinnedToCore() failed with %i", result);
+        return runFlood(label, params, true);
+    }
+
+    auto result = runFlood(label, params, true);
+
+    // run lives on this stack, the probe task has to be done with it before returning
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    if (run.result)
+    {
+        result.probeSent = run.result->sent;
+        result.probeReceived = run.result->received;
+        result.probeAvgRttUs = run.result->avgRttUs();
+        result.probeMaxRttUs = run.result->maxRttUs;
+    }
+
+    return result;
+}
+} // namespace
+} // namespace tester
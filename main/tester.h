@@ -0,0 +1,91 @@
+#pragma once
+
+// system includes
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// 3rdparty lib includes
+#include <tl/expected.hpp>
+#include <espwifiutils.h>
+
+namespace tester {
+enum class Mode : uint8_t {
+    Idle,
+    Flood,
+    EncryptionBenchmark,
+    RateSweep,
+    QosProbe, // queued flood, pinged once as control and once as bulk traffic
+    LoadGen // many virtual nodes flooding from this board, see espnow::sendVirtual()
+};
+
+std::string_view toString(Mode mode);
+
+// traffic of one virtual node in Mode::LoadGen, all average FloodParams::rate
+enum class Pattern : uint8_t {
+    Constant,
+    Poisson, // exponentially distributed gaps
+    Bursty, // on for 100ms at four times the rate, then off for 300ms
+    Mixed // the patterns above round robin over the nodes
+};
+
+std::string_view toString(Pattern pattern);
+tl::expected<Pattern, std::string> parsePattern(std::string_view str);
+
+constexpr const uint8_t MaxVirtualNodes = 16;
+
+struct FloodParams
+{
+    wifi_stack::mac_t destination;
+    uint32_t rate; // frames per second, 0 sends as fast as the driver accepts
+    uint32_t durationMs;
+    uint8_t payloadSize;
+
+    // only Mode::LoadGen, rate is per node there
+    uint8_t virtualNodes;
+    Pattern pattern;
+};
+
+struct FloodResult
+{
+    const char *label;
+    uint32_t sent;
+    uint32_t sendErrors;
+    uint32_t success;
+    uint32_t fail;
+    uint32_t durationUs;
+    uint32_t payloadBytes;
+    uint32_t avgLatencyUs;
+    uint32_t maxLatencyUs;
+    std::optional<int8_t> ackRssi; // only with configs.espnowRssiCapture
+    std::array<uint32_t, 8> latencyHistogram; // buckets of espnow::latencyBucketLimitsUs
+
+    // pings sent beside the flood, only in Mode::QosProbe
+    uint32_t probeSent;
+    uint32_t probeReceived;
+    uint32_t probeAvgRttUs;
+    uint32_t probeMaxRttUs;
+
+    float throughputKbps() const;
+    float lossPercent() const;
+};
+
+struct Results
+{
+    std::array<FloodResult, 24> entries;
+    size_t count;
+};
+
+Mode mode();
+const FloodParams &params();
+const Results &results();
+
+tl::expected<void, std::string> startFlood(const FloodParams &params);
+tl::expected<void, std::string> startEncryptionBenchmark(const FloodParams &params);
+tl::expected<void, std::string> startRateSweep(const FloodParams &params);
+tl::expected<void, std::string> startQosProbe(const FloodParams &params);
+tl::expected<void, std::string> startLoadGen(const FloodParams &params);
+void abort();
+} // namespace tester
@@ -3,7 +3,10 @@
 #include "sdkconfig.h"
 
 // system includes
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <iterator>
 
 // esp-idf includes
 #include <esp_log.h>
@@ -22,10 +25,25 @@
 #include <espchrono.h>
 #include <cpputils.h>
 #include <numberparsing.h>
+#include <schedulertask.h>
 
 // local includes
 #include "ota.h"
+#include "otadelta.h"
 #include "config.h"
+#include "debugconsole.h"
+#include "espnow.h"
+#include "espnowcycles.h"
+#include "espnowfilter.h"
+#include "espnowota.h"
+#include "espnowrate.h"
+#include "espnowrelay.h"
+#include "espnowtimesync.h"
+#include "espnowtrace.h"
+#include "resultstore.h"
+#include "taskmanager.h"
+#include "telemetry.h"
+#include "tester.h"
 
 using namespace std::chrono_literals;
 using esphttpdutils::HtmlTag;
@@ -39,18 +57,54 @@ esp_err_t webserver_reboot_handler(httpd_req_t *req);
 
 esp_err_t webserver_ota_handler(httpd_req_t *req);
 esp_err_t webserver_trigger_ota_handler(httpd_req_t *req);
+esp_err_t webserver_startP2pOta_handler(httpd_req_t *req);
+esp_err_t webserver_stopP2pOta_handler(httpd_req_t *req);
 
 esp_err_t webserver_settings_handler(httpd_req_t *req);
 esp_err_t webserver_saveSettings_handler(httpd_req_t *req);
 esp_err_t webserver_resetSettings_handler(httpd_req_t *req);
+
+esp_err_t webserver_tester_handler(httpd_req_t *req);
+esp_err_t webserver_startTester_handler(httpd_req_t *req);
+esp_err_t webserver_abortTester_handler(httpd_req_t *req);
+esp_err_t webserver_resetRxStats_handler(httpd_req_t *req);
+
+esp_err_t webserver_metrics_handler(httpd_req_t *req);
+esp_err_t webserver_heapHistory_handler(httpd_req_t *req);
+esp_err_t webserver_traces_handler(httpd_req_t *req);
+esp_err_t webserver_results_handler(httpd_req_t *req);
+esp_err_t webserver_clearResults_handler(httpd_req_t *req);
+
+tl::expected<std::string, std::string> webserver_get_query_param(const std::string &query, const char *name);
+std::string jsonEscape(std::string_view str);
+
+// httpd runs the handlers one after another in its own task, so they can share one body buffer.
+// it is reserved at boot and keeps its capacity, larger pages grow it once
+constexpr const size_t ResponseBodyReserve = 8192;
+std::string responseBody;
+
+std::string &takeResponseBody()
+{
+    responseBody.clear();
+    return responseBody;
+}
+
+// cores and priorities are only read when the tasks are created
+std::atomic<bool> rebootRequired{};
 } // namespace
 
 void initWebserver()
 {
+    responseBody.reserve(ResponseBodyReserve);
+
+    watchConfigs(subscribeConfigChanges([](){ rebootRequired = true; }),
+                 configs.radioCore, configs.appCore, configs.espnowTxPrio, configs.espnowOutPrio, configs.consolePrio, configs.httpdPrio);
+
     {
         httpd_config_t httpConfig HTTPD_DEFAULT_CONFIG();
-        httpConfig.core_id = 1;
-        httpConfig.max_uri_handlers = 16;
+        httpConfig.core_id = configs.appCore.value;
+        httpConfig.task_priority = configs.httpdPrio.value;
+        httpConfig.max_uri_handlers = 24;
         httpConfig.stack_size = 8192;
 
         const auto result = httpd_start(&httpdHandle, &httpConfig);
@@ -68,6 +122,19 @@ void initWebserver()
 
         httpd_uri_t { .uri = "/ota",                .method = HTTP_GET, .handler = webserver_ota_handler,                .user_ctx = NULL },
         httpd_uri_t { .uri = "/triggerOta",         .method = HTTP_GET, .handler = webserver_trigger_ota_handler,        .user_ctx = NULL },
+        httpd_uri_t { .uri = "/startP2pOta",        .method = HTTP_GET, .handler = webserver_startP2pOta_handler,        .user_ctx = NULL },
+        httpd_uri_t { .uri = "/stopP2pOta",         .method = HTTP_GET, .handler = webserver_stopP2pOta_handler,         .user_ctx = NULL },
+
+        httpd_uri_t { .uri = "/tester",             .method = HTTP_GET, .handler = webserver_tester_handler,             .user_ctx = NULL },
+        httpd_uri_t { .uri = "/startTester",        .method = HTTP_GET, .handler = webserver_startTester_handler,        .user_ctx = NULL },
+        httpd_uri_t { .uri = "/abortTester",        .method = HTTP_GET, .handler = webserver_abortTester_handler,        .user_ctx = NULL },
+        httpd_uri_t { .uri = "/resetRxStats",       .method = HTTP_GET, .handler = webserver_resetRxStats_handler,       .user_ctx = NULL },
+
+        httpd_uri_t { .uri = "/metrics",            .method = HTTP_GET, .handler = webserver_metrics_handler,            .user_ctx = NULL },
+        httpd_uri_t { .uri = "/heapHistory",        .method = HTTP_GET, .handler = webserver_heapHistory_handler,        .user_ctx = NULL },
+        httpd_uri_t { .uri = "/traces",             .method = HTTP_GET, .handler = webserver_traces_handler,             .user_ctx = NULL },
+        httpd_uri_t { .uri = "/results",            .method = HTTP_GET, .handler = webserver_results_handler,            .user_ctx = NULL },
+        httpd_uri_t { .uri = "/clearResults",       .method = HTTP_GET, .handler = webserver_clearResults_handler,       .user_ctx = NULL },
     })
     {
         const auto result = httpd_register_uri_handler(httpdHandle, &uri);
@@ -91,7 +158,7 @@ esp_err_t webserver_reboot_handler(httpd_req_t *req)
 
 esp_err_t webserver_ota_handler(httpd_req_t *req)
 {
-    std::string body;
+    auto &body = takeResponseBody();
 
     HtmlTag htmlTag{"html", body};
 
@@ -117,7 +184,8 @@ esp_err_t webserver_ota_handler(httpd_req_t *req)
         {
             HtmlTag pTag{"p", body};
             body += "<a href=\"/\">Settings</a> - "
-                    "<b>Update</b>";
+                    "<b>Update</b> - "
+                    "<a href=\"/tester\">Tester</a>";
         }
 
         if (const esp_app_desc_t *app_desc = esp_ota_get_app_description())
@@ -184,10 +252,37 @@ esp_err_t webserver_ota_handler(httpd_req_t *req)
                     HtmlTag tdTag{"td", body};
                     const auto progress = otaClient.progress();
                     const auto totalSize = otaClient.totalSize();
-                    body += fmt::format("{} / {}{}",
-                                        progress,
-                                        totalSize ? std::to_string(*totalSize) : "?",
-                                        (totalSize && *totalSize > 0) ? fmt::format(" ({:.02f}%)", float(progress) / *totalSize * 100) : "");
+                    fmt::format_to(std::back_inserter(body), "{} / {}{}",
+                                   progress,
+                                   totalSize ? std::to_string(*totalSize) : "?",
+                                   (totalSize && *totalSize > 0) ? fmt::format(" ({:.02f}%)", float(progress) / *totalSize * 100) : "");
+                }
+            }
+
+            if (otaGovernorStats.active)
+            {
+                HtmlTag trTag{"tr", body};
+                { HtmlTag tdTag{"td", body}; body += "Update rate"; }
+                {
+                    HtmlTag tdTag{"td", body};
+                    fmt::format_to(std::back_inserter(body), "{:.1f} KiB/s (avg {:.1f} KiB/s), paused {} times for {}ms, esp-now frames={} lost={} tx fail={}",
+                                   otaGovernorStats.bytesPerSecond / 1024.f, otaGovernorStats.avgBytesPerSecond / 1024.f,
+                                   otaGovernorStats.pauses, otaGovernorStats.pausedMs,
+                                   otaGovernorStats.espnowFrames, otaGovernorStats.espnowLost, otaGovernorStats.espnowTxFail);
+                }
+            }
+
+            if (const auto delta = otadelta::progress(); delta.status != otadelta::Status::Idle)
+            {
+                HtmlTag trTag{"tr", body};
+                { HtmlTag tdTag{"td", body}; body += delta.delta ? "Delta update" : "Compressed update"; }
+                {
+                    HtmlTag tdTag{"td", body};
+                    body += esphttpdutils::htmlentities(fmt::format("{}: {} / {} bytes written, {} / {} bytes over the air{}{}",
+                                                                    toString(delta.status), delta.written, delta.targetSize,
+                                                                    delta.downloaded, delta.contentLength ? std::to_string(*delta.contentLength) : "?",
+                                                                    delta.durationUs ? fmt::format(" in {:.1f}s", delta.durationUs / 1000000.f) : "",
+                                                                    delta.message.empty() ? "" : fmt::format(" ({})", delta.message)));
                 }
             }
 
@@ -245,7 +340,7 @@ esp_err_t webserver_ota_handler(httpd_req_t *req)
                 body += "Trigger Update";
             }
 
-            body += fmt::format("<input type=\"text\" name=\"url\" value=\"{}\" />", esphttpdutils::htmlentities(configs.otaUrl.value));
+            fmt::format_to(std::back_inserter(body), "<input type=\"text\" name=\"url\" value=\"{}\" />", esphttpdutils::htmlentities(configs.otaUrl.value));
 
             {
                 HtmlTag buttonTag{"button", "type=\"submit\"", body};
@@ -254,6 +349,73 @@ esp_err_t webserver_ota_handler(httpd_req_t *req)
 
             body += "url is only used temporarely and not persisted in flash";
         }
+
+        {
+            HtmlTag h2Tag{"h2", body};
+            body += "ESP-NOW distribution";
+        }
+
+        {
+            HtmlTag tableTag{"table", "border=\"1\"", body};
+
+            const auto sender = espnow::ota::senderStatus();
+            {
+                HtmlTag trTag{"tr", body};
+                { HtmlTag tdTag{"td", body}; body += "Serving"; }
+                {
+                    HtmlTag tdTag{"td", body};
+                    if (sender.serving)
+                        fmt::format_to(std::back_inserter(body), "{} image ({} bytes) to {}{}, requests={} chunks sent={} deduplicated={} <a href=\"/stopP2pOta\">Stop</a>",
+                                       espnow::ota::toString(sender.source), sender.imageSize,
+                                       wifi_stack::toString(wifi_stack::mac_t{sender.destination.data()}),
+                                       sender.multicast ? " (multicast)" : "",
+                                       sender.requests, sender.chunksSent, sender.chunksDeduplicated);
+                    else
+                        body += "no";
+                }
+            }
+
+            const auto receiver = espnow::ota::receiverStatus();
+            {
+                HtmlTag trTag{"tr", body};
+                { HtmlTag tdTag{"td", body}; body += "Receiving"; }
+                {
+                    HtmlTag tdTag{"td", body};
+                    body += esphttpdutils::htmlentities(espnow::ota::toString(receiver.state));
+                    if (!configs.otaP2pAccept.value)
+                        body += " (otaP2pAccept is off)";
+                    if (receiver.state != espnow::ota::ReceiverState::Idle)
+                        body += esphttpdutils::htmlentities(fmt::format(" {} from {}: {} / {} ({:.02f}%) requests={} hash failures={} resumes={} {}",
+                                                                        receiver.version.data(),
+                                                                        wifi_stack::toString(wifi_stack::mac_t{receiver.sender.data()}),
+                                                                        receiver.written, receiver.imageSize,
+                                                                        receiver.imageSize ? float(receiver.written) / receiver.imageSize * 100 : 0.f,
+                                                                        receiver.requests, receiver.hashFailures, receiver.resumes, receiver.message));
+                }
+            }
+        }
+
+        {
+            HtmlTag formTag{"form", "action=\"/startP2pOta\" method=\"GET\"", body};
+            HtmlTag fieldsetTag{"fieldset", body};
+            {
+                HtmlTag legendTag{"legend", body};
+                body += "Serve image over ESP-NOW";
+            }
+
+            body += "<select name=\"source\">"
+                    "<option value=\"running\">running</option>"
+                    "<option value=\"staged\">staged</option>"
+                    "</select>";
+            body += "<input type=\"text\" name=\"mac\" placeholder=\"peer mac, empty for all\" />";
+
+            {
+                HtmlTag buttonTag{"button", "type=\"submit\"", body};
+                body += "Start";
+            }
+
+            body += "receivers need otaP2pAccept and this node in their peer list";
+        }
     }
 
     CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::Ok, "text/html", body)
@@ -326,6 +488,9 @@ typename std::enable_if<
     !std::is_same_v<T, wifi_stack::mac_t> &&
     !std::is_same_v<T, std::optional<wifi_stack::mac_t>> &&
     !std::is_same_v<T, wifi_auth_mode_t> &&
+    !std::is_same_v<T, wifi_phy_rate_t> &&
+    !std::is_same_v<T, espnow::output::Mode> &&
+    !std::is_same_v<T, espnow::filter::MacMode> &&
     !std::is_same_v<T, sntp_sync_mode_t> &&
     !std::is_same_v<T, espchrono::DayLightSavingMode>
 , void>::type
@@ -341,11 +506,11 @@ typename std::enable_if<
 , void>::type
 showInputForSetting(std::string_view key, T value, std::string &body)
 {
-    body += fmt::format("<input type=\"checkbox\" name=\"{}\" value=\"true\" {}/>"
-                        "<input type=\"hidden\" name=\"{}\" value=\"false\" />",
-                        esphttpdutils::htmlentities(key),
-                        value ? "checked " : "",
-                        esphttpdutils::htmlentities(key));
+    fmt::format_to(std::back_inserter(body), "<input type=\"checkbox\" name=\"{}\" value=\"true\" {}/>"
+                   "<input type=\"hidden\" name=\"{}\" value=\"false\" />",
+                   esphttpdutils::htmlentities(key),
+                   value ? "checked " : "",
+                   esphttpdutils::htmlentities(key));
 }
 
 template<typename T>
@@ -355,11 +520,11 @@ typename std::enable_if<
 , void>::type
 showInputForSetting(std::string_view key, T value, std::string &body)
 {
-    body += fmt::format("<input type=\"number\" name=\"{}\" value=\"{}\" min=\"{}\" max=\"{}\" step=\"1\" />",
-                        esphttpdutils::htmlentities(key),
-                        value,
-                        std::numeric_limits<T>::min(),
-                        std::numeric_limits<T>::max());
+    fmt::format_to(std::back_inserter(body), "<input type=\"number\" name=\"{}\" value=\"{}\" min=\"{}\" max=\"{}\" step=\"1\" />",
+                   esphttpdutils::htmlentities(key),
+                   value,
+                   std::numeric_limits<T>::min(),
+                   std::numeric_limits<T>::max());
 }
 
 template<typename T>
@@ -368,9 +533,9 @@ typename std::enable_if<
 , void>::type
 showInputForSetting(std::string_view key, T value, std::string &body)
 {
-    body += fmt::format("<input type=\"number\" name=\"{}\" value=\"{}\" step=\"1\" />",
-                        esphttpdutils::htmlentities(key),
-                        value.count());
+    fmt::format_to(std::back_inserter(body), "<input type=\"number\" name=\"{}\" value=\"{}\" step=\"1\" />",
+                   esphttpdutils::htmlentities(key),
+                   value.count());
 }
 
 template<typename T>
@@ -379,9 +544,9 @@ typename std::enable_if<
 , void>::type
 showInputForSetting(std::string_view key, T value, std::string &body)
 {
-    body += fmt::format("<input type=\"text\" name=\"{}\" value=\"{}\" />",
-                        esphttpdutils::htmlentities(key),
-                        esphttpdutils::htmlentities(value));
+    fmt::format_to(std::back_inserter(body), "<input type=\"text\" name=\"{}\" value=\"{}\" />",
+                   esphttpdutils::htmlentities(key),
+                   esphttpdutils::htmlentities(value));
 }
 
 template<typename T>
@@ -390,9 +555,9 @@ typename std::enable_if<
 , void>::type
 showInputForSetting(std::string_view key, T value, std::string &body)
 {
-    body += fmt::format("<input type=\"text\" name=\"{}\" value=\"{}\" pattern=\"[0-9]+\\.[0-9]+\\.[0-9]+\\.[0-9]+\" />",
-                        esphttpdutils::htmlentities(key),
-                        esphttpdutils::htmlentities(wifi_stack::toString(value)));
+    fmt::format_to(std::back_inserter(body), "<input type=\"text\" name=\"{}\" value=\"{}\" pattern=\"[0-9]+\\.[0-9]+\\.[0-9]+\\.[0-9]+\" />",
+                   esphttpdutils::htmlentities(key),
+                   esphttpdutils::htmlentities(wifi_stack::toString(value)));
 }
 
 template<typename T>
@@ -401,9 +566,9 @@ typename std::enable_if<
 , void>::type
 showInputForSetting(std::string_view key, T value, std::string &body)
 {
-    body += fmt::format("<input type=\"text\" name=\"{}\" value=\"{}\" pattern=\"[0-9a-fA-F]{{2}}(?:\\:[0-9a-fA-F]{{2}}){{5}}\" />",
-                        esphttpdutils::htmlentities(key),
-                        esphttpdutils::htmlentities(wifi_stack::toString(value)));
+    fmt::format_to(std::back_inserter(body), "<input type=\"text\" name=\"{}\" value=\"{}\" pattern=\"[0-9a-fA-F]{{2}}(?:\\:[0-9a-fA-F]{{2}}){{5}}\" />",
+                   esphttpdutils::htmlentities(key),
+                   esphttpdutils::htmlentities(wifi_stack::toString(value)));
 }
 
 template<typename T>
@@ -412,9 +577,9 @@ typename std::enable_if<
 , void>::type
 showInputForSetting(std::string_view key, T value, std::string &body)
 {
-    body += fmt::format("<input type=\"text\" name=\"{}\" value=\"{}\" pattern=\"(?:[0-9a-fA-F]{{2}}(?:\\:[0-9a-fA-F]{{2}}){{5}})?\" /> ?",
-                        esphttpdutils::htmlentities(key),
-                        value ? esphttpdutils::htmlentities(wifi_stack::toString(*value)) : std::string{});
+    fmt::format_to(std::back_inserter(body), "<input type=\"text\" name=\"{}\" value=\"{}\" pattern=\"(?:[0-9a-fA-F]{{2}}(?:\\:[0-9a-fA-F]{{2}}){{5}})?\" /> ?",
+                   esphttpdutils::htmlentities(key),
+                   value ? esphttpdutils::htmlentities(wifi_stack::toString(*value)) : std::string{});
 }
 
 template<typename T>
@@ -443,6 +608,49 @@ showInputForSetting(std::string_view key, T value, std::string &body)
 #undef HANDLE_ENUM_KEY
 }
 
+template<typename T>
+typename std::enable_if<
+    std::is_same_v<T, wifi_phy_rate_t>
+, void>::type
+showInputForSetting(std::string_view key, T value, std::string &body)
+{
+    HtmlTag select{"select", fmt::format("name=\"{}\"", esphttpdutils::htmlentities(key)), body};
+
+    for (const auto &phyRate : espnow::phyRates)
+    {
+        HtmlTag option{"option", fmt::format("value=\"{}\"{}", std::to_underlying(phyRate.rate), value == phyRate.rate ? " selected" : ""), body};
+        body += esphttpdutils::htmlentities(phyRate.name);
+    }
+}
+
+template<typename T>
+typename std::enable_if<
+    std::is_same_v<T, espnow::output::Mode>
+, void>::type
+showInputForSetting(std::string_view key, T value, std::string &body)
+{
+    HtmlTag select{"select", fmt::format("name=\"{}\"", esphttpdutils::htmlentities(key)), body};
+
+    espnow::output::iterateModes([&](T enumVal, std::string_view enumKey){
+        HtmlTag option{"option", fmt::format("value=\"{}\"{}", std::to_underlying(enumVal), value == enumVal ? " selected" : ""), body};
+        body += esphttpdutils::htmlentities(enumKey);
+    });
+}
+
+template<typename T>
+typename std::enable_if<
+    std::is_same_v<T, espnow::filter::MacMode>
+, void>::type
+showInputForSetting(std::string_view key, T value, std::string &body)
+{
+    HtmlTag select{"select", fmt::format("name=\"{}\"", esphttpdutils::htmlentities(key)), body};
+
+    espnow::filter::iterateMacModes([&](T enumVal, std::string_view enumKey){
+        HtmlTag option{"option", fmt::format("value=\"{}\"{}", std::to_underlying(enumVal), value == enumVal ? " selected" : ""), body};
+        body += esphttpdutils::htmlentities(enumKey);
+    });
+}
+
 template<typename T>
 typename std::enable_if<
     std::is_same_v<T, sntp_sync_mode_t>
@@ -475,9 +683,55 @@ showInputForSetting(std::string_view key, T value, std::string &body)
     });
 }
 
+esp_err_t webserver_startP2pOta_handler(httpd_req_t *req)
+{
+    std::string query;
+    if (auto result = esphttpdutils::webserver_get_query(req))
+        query = *result;
+    else
+    {
+        ESP_LOGE(TAG, "%.*s", result.error().size(), result.error().data());
+        CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", result.error());
+    }
+
+    espnow::ota::Source source;
+    if (const auto value = webserver_get_query_param(query, "source"); value && *value == "staged")
+        source = espnow::ota::Source::Staged;
+    else if (!value || *value == "running")
+        source = espnow::ota::Source::Running;
+    else
+        CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", fmt::format("unknown source {}", *value));
+
+    wifi_stack::mac_t destination{broadcastAddress};
+    if (const auto value = webserver_get_query_param(query, "mac"); value && !value->empty())
+    {
+        const auto parsed = wifi_stack::fromString<wifi_stack::mac_t>(*value);
+        if (!parsed)
+            CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", parsed.error());
+        destination = *parsed;
+    }
+
+    if (const auto result = espnow::ota::startServing(source, destination.data()); !result)
+    {
+        ESP_LOGW(TAG, "%.*s", result.error().size(), result.error().data());
+        CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", result.error());
+    }
+
+    CALL_AND_EXIT_ON_ERROR(httpd_resp_set_hdr, req, "Location", "/ota")
+    CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::TemporaryRedirect, "text/html", "Ok, continue at <a href=\"/ota\">/ota</a>")
+}
+
+esp_err_t webserver_stopP2pOta_handler(httpd_req_t *req)
+{
+    espnow::ota::stopServing();
+
+    CALL_AND_EXIT_ON_ERROR(httpd_resp_set_hdr, req, "Location", "/ota")
+    CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::TemporaryRedirect, "text/html", "Ok, continue at <a href=\"/ota\">/ota</a>")
+}
+
 esp_err_t webserver_settings_handler(httpd_req_t *req)
 {
-    std::string body;
+    auto &body = takeResponseBody();
 
     {
         HtmlTag htmlTag{"html", body};
@@ -520,7 +774,14 @@ esp_err_t webserver_settings_handler(httpd_req_t *req)
             {
                 HtmlTag pTag{"p", body};
                 body += "<b>Settings</b> - "
-                        "<a href=\"/ota\">Update</a>";
+                        "<a href=\"/ota\">Update</a> - "
+                        "<a href=\"/tester\">Tester</a>";
+            }
+
+            if (rebootRequired)
+            {
+                HtmlTag pTag{"p", body};
+                body += "Changed cores or priorities only apply after a <a href=\"/reboot\">reboot</a>";
             }
 
             HtmlTag divTag{"div", "class=\"form-table\"", body};
@@ -602,6 +863,9 @@ typename std::enable_if<
     !std::is_same_v<T, wifi_stack::mac_t> &&
     !std::is_same_v<T, std::optional<wifi_stack::mac_t>> &&
     !std::is_same_v<T, wifi_auth_mode_t> &&
+    !std::is_same_v<T, wifi_phy_rate_t> &&
+    !std::is_same_v<T, espnow::output::Mode> &&
+    !std::is_same_v<T, espnow::filter::MacMode> &&
     !std::is_same_v<T, sntp_sync_mode_t> &&
     !std::is_same_v<T, espchrono::DayLightSavingMode>
 , tl::expected<void, std::string>>::type
@@ -617,7 +881,7 @@ typename std::enable_if<
 saveSetting(ConfigWrapper<T> &config, std::string_view newValue)
 {
     if (cpputils::is_in(newValue, "true", "false"))
-        return configs.write_config(config, newValue == "true");
+        return writeConfig(config, newValue == "true");
     else
         return tl::make_unexpected(fmt::format("only true and false allowed, not {}", newValue));
 }
@@ -630,7 +894,7 @@ typename std::enable_if<
 saveSetting(ConfigWrapper<T> &config, std::string_view newValue)
 {
     if (auto parsed = cpputils::fromString<T>(newValue))
-        return configs.write_config(config, *parsed);
+        return writeConfig(config, *parsed);
     else
         return tl::make_unexpected(fmt::format("could not parse {}", newValue));
 }
@@ -641,7 +905,7 @@ typename std::enable_if<
 , tl::expected<void, std::string>>::type
 saveSetting(ConfigWrapper<T> &config, std::string_view newValue)
 {
-    return configs.write_config(config, std::string{newValue});
+    return writeConfig(config, std::string{newValue});
 }
 
 template<typename T>
@@ -651,7 +915,7 @@ typename std::enable_if<
 saveSetting(ConfigWrapper<T> &config, std::string_view newValue)
 {
     if (const auto parsed = wifi_stack::fromString<wifi_stack::ip_address_t>(newValue); parsed)
-        return configs.write_config(config, *parsed);
+        return writeConfig(config, *parsed);
     else
         return tl::make_unexpected(parsed.error());
 }
@@ -663,7 +927,7 @@ typename std::enable_if<
 saveSetting(ConfigWrapper<T> &config, std::string_view newValue)
 {
     if (const auto parsed = wifi_stack::fromString<wifi_stack::mac_t>(newValue); parsed)
-        return configs.write_config(config, *parsed);
+        return writeConfig(config, *parsed);
     else
         return tl::make_unexpected(parsed.error());
 }
@@ -675,9 +939,9 @@ typename std::enable_if<
 saveSetting(ConfigWrapper<T> &config, std::string_view newValue)
 {
     if (newValue.empty())
-        return configs.write_config(config, std::nullopt);
+        return writeConfig(config, std::nullopt);
     else if (const auto parsed = wifi_stack::fromString<wifi_stack::mac_t>(newValue); parsed)
-        return configs.write_config(config, *parsed);
+        return writeConfig(config, *parsed);
     else
         return tl::make_unexpected(parsed.error());
 }
@@ -685,13 +949,16 @@ saveSetting(ConfigWrapper<T> &config, std::string_view newValue)
 template<typename T>
 typename std::enable_if<
     std::is_same_v<T, wifi_auth_mode_t> ||
+    std::is_same_v<T, wifi_phy_rate_t> ||
+    std::is_same_v<T, espnow::output::Mode> ||
+    std::is_same_v<T, espnow::filter::MacMode> ||
     std::is_same_v<T, sntp_sync_mode_t> ||
     std::is_same_v<T, espchrono::DayLightSavingMode>
 , tl::expected<void, std::string>>::type
 saveSetting(ConfigWrapper<T> &config, std::string_view newValue)
 {
     if (auto parsed = cpputils::fromString<std::underlying_type_t<T>>(newValue))
-        return configs.write_config(config, T(*parsed));
+        return writeConfig(config, T(*parsed));
     else
         return tl::make_unexpected(fmt::format("could not parse {}", newValue));
 }
@@ -707,9 +974,12 @@ esp_err_t webserver_saveSettings_handler(httpd_req_t *req)
         CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", result.error());
     }
 
-    std::string body;
+    auto &body = takeResponseBody();
     bool success{true};
 
+    // subscribers recompute their state once for the whole form
+    ConfigChangeBatch batch;
+
     configs.callForEveryConfig([&](auto &config){
         const std::string_view nvsName{config.nvsName()};
 
@@ -731,10 +1001,10 @@ esp_err_t webserver_saveSettings_handler(httpd_req_t *req)
         esphttpdutils::urldecode(valueBuf, valueBufEncoded);
 
         if (const auto result = saveSetting(config, valueBuf); result)
-            body += fmt::format("{} succeeded!\n", esphttpdutils::htmlentities(nvsName));
+            fmt::format_to(std::back_inserter(body), "{} succeeded!\n", esphttpdutils::htmlentities(nvsName));
         else
         {
-            body += fmt::format("{} failed: {}\n", esphttpdutils::htmlentities(nvsName), esphttpdutils::htmlentities(result.error()));
+            fmt::format_to(std::back_inserter(body), "{} failed: {}\n", esphttpdutils::htmlentities(nvsName), esphttpdutils::htmlentities(result.error()));
             success = false;
         }
 
@@ -768,9 +1038,12 @@ esp_err_t webserver_resetSettings_handler(httpd_req_t *req)
         CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", result.error());
     }
 
-    std::string body;
+    auto &body = takeResponseBody();
     bool success{true};
 
+    // subscribers recompute their state once for the whole form
+    ConfigChangeBatch batch;
+
     configs.callForEveryConfig([&](auto &config){
         const std::string_view nvsName{config.nvsName()};
 
@@ -791,7 +1064,7 @@ esp_err_t webserver_resetSettings_handler(httpd_req_t *req)
         body += nvsName;
         body += ' ';
 
-        if (const auto result = configs.reset_config(config); result)
+        if (const auto result = resetConfig(config); result)
             body += "reset successful";
         else
         {
@@ -819,4 +1092,931 @@ esp_err_t webserver_resetSettings_handler(httpd_req_t *req)
                   "text/plain",
                   body)
 }
+
+esp_err_t webserver_tester_handler(httpd_req_t *req)
+{
+    auto &body = takeResponseBody();
+
+    HtmlTag htmlTag{"html", body};
+
+    {
+        HtmlTag headTag{"head", body};
+
+        {
+            HtmlTag titleTag{"title", body};
+            body += "Tester";
+        }
+
+        body += "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1, shrink-to-fit=no\" />";
+    }
+
+    {
+        HtmlTag bodyTag{"body", body};
+
+        {
+            HtmlTag h1Tag{"h1", body};
+            body += "Tester";
+        }
+
+        {
+            HtmlTag pTag{"p", body};
+            body += "<a href=\"/\">Settings</a> - "
+                    "<a href=\"/ota\">Update</a> - "
+                    "<b>Tester</b>";
+        }
+
+        const auto mode = tester::mode();
+
+        {
+            HtmlTag pTag{"p", body};
+            fmt::format_to(std::back_inserter(body), "Status: <b>{}</b>", esphttpdutils::htmlentities(tester::toString(mode)));
+            if (mode != tester::Mode::Idle)
+                body += " <a href=\"/abortTester\">Abort</a>";
+        }
+
+        {
+            HtmlTag pTag{"p", body};
+            if (const auto info = resultstore::info(); info.available)
+                fmt::format_to(std::back_inserter(body), "Stored results: {} of {} "
+                               "(<a href=\"/results\">CSV</a> - <a href=\"/results?format=json\">JSON</a> - <a href=\"/clearResults\">Clear</a>)",
+                               info.nextSequence - info.oldestSequence, info.capacity);
+            else
+                body += "Results are not stored, the partition table has no results partition.";
+        }
+
+        {
+            HtmlTag formTag{"form", "action=\"/startTester\" method=\"GET\"", body};
+            HtmlTag fieldsetTag{"fieldset", body};
+            {
+                HtmlTag legendTag{"legend", body};
+                body += "Start benchmark";
+            }
+
+            const auto &params = tester::params();
+
+            fmt::format_to(std::back_inserter(body), "<label>destination <input type=\"text\" name=\"mac\" value=\"{}\" pattern=\"[0-9a-fA-F]{{2}}(?:\\:[0-9a-fA-F]{{2}}){{5}}\" /></label> "
+                           "<label>frames/s <input type=\"number\" name=\"rate\" value=\"{}\" min=\"0\" step=\"1\" /></label> "
+                           "<label>duration ms <input type=\"number\" name=\"duration\" value=\"{}\" min=\"1\" step=\"1\" /></label> "
+                           "<label>payload bytes <input type=\"number\" name=\"size\" value=\"{}\" min=\"1\" max=\"{}\" step=\"1\" /></label> ",
+                           esphttpdutils::htmlentities(wifi_stack::toString(params.destination)),
+                           params.rate,
+                           params.durationMs ? params.durationMs : 5000,
+                           params.payloadSize ? params.payloadSize : 200,
+                           espnow::MaxFramePayload);
+            fmt::format_to(std::back_inserter(body), "<label>virtual nodes <input type=\"number\" name=\"nodes\" value=\"{}\" min=\"1\" max=\"{}\" step=\"1\" /></label> ",
+                           params.virtualNodes ? params.virtualNodes : 8,
+                           tester::MaxVirtualNodes);
+
+            {
+                HtmlTag label{"label", body};
+                body += "pattern ";
+                HtmlTag select{"select", "name=\"pattern\"", body};
+                for (const auto pattern : {tester::Pattern::Mixed, tester::Pattern::Constant, tester::Pattern::Poisson, tester::Pattern::Bursty})
+                    fmt::format_to(std::back_inserter(body), "<option value=\"{}\"{}>{}</option>", tester::toString(pattern),
+                                   params.virtualNodes && pattern == params.pattern ? " selected" : "", tester::toString(pattern));
+            }
+            body += ' ';
+
+            {
+                HtmlTag select{"select", "name=\"mode\"", body};
+                body += "<option value=\"flood\">Flood</option>"
+                        "<option value=\"encryption\">Encryption overhead (plaintext vs encrypted)</option>"
+                        "<option value=\"ratesweep\">Rate sweep (one flood per phy rate)</option>"
+                        "<option value=\"qos\">QoS probe (ping rtt under a queued flood, control vs bulk)</option>"
+                        "<option value=\"loadgen\">Load generator (virtual nodes and pattern, frames/s per node)</option>";
+            }
+
+            {
+                HtmlTag buttonTag{"button", "type=\"submit\"", body};
+                body += "Go";
+            }
+        }
+
+        if (mode == tester::Mode::Idle)
+        {
+            const auto &results = tester::results();
+
+            HtmlTag tableTag{"table", "border=\"1\"", body};
+
+            {
+                HtmlTag trTag{"tr", body};
+                for (const char *column : {"Run", "Sent", "Send errors", "Success", "Fail", "Loss", "Throughput", "Avg latency", "Max latency", "Ack RSSI", "Ping RTT"})
+                {
+                    HtmlTag thTag{"th", body};
+                    body += column;
+                }
+            }
+
+            for (size_t i = 0; i < results.count; i++)
+            {
+                const auto &result = results.entries[i];
+                HtmlTag trTag{"tr", body};
+                { HtmlTag tdTag{"td", body}; body += esphttpdutils::htmlentities(result.label); }
+                { HtmlTag tdTag{"td", body}; body += std::to_string(result.sent); }
+                { HtmlTag tdTag{"td", body}; body += std::to_string(result.sendErrors); }
+                { HtmlTag tdTag{"td", body}; body += std::to_string(result.success); }
+                { HtmlTag tdTag{"td", body}; body += std::to_string(result.fail); }
+                { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{:.2f}%", result.lossPercent()); }
+                { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{:.1f} kbit/s", result.throughputKbps()); }
+                { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{}us", result.avgLatencyUs); }
+                { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{}us", result.maxLatencyUs); }
+                { HtmlTag tdTag{"td", body}; body += result.ackRssi ? fmt::format("{}dBm", *result.ackRssi) : "-"; }
+                {
+                    HtmlTag tdTag{"td", body};
+                    body += result.probeSent ?
+                        fmt::format("{}/{} avg={}us max={}us", result.probeReceived, result.probeSent, result.probeAvgRttUs, result.probeMaxRttUs) :
+                        "-";
+                }
+            }
+        }
+
+        {
+            HtmlTag h2Tag{"h2", body};
+            body += "Received";
+        }
+
+        {
+            HtmlTag pTag{"p", body};
+            body += configs.espnowRssiCapture.value ?
+                "RSSI capture is enabled." :
+                "RSSI capture is disabled, enable espnowRssiCapture for the RSSI columns.";
+            body += " <a href=\"/resetRxStats\">Reset</a>";
+        }
+
+        {
+            HtmlTag pTag{"p", body};
+            const auto &stats = espnow::output::stats;
+            fmt::format_to(std::back_inserter(body), "UART output ({}): queued {}, written {}, dropped {}",
+                           esphttpdutils::htmlentities(espnow::output::toString(configs.espnowOutputMode.value)),
+                           stats.queued.load(), stats.written.load(), stats.dropped.load());
+        }
+
+        {
+            HtmlTag pTag{"p", body};
+            fmt::format_to(std::back_inserter(body), "UART bridge ({}): {} bytes read, {} frames sent, {} dropped, {} uart overflows",
+                           bridgeModeActive() ? "active" : "inactive",
+                           bridgeStats.uartBytes.load(), bridgeStats.frames.load(),
+                           bridgeStats.dropped.load(), bridgeStats.overflows.load());
+        }
+
+        {
+            HtmlTag tableTag{"table", "border=\"1\"", body};
+
+            {
+                HtmlTag trTag{"tr", body};
+                for (const char *column : {"MAC", "Frames", "Lost", "Loss", "Avg RSSI", "Min RSSI", "Max RSSI", "Noise floor"})
+                {
+                    HtmlTag thTag{"th", body};
+                    body += column;
+                }
+            }
+
+            for (size_t i = 0; i < espnow::peerRxStatsCount; i++)
+            {
+                const auto &stats = espnow::peerRxStats[i];
+                HtmlTag trTag{"tr", body};
+                {
+                    HtmlTag tdTag{"td", body};
+                    body += esphttpdutils::htmlentities(wifi_stack::toString(wifi_stack::mac_t{stats.mac.data()}));
+                    if (stats.virtualNode)
+                        fmt::format_to(std::back_inserter(body), " node {}", stats.virtualNode);
+                }
+                { HtmlTag tdTag{"td", body}; body += std::to_string(stats.frames); }
+                { HtmlTag tdTag{"td", body}; body += std::to_string(stats.lost); }
+                { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{:.2f}%", stats.lossPercent()); }
+                if (const auto avgRssi = stats.avgRssi())
+                {
+                    { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{:.1f}dBm", *avgRssi); }
+                    { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{}dBm", stats.rssiMin); }
+                    { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{}dBm", stats.rssiMax); }
+                    { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{}dBm", stats.noiseFloor); }
+                }
+                else
+                    for (int j = 0; j < 4; j++)
+                    {
+                        HtmlTag tdTag{"td", body};
+                        body += "-";
+                    }
+            }
+        }
+
+        if (configs.espnowRssiCapture.value)
+        {
+            HtmlTag tableTag{"table", "border=\"1\"", body};
+
+            {
+                HtmlTag trTag{"tr", body};
+                for (const char *column : {"RSSI", "Frames", "Lost", "Loss"})
+                {
+                    HtmlTag thTag{"th", body};
+                    body += column;
+                }
+            }
+
+            for (const auto &bucket : espnow::rssiBuckets)
+            {
+                HtmlTag trTag{"tr", body};
+                { HtmlTag tdTag{"td", body}; body += bucket.rssiMin == INT8_MIN ? "lower" : fmt::format("&gt;= {}dBm", bucket.rssiMin); }
+                { HtmlTag tdTag{"td", body}; body += std::to_string(bucket.frames); }
+                { HtmlTag tdTag{"td", body}; body += std::to_string(bucket.lost); }
+                { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{:.2f}%", bucket.frames + bucket.lost ? float(bucket.lost) / (bucket.frames + bucket.lost) * 100 : 0.f); }
+            }
+        }
+
+        if (configs.espnowRssiCapture.value)
+        {
+            HtmlTag tableTag{"table", "border=\"1\"", body};
+
+            {
+                HtmlTag trTag{"tr", body};
+                for (const char *column : {"Rate", "Frames", "Avg RSSI"})
+                {
+                    HtmlTag thTag{"th", body};
+                    body += column;
+                }
+            }
+
+            for (uint8_t rate = 0; rate < espnow::rateRxStats.size(); rate++)
+            {
+                const auto &stats = espnow::rateRxStats[rate];
+                if (!stats.frames)
+                    continue;
+
+                HtmlTag trTag{"tr", body};
+                { HtmlTag tdTag{"td", body}; body += esphttpdutils::htmlentities(espnow::sniffer::rateName(rate)); }
+                { HtmlTag tdTag{"td", body}; body += std::to_string(stats.frames); }
+                { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{:.1f}dBm", float(stats.rssiSum) / stats.frames); }
+            }
+        }
+
+        {
+            HtmlTag h2Tag{"h2", body};
+            body += "Latency breakdown";
+        }
+
+        {
+            HtmlTag pTag{"p", body};
+            if (configs.espnowTraceEvery.value)
+                fmt::format_to(std::back_inserter(body), "Every {}. sent and received frame is traced.", configs.espnowTraceEvery.value);
+            else
+                body += "Tracing is disabled, set espnowTraceEvery.";
+            body += " <a href=\"/traces\">Recent traces</a>";
+        }
+
+        {
+            HtmlTag tableTag{"table", "border=\"1\"", body};
+
+            {
+                HtmlTag trTag{"tr", body};
+                for (const char *column : {"Stage", "Samples", "Avg", "Max"})
+                {
+                    HtmlTag thTag{"th", body};
+                    body += column;
+                }
+            }
+
+            const auto stats = espnow::trace::breakdown();
+            for (size_t i = 0; i < stats.size(); i++)
+            {
+                HtmlTag trTag{"tr", body};
+                { HtmlTag tdTag{"td", body}; body += esphttpdutils::htmlentities(espnow::trace::stages[i].name); }
+                { HtmlTag tdTag{"td", body}; body += std::to_string(stats[i].samples); }
+                { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{}us", stats[i].avgUs); }
+                { HtmlTag tdTag{"td", body}; fmt::format_to(std::back_inserter(body), "{}us", stats[i].maxUs); }
+            }
+        }
+
+        {
+            HtmlTag h2Tag{"h2", body};
+            body += "Peers";
+        }
+
+        {
+            HtmlTag tableTag{"table", "border=\"1\"", body};
+
+            {
+                HtmlTag trTag{"tr", body};
+                for (const char *column : {"Slot", "MAC", "Encrypt", "Status"})
+                {
+                    HtmlTag thTag{"th", body};
+                    body += column;
+                }
+            }
+
+            for (size_t i = 0; i < espnow::peerStatus.size(); i++)
+            {
+                const auto &peerConfig = configs.espnow_peers[i];
+                if (!peerConfig.mac.value)
+                    continue;
+
+                HtmlTag trTag{"tr", body};
+                { HtmlTag tdTag{"td", body}; body += std::to_string(i); }
+                { HtmlTag tdTag{"td", body}; body += esphttpdutils::htmlentities(wifi_stack::toString(*peerConfig.mac.value)); }
+                { HtmlTag tdTag{"td", body}; body += peerConfig.encrypt.value ? "yes" : "no"; }
+                { HtmlTag tdTag{"td", body}; body += esphttpdutils::htmlentities(espnow::toString(espnow::peerStatus[i])); }
+            }
+        }
+
+        {
+            HtmlTag pTag{"p", body};
+            fmt::format_to(std::back_inserter(body), "Encrypted peers are limited to {} of {} driver peer slots.", ESP_NOW_MAX_ENCRYPT_PEER_NUM, ESP_NOW_MAX_TOTAL_PEER_NUM);
+        }
+    }
+
+    CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::Ok, "text/html", body)
+}
+
+esp_err_t webserver_startTester_handler(httpd_req_t *req)
+{
+    std::string query;
+    if (auto result = esphttpdutils::webserver_get_query(req))
+        query = *result;
+    else
+    {
+        ESP_LOGE(TAG, "%.*s", result.error().size(), result.error().data());
+        CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", result.error());
+    }
+
+    tester::FloodParams params;
+    std::string mode;
+
+    {
+        const auto parsed = webserver_get_query_param(query, "mac").and_then([](const std::string &value) -> tl::expected<wifi_stack::mac_t, std::string> {
+            return wifi_stack::fromString<wifi_stack::mac_t>(value);
+        });
+        if (!parsed)
+            CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", parsed.error());
+        params.destination = *parsed;
+    }
+
+    for (const auto &[name, target] : {
+        std::pair<const char *, uint32_t *>{"rate", &params.rate},
+        std::pair<const char *, uint32_t *>{"duration", &params.durationMs},
+    })
+    {
+        const auto value = webserver_get_query_param(query, name);
+        if (!value)
+            CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", value.error());
+
+        const auto parsed = cpputils::fromString<uint32_t>(*value);
+        if (!parsed)
+            CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", fmt::format("could not parse {} {}", name, *value));
+        *target = *parsed;
+    }
+
+    {
+        const auto value = webserver_get_query_param(query, "size");
+        if (!value)
+            CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", value.error());
+
+        const auto parsed = cpputils::fromString<uint8_t>(*value);
+        if (!parsed)
+            CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", fmt::format("could not parse size {}", *value));
+        params.payloadSize = *parsed;
+    }
+
+    if (auto value = webserver_get_query_param(query, "mode"))
+        mode = std::move(*value);
+    else
+        CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", value.error());
+
+    if (mode == "loadgen")
+    {
+        const auto nodes = webserver_get_query_param(query, "nodes");
+        if (!nodes)
+            CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", nodes.error());
+
+        const auto parsedNodes = cpputils::fromString<uint8_t>(*nodes);
+        if (!parsedNodes)
+            CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", fmt::format("could not parse nodes {}", *nodes));
+        params.virtualNodes = *parsedNodes;
+
+        const auto pattern = webserver_get_query_param(query, "pattern").and_then(tester::parsePattern);
+        if (!pattern)
+            CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", pattern.error());
+        params.pattern = *pattern;
+    }
+
+    tl::expected<void, std::string> result;
+    if (mode == "flood")
+        result = tester::startFlood(params);
+    else if (mode == "encryption")
+        result = tester::startEncryptionBenchmark(params);
+    else if (mode == "ratesweep")
+        result = tester::startRateSweep(params);
+    else if (mode == "qos")
+        result = tester::startQosProbe(params);
+    else if (mode == "loadgen")
+        result = tester::startLoadGen(params);
+    else
+        result = tl::make_unexpected(fmt::format("unknown mode {}", mode));
+
+    if (!result)
+    {
+        ESP_LOGW(TAG, "%.*s", result.error().size(), result.error().data());
+        CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", result.error());
+    }
+
+    CALL_AND_EXIT_ON_ERROR(httpd_resp_set_hdr, req, "Location", "/tester")
+    CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::TemporaryRedirect, "text/html", "Ok, continue at <a href=\"/tester\">/tester</a>")
+}
+
+esp_err_t webserver_abortTester_handler(httpd_req_t *req)
+{
+    tester::abort();
+
+    CALL_AND_EXIT_ON_ERROR(httpd_resp_set_hdr, req, "Location", "/tester")
+    CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::TemporaryRedirect, "text/html", "Ok, continue at <a href=\"/tester\">/tester</a>")
+}
+
+esp_err_t webserver_resetRxStats_handler(httpd_req_t *req)
+{
+    espnow::resetRxStats();
+
+    CALL_AND_EXIT_ON_ERROR(httpd_resp_set_hdr, req, "Location", "/tester")
+    CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::TemporaryRedirect, "text/html", "Ok, continue at <a href=\"/tester\">/tester</a>")
+}
+
+esp_err_t webserver_metrics_handler(httpd_req_t *req)
+{
+    auto &body = takeResponseBody();
+
+    if (const auto sample = telemetry::latestHeapSample())
+    {
+        fmt::format_to(std::back_inserter(body), "# TYPE heap_free_bytes gauge\n"
+                       "heap_free_bytes{{caps=\"8bit\"}} {}\n"
+                       "heap_free_bytes{{caps=\"32bit\"}} {}\n"
+                       "# TYPE heap_largest_free_block_bytes gauge\n"
+                       "heap_largest_free_block_bytes{{caps=\"8bit\"}} {}\n"
+                       "# TYPE heap_min_free_bytes gauge\n"
+                       "heap_min_free_bytes{{caps=\"8bit\"}} {}\n",
+                       sample->free8, sample->free32, sample->largest8, sample->minFree8);
+    }
+
+    body += "# TYPE task_stack_high_water_bytes gauge\n";
+    {
+        const auto highWaterMarks = telemetry::stackHighWaterMarks();
+        for (size_t i = 0; i < freertosTaskNames.size(); i++)
+            if (highWaterMarks[i])
+                fmt::format_to(std::back_inserter(body), "task_stack_high_water_bytes{{task=\"{}\"}} {}\n", freertosTaskNames[i], *highWaterMarks[i]);
+    }
+
+    body += "# TYPE subsystem_heap_net_bytes gauge\n";
+    {
+        size_t index{};
+        for (const auto &task : schedulerTasks)
+        {
+            if (index >= telemetry::MaxSubsystems)
+                break;
+            const auto subsystem = telemetry::subsystemHeap(index++);
+            fmt::format_to(std::back_inserter(body), "subsystem_heap_net_bytes{{subsystem=\"{}\"}} {}\n", task.name(), subsystem.netBytes);
+        }
+    }
+
+    body += "# TYPE scheduler_task_allocations_total counter\n";
+    {
+        size_t index{};
+        for (const auto &task : schedulerTasks)
+        {
+            if (index >= telemetry::MaxSubsystems)
+                break;
+            fmt::format_to(std::back_inserter(body), "scheduler_task_allocations_total{{task=\"{}\"}} {}\n", task.name(), telemetry::schedulerAllocations(index++));
+        }
+    }
+
+    body += "# TYPE task_allocations_total counter\n";
+    for (size_t i = 0; i < freertosTaskNames.size(); i++)
+        fmt::format_to(std::back_inserter(body), "task_allocations_total{{task=\"{}\"}} {}\n", freertosTaskNames[i], telemetry::freertosTaskAllocations(i));
+
+    fmt::format_to(std::back_inserter(body), "# TYPE hot_path_allocations_total counter\n"
+                   "hot_path_allocations_total {}\n",
+                   telemetry::allocationStats.hotPathAllocations.load());
+
+    const auto &tx = espnow::txStats;
+    const auto &rx = espnow::rxStats;
+    fmt::format_to(std::back_inserter(body), "# TYPE espnow_tx_sent_total counter\n"
+                   "espnow_tx_sent_total {}\n"
+                   "# TYPE espnow_tx_errors_total counter\n"
+                   "espnow_tx_errors_total {}\n"
+                   "# TYPE espnow_tx_no_mem_total counter\n"
+                   "espnow_tx_no_mem_total {}\n"
+                   "# TYPE espnow_tx_unlogged_errors_total counter\n"
+                   "espnow_tx_unlogged_errors_total {}\n"
+                   "# TYPE espnow_tx_in_flight gauge\n"
+                   "espnow_tx_in_flight {}\n"
+                   "# TYPE espnow_tx_in_flight_limit gauge\n"
+                   "espnow_tx_in_flight_limit {}\n"
+                   "# TYPE espnow_tx_pace_decreases_total counter\n"
+                   "espnow_tx_pace_decreases_total {}\n"
+                   "# TYPE espnow_tx_queue_full_total counter\n"
+                   "espnow_tx_queue_full_total {}\n"
+                   "# TYPE espnow_tx_success_total counter\n"
+                   "espnow_tx_success_total {}\n"
+                   "# TYPE espnow_tx_fail_total counter\n"
+                   "espnow_tx_fail_total {}\n"
+                   "# TYPE espnow_rx_frames_total counter\n"
+                   "espnow_rx_frames_total {}\n"
+                   "# TYPE espnow_rx_bytes_total counter\n"
+                   "espnow_rx_bytes_total {}\n"
+                   "# TYPE espnow_rx_decode_errors_total counter\n"
+                   "espnow_rx_decode_errors_total {}\n"
+                   "# TYPE espnow_rx_filtered_total counter\n"
+                   "espnow_rx_filtered_total{{reason=\"mac\"}} {}\n"
+                   "espnow_rx_filtered_total{{reason=\"foreign\"}} {}\n"
+                   "espnow_rx_filtered_total{{reason=\"type\"}} {}\n",
+                   tx.sent.load(), tx.sendErrors.load(), tx.noMem.load(), tx.unloggedErrors.load(),
+                   espnow::inFlight(), espnow::inFlightLimit(), tx.paceDecreases.load(), tx.queueFull.load(), tx.success.load(), tx.fail.load(),
+                   rx.frames.load(), rx.bytes.load(), rx.decodeErrors.load(),
+                   espnow::filter::stats.rejectedMac.load(), espnow::filter::stats.rejectedForeign.load(), espnow::filter::stats.rejectedType.load());
+
+    {
+        const auto &control = espnow::txClassStats[size_t(espnow::TrafficClass::Control)];
+        const auto &bulk = espnow::txClassStats[size_t(espnow::TrafficClass::Bulk)];
+        fmt::format_to(std::back_inserter(body), "# TYPE espnow_tx_class_queued_total counter\n"
+                       "espnow_tx_class_queued_total{{class=\"control\"}} {}\n"
+                       "espnow_tx_class_queued_total{{class=\"bulk\"}} {}\n"
+                       "# TYPE espnow_tx_class_queue_full_total counter\n"
+                       "espnow_tx_class_queue_full_total{{class=\"control\"}} {}\n"
+                       "espnow_tx_class_queue_full_total{{class=\"bulk\"}} {}\n"
+                       "# TYPE espnow_tx_class_queue_length gauge\n"
+                       "espnow_tx_class_queue_length{{class=\"control\"}} {}\n"
+                       "espnow_tx_class_queue_length{{class=\"bulk\"}} {}\n"
+                       "# TYPE espnow_tx_class_wait_us_sum counter\n"
+                       "espnow_tx_class_wait_us_sum{{class=\"control\"}} {}\n"
+                       "espnow_tx_class_wait_us_sum{{class=\"bulk\"}} {}\n"
+                       "# TYPE espnow_tx_class_wait_us_max gauge\n"
+                       "espnow_tx_class_wait_us_max{{class=\"control\"}} {}\n"
+                       "espnow_tx_class_wait_us_max{{class=\"bulk\"}} {}\n",
+                       control.queued.load(), bulk.queued.load(), control.queueFull.load(), bulk.queueFull.load(),
+                       espnow::txQueueLength(espnow::TrafficClass::Control), espnow::txQueueLength(espnow::TrafficClass::Bulk),
+                       control.waitSumUs.load(), bulk.waitSumUs.load(), control.waitMaxUs.load(), bulk.waitMaxUs.load());
+    }
+
+    {
+        namespace trace = espnow::trace;
+
+        const auto stats = trace::breakdown();
+        body += "# TYPE espnow_trace_stage_samples_total counter\n";
+        for (size_t i = 0; i < stats.size(); i++)
+            fmt::format_to(std::back_inserter(body), "espnow_trace_stage_samples_total{{stage=\"{}\"}} {}\n", trace::stages[i].name, stats[i].samples);
+        body += "# TYPE espnow_trace_stage_avg_us gauge\n";
+        for (size_t i = 0; i < stats.size(); i++)
+            fmt::format_to(std::back_inserter(body), "espnow_trace_stage_avg_us{{stage=\"{}\"}} {}\n", trace::stages[i].name, stats[i].avgUs);
+        body += "# TYPE espnow_trace_stage_max_us gauge\n";
+        for (size_t i = 0; i < stats.size(); i++)
+            fmt::format_to(std::back_inserter(body), "espnow_trace_stage_max_us{{stage=\"{}\"}} {}\n", trace::stages[i].name, stats[i].maxUs);
+    }
+
+    if constexpr (espnow::cycles::Enabled)
+    {
+        namespace cycles = espnow::cycles;
+
+        fmt::format_to(std::back_inserter(body), "# TYPE espnow_cycles_per_1000_frames gauge\n"
+                       "espnow_cycles_per_1000_frames{{direction=\"tx\"}} {}\n"
+                       "espnow_cycles_per_1000_frames{{direction=\"rx\"}} {}\n",
+                       cycles::cyclesPer1000Sent(), cycles::cyclesPer1000Received());
+
+        constexpr const cycles::Path paths[] {cycles::Path::Receive, cycles::Path::SendCallback, cycles::Path::Send};
+
+        body += "# TYPE espnow_cycles_calls_total counter\n";
+        for (const auto path : paths)
+            fmt::format_to(std::back_inserter(body), "espnow_cycles_calls_total{{path=\"{}\"}} {}\n", cycles::toString(path), cycles::stats[size_t(path)].calls.load());
+
+        body += "# TYPE espnow_cycles_max gauge\n";
+        for (const auto path : paths)
+            fmt::format_to(std::back_inserter(body), "espnow_cycles_max{{path=\"{}\"}} {}\n", cycles::toString(path), cycles::stats[size_t(path)].maxCycles.load());
+
+        // cumulative like a prometheus histogram, there is no sum
+        body += "# TYPE espnow_cycles_bucket counter\n";
+        for (const auto path : paths)
+        {
+            const auto &stats = cycles::stats[size_t(path)];
+            const auto name = cycles::toString(path);
+            uint32_t cumulative{};
+            for (size_t i = 0; i < cycles::Buckets; i++)
+            {
+                cumulative += stats.histogram[i];
+                if (i < std::size(cycles::bucketLimits))
+                    fmt::format_to(std::back_inserter(body), "espnow_cycles_bucket{{path=\"{}\",le=\"{}\"}} {}\n", name, cycles::bucketLimits[i], cumulative);
+                else
+                    fmt::format_to(std::back_inserter(body), "espnow_cycles_bucket{{path=\"{}\",le=\"+Inf\"}} {}\n", name, cumulative);
+            }
+        }
+    }
+
+    if (const auto sync = espnow::timesync::status(); !sync.reference)
+        fmt::format_to(std::back_inserter(body), "# TYPE espnow_timesync_synced gauge\n"
+                       "espnow_timesync_synced {}\n"
+                       "# TYPE espnow_timesync_offset_us gauge\n"
+                       "espnow_timesync_offset_us {}\n"
+                       "# TYPE espnow_timesync_drift_ppb gauge\n"
+                       "espnow_timesync_drift_ppb {}\n"
+                       "# TYPE espnow_timesync_delay_us gauge\n"
+                       "espnow_timesync_delay_us {}\n"
+                       "# TYPE espnow_timesync_error_us gauge\n"
+                       "espnow_timesync_error_us {}\n"
+                       "# TYPE espnow_timesync_residual_us gauge\n"
+                       "espnow_timesync_residual_us {}\n"
+                       "# TYPE espnow_timesync_requests_total counter\n"
+                       "espnow_timesync_requests_total {}\n"
+                       "# TYPE espnow_timesync_responses_total counter\n"
+                       "espnow_timesync_responses_total {}\n"
+                       "# TYPE espnow_timesync_rejected_total counter\n"
+                       "espnow_timesync_rejected_total {}\n",
+                       sync.synced ? 1 : 0, sync.offsetUs, sync.driftPpb, sync.delayUs, sync.errorUs, sync.residualUs,
+                       sync.requests, sync.responses, sync.rejected);
+
+    {
+        const auto &relay = espnow::relay::stats;
+        const uint32_t received = relay.received;
+        const uint32_t timed = relay.timedFrames;
+        fmt::format_to(std::back_inserter(body), "# TYPE espnow_relay_originated_total counter\n"
+                       "espnow_relay_originated_total {}\n"
+                       "# TYPE espnow_relay_received_total counter\n"
+                       "espnow_relay_received_total {}\n"
+                       "# TYPE espnow_relay_duplicates_total counter\n"
+                       "espnow_relay_duplicates_total {}\n"
+                       "# TYPE espnow_relay_delivered_total counter\n"
+                       "espnow_relay_delivered_total {}\n"
+                       "# TYPE espnow_relay_forwarded_total counter\n"
+                       "espnow_relay_forwarded_total {}\n"
+                       "# TYPE espnow_relay_directed_total counter\n"
+                       "espnow_relay_directed_total {}\n"
+                       "# TYPE espnow_relay_suppressed_total counter\n"
+                       "espnow_relay_suppressed_total {}\n"
+                       "# TYPE espnow_relay_expired_total counter\n"
+                       "espnow_relay_expired_total {}\n"
+                       "# TYPE espnow_relay_dropped_total counter\n"
+                       "espnow_relay_dropped_total {}\n"
+                       // copies heard per distinct frame, 1 means every frame arrived exactly once
+                       "# TYPE espnow_relay_amplification gauge\n"
+                       "espnow_relay_amplification {:.2f}\n"
+                       "# TYPE espnow_relay_hop_latency_us gauge\n"
+                       "espnow_relay_hop_latency_us {}\n"
+                       "# TYPE espnow_relay_hops gauge\n"
+                       "espnow_relay_hops {:.2f}\n",
+                       relay.originated.load(), received, relay.duplicates.load(), relay.delivered.load(),
+                       relay.forwarded.load(), relay.directed.load(), relay.suppressed.load(), relay.expired.load(), relay.dropped.load(),
+                       received ? float(received + relay.duplicates) / received : 0.f,
+                       timed ? relay.hopLatencySumUs / timed : 0, timed ? float(relay.hopsSum) / timed : 0.f);
+    }
+
+    {
+        namespace rate = espnow::rate;
+
+        uint32_t selectedKbps{};
+        rate::forEachRate([&](const rate::RateStatus &status){
+            if (status.selected)
+                selectedKbps = status.rate.kbps;
+        });
+
+        fmt::format_to(std::back_inserter(body), "# TYPE espnow_rate_auto gauge\n"
+                       "espnow_rate_auto {}\n"
+                       "# TYPE espnow_rate_selected_kbps gauge\n"
+                       "espnow_rate_selected_kbps {}\n"
+                       "# TYPE espnow_rate_windows_total counter\n"
+                       "espnow_rate_windows_total {}\n"
+                       "# TYPE espnow_rate_changes_total counter\n"
+                       "espnow_rate_changes_total {}\n"
+                       "# TYPE espnow_rate_unattributed_total counter\n"
+                       "espnow_rate_unattributed_total {}\n"
+                       "# TYPE espnow_rate_decisions_total counter\n",
+                       rate::selected() ? 1 : 0, selectedKbps, rate::stats.windows.load(), rate::stats.changes.load(),
+                       rate::stats.unattributed.load());
+        for (const auto reason : {rate::Reason::Start, rate::Reason::Best, rate::Reason::Sample, rate::Reason::SampleWon, rate::Reason::Ineligible})
+            fmt::format_to(std::back_inserter(body), "espnow_rate_decisions_total{{reason=\"{}\"}} {}\n", rate::toString(reason), rate::stats.decisions[size_t(reason)].load());
+
+        // one pass per metric, every series has to be contiguous
+        body += "# TYPE espnow_rate_attempts_total counter\n";
+        rate::forEachRate([&](const rate::RateStatus &status){
+            if (status.eligible || status.attempts)
+                fmt::format_to(std::back_inserter(body), "espnow_rate_attempts_total{{rate=\"{}\"}} {}\n", status.rate.name, status.attempts);
+        });
+        body += "# TYPE espnow_rate_success_total counter\n";
+        rate::forEachRate([&](const rate::RateStatus &status){
+            if (status.eligible || status.attempts)
+                fmt::format_to(std::back_inserter(body), "espnow_rate_success_total{{rate=\"{}\"}} {}\n", status.rate.name, status.success);
+        });
+        body += "# TYPE espnow_rate_probability gauge\n";
+        rate::forEachRate([&](const rate::RateStatus &status){
+            if ((status.eligible || status.attempts) && status.probability)
+                fmt::format_to(std::back_inserter(body), "espnow_rate_probability{{rate=\"{}\"}} {:.3f}\n", status.rate.name, *status.probability);
+        });
+        body += "# TYPE espnow_rate_expected_kbps gauge\n";
+        rate::forEachRate([&](const rate::RateStatus &status){
+            if ((status.eligible || status.attempts) && status.probability)
+                fmt::format_to(std::back_inserter(body), "espnow_rate_expected_kbps{{rate=\"{}\"}} {:.1f}\n", status.rate.name, status.expectedKbps);
+        });
+    }
+
+    CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::Ok, "text/plain; version=0.0.4", body)
+}
+
+esp_err_t webserver_heapHistory_handler(httpd_req_t *req)
+{
+    auto &body = takeResponseBody();
+    body += "uptime,free8,largest8,minFree8,free32";
+    for (const auto name : freertosTaskNames)
+        fmt::format_to(std::back_inserter(body), ",stack_{}", name);
+    body += '\n';
+
+    telemetry::forEachHeapSample([&](const telemetry::HeapSample &sample){
+        fmt::format_to(std::back_inserter(body), "{},{},{},{},{}", sample.uptimeS, sample.free8, sample.largest8, sample.minFree8, sample.free32);
+        for (const auto stackFree : sample.stackFree)
+            fmt::format_to(std::back_inserter(body), ",{}", stackFree);
+        body += '\n';
+    });
+
+    CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::Ok, "text/csv", body)
+}
+
+esp_err_t webserver_traces_handler(httpd_req_t *req)
+{
+    namespace trace = espnow::trace;
+
+    // points are in microseconds after the first point of the trace, empty if not reached
+    auto &body = takeResponseBody();
+    body += "id,mac,type,seq";
+    for (size_t i = 0; i < trace::PointCount; i++)
+        fmt::format_to(std::back_inserter(body), ",{}_us", trace::toString(trace::Point(i)));
+    body += '\n';
+
+    trace::forEachTrace([&](const trace::Trace &trace){
+        fmt::format_to(std::back_inserter(body), "{},{},{},{}", trace.id, wifi_stack::toString(wifi_stack::mac_t{trace.mac.data()}),
+                       std::to_underlying(trace.type), trace.seq);
+        std::optional<uint32_t> first;
+        for (const auto &timestamp : trace.timestampsUs)
+        {
+            body += ',';
+            if (!timestamp)
+                continue;
+            if (!first)
+                first = *timestamp;
+            body += std::to_string(*timestamp - *first);
+        }
+        body += '\n';
+    });
+
+    CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::Ok, "text/csv", body)
+}
+
+esp_err_t webserver_results_handler(httpd_req_t *req)
+{
+    // all parameters are optional, a missing query is fine
+    std::string query;
+    if (auto result = esphttpdutils::webserver_get_query(req))
+        query = *result;
+
+    bool json{};
+    if (const auto value = webserver_get_query_param(query, "format"); value && *value == "json")
+        json = true;
+    else if (value && *value != "csv")
+        CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", fmt::format("unknown format {}", *value));
+
+    uint32_t since{};
+    if (const auto value = webserver_get_query_param(query, "since"); value && !value->empty())
+    {
+        const auto parsed = cpputils::fromString<uint32_t>(*value);
+        if (!parsed)
+            CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", parsed.error());
+        since = *parsed;
+    }
+
+    CALL_AND_EXIT_ON_ERROR(httpd_resp_set_type, req, json ? "application/json" : "text/csv")
+
+    auto &body = takeResponseBody();
+    if (json)
+        body += '[';
+    else
+    {
+        body += "sequence,unix_time,uptime_s,firmware,mode,label,destination,payload_bytes,rate,"
+                "sent,send_errors,success,fail,duration_us,throughput_kbps,avg_latency_us,max_latency_us,ack_rssi";
+        for (const auto limit : espnow::latencyBucketLimitsUs)
+            fmt::format_to(std::back_inserter(body), ",latency_lt_{}us", limit);
+        fmt::format_to(std::back_inserter(body), ",latency_ge_{}us\n", espnow::latencyBucketLimitsUs[std::size(espnow::latencyBucketLimitsUs) - 1]);
+    }
+
+    // the log can be much bigger than the heap, records are formatted one by one and sent in chunks
+    esp_err_t sendResult{ESP_OK};
+    bool first{true};
+    resultstore::forEachRecord(since, [&](const resultstore::Record &record){
+        const std::string_view firmware{record.firmware, strnlen(record.firmware, sizeof(record.firmware))};
+        const std::string_view label{record.label, strnlen(record.label, sizeof(record.label))};
+        const auto mode = tester::toString(tester::Mode(record.mode));
+        const auto destination = wifi_stack::toString(wifi_stack::mac_t{record.destination});
+        const auto throughputKbps = record.durationUs ? float(record.success) * record.payloadSize * 8 / record.durationUs * 1000 : 0.f;
+        const bool hasTime = record.flags & resultstore::RecordFlagUnixTime;
+        const bool hasRssi = record.flags & resultstore::RecordFlagAckRssi;
+
+        if (json)
+        {
+            if (!first)
+                body += ',';
+            fmt::format_to(std::back_inserter(body), "{{\"sequence\":{},\"unixTime\":{},\"uptimeS\":{},\"firmware\":\"{}\",\"mode\":\"{}\",\"label\":\"{}\","
+                           "\"destination\":\"{}\",\"payloadBytes\":{},\"rate\":{},\"sent\":{},\"sendErrors\":{},\"success\":{},\"fail\":{},"
+                           "\"durationUs\":{},\"throughputKbps\":{:.1f},\"avgLatencyUs\":{},\"maxLatencyUs\":{},\"ackRssi\":{},\"latencyHistogram\":[",
+                           uint32_t(record.sequence), hasTime ? std::to_string(record.unixTime) : "null", uint32_t(record.uptimeS), jsonEscape(firmware), mode, jsonEscape(label),
+                           destination, record.payloadSize, uint32_t(record.rate), uint32_t(record.sent), uint32_t(record.sendErrors),
+                           uint32_t(record.success), uint32_t(record.fail), uint32_t(record.durationUs), throughputKbps,
+                           uint32_t(record.avgLatencyUs), uint32_t(record.maxLatencyUs), hasRssi ? std::to_string(record.ackRssi) : "null");
+            for (size_t i = 0; i < record.latencyHistogram.size(); i++)
+            {
+                if (i)
+                    body += ',';
+                body += std::to_string(record.latencyHistogram[i]);
+            }
+            body += "]}";
+        }
+        else
+        {
+            fmt::format_to(std::back_inserter(body), "{},{},{},{},{},{},{},{},{},{},{},{},{},{},{:.1f},{},{},{}",
+                           uint32_t(record.sequence), hasTime ? std::to_string(record.unixTime) : "", uint32_t(record.uptimeS), firmware, mode, label,
+                           destination, record.payloadSize, uint32_t(record.rate), uint32_t(record.sent), uint32_t(record.sendErrors),
+                           uint32_t(record.success), uint32_t(record.fail), uint32_t(record.durationUs), throughputKbps,
+                           uint32_t(record.avgLatencyUs), uint32_t(record.maxLatencyUs), hasRssi ? std::to_string(record.ackRssi) : "");
+            for (const auto count : record.latencyHistogram)
+            {
+                body += ',';
+                body += std::to_string(count);
+            }
+            body += '\n';
+        }
+        first = false;
+
+        if (body.size() > 2048)
+        {
+            sendResult = httpd_resp_send_chunk(req, body.data(), body.size());
+            body.clear();
+            if (sendResult != ESP_OK)
+                return false;
+        }
+        return true;
+    });
+
+    if (sendResult != ESP_OK)
+    {
+        ESP_LOGE(TAG, "httpd_resp_send_chunk() failed with %s", esp_err_to_name(sendResult));
+        return sendResult;
+    }
+
+    if (json)
+        body += ']';
+
+    CALL_AND_EXIT_ON_ERROR(httpd_resp_send_chunk, req, body.data(), body.size());
+    body.clear();
+    CALL_AND_EXIT(httpd_resp_send_chunk, req, nullptr, 0);
+}
+
+esp_err_t webserver_clearResults_handler(httpd_req_t *req)
+{
+    if (const auto result = resultstore::clear(); !result)
+    {
+        ESP_LOGW(TAG, "%.*s", result.error().size(), result.error().data());
+        CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::BadRequest, "text/plain", result.error());
+    }
+
+    CALL_AND_EXIT_ON_ERROR(httpd_resp_set_hdr, req, "Location", "/tester")
+    CALL_AND_EXIT(esphttpdutils::webserver_resp_send, req, esphttpdutils::ResponseStatus::TemporaryRedirect, "text/html", "Ok, continue at <a href=\"/tester\">/tester</a>")
+}
+
+tl::expected<std::string, std::string> webserver_get_query_param(const std::string &query, const char *name)
+{
+    char valueBufEncoded[256];
+    if (const auto result = httpd_query_key_value(query.data(), name, valueBufEncoded, 256); result != ESP_OK)
+    {
+        if (result == ESP_ERR_NOT_FOUND)
+            return tl::make_unexpected(fmt::format("{} not set", name));
+        else
+            return tl::make_unexpected(fmt::format("httpd_query_key_value() {} failed with {}", name, esp_err_to_name(result)));
+    }
+
+    char valueBuf[257];
+    esphttpdutils::urldecode(valueBuf, valueBufEncoded);
+
+    return std::string{valueBuf};
+}
+
+// for user controlled strings inside a json string literal, like a tester label
+std::string jsonEscape(std::string_view str)
+{
+    std::string result;
+    result.reserve(str.size());
+    for (const char c : str)
+    {
+        switch (c)
+        {
+        case '"':  result += "\\\""; break;
+        case '\\': result += "\\\\"; break;
+        case '\n': result += "\\n"; break;
+        case '\r': result += "\\r"; break;
+        case '\t': result += "\\t"; break;
+        default:
+            if (uint8_t(c) < 0x20)
+                fmt::format_to(std::back_inserter(result), "\\u{:04x}", uint8_t(c));
+            else
+                result += c;
+        }
+    }
+    return result;
+}
 } // namespace
@@ -1,10 +1,13 @@
 #include "wifi.h"
 
 // system includes
+#include <atomic>
 #include <optional>
+#include <string>
 
 // esp-idf includes
 #include <esp_log.h>
+#include <esp_sntp.h>
 
 // 3rdparty lib includes
 #include <espwifistack.h>
@@ -19,21 +22,48 @@ wifi_stack::config createConfig();
 std::optional<wifi_stack::sta_config> createStaConfig();
 wifi_stack::wifi_entry createWifiEntry(const WiFiConfig &wifi_config);
 std::optional<wifi_stack::ap_config> createApConfig();
+
+// building the config copies every ssid and key, it is only rebuilt after a config it is made of was written
+wifi_stack::config cachedConfig;
+std::atomic<bool> wifiConfigChanged{};
+std::atomic<bool> sntpConfigChanged{true};
+void subscribeConfigs();
+const wifi_stack::config &currentConfig();
+
+// lwip keeps the pointer to the server name
+struct SntpConfig
+{
+    bool enabled;
+    std::string server;
+    sntp_sync_mode_t mode;
+    espchrono::milliseconds32 interval;
+
+    bool operator==(const SntpConfig &other) const
+    {
+        return enabled == other.enabled && server == other.server && mode == other.mode && interval == other.interval;
+    }
+};
+std::optional<SntpConfig> appliedSntpConfig;
+
+void updateSntp();
 } // namespace
 
 void wifi_begin()
 {
-    wifi_stack::init(createConfig());
+    subscribeConfigs();
+    cachedConfig = createConfig();
+    wifi_stack::init(cachedConfig);
 }
 
 void wifi_update()
 {
-    wifi_stack::update(createConfig());
+    wifi_stack::update(currentConfig());
+    updateSntp();
 }
 
 esp_err_t wifi_scan()
 {
-    const auto &sta_config = createStaConfig();
+    const auto &sta_config = currentConfig().sta;
     if (!sta_config)
     {
         ESP_LOGE(TAG, "no sta enabled");
@@ -50,6 +80,29 @@ esp_err_t wifi_scan()
 }
 
 namespace {
+void subscribeConfigs()
+{
+    const auto wifi = subscribeConfigChanges([](){ wifiConfigChanged = true; });
+    watchConfigs(wifi, configs.baseMacAddressOverride, configs.hostname, configs.espnowLongRange,
+                 configs.wifiStaEnabled, configs.wifiStaMinRssi,
+                 configs.wifiApEnabled, configs.wifiApName, configs.wifiApKey, configs.wifiApIp,
+                 configs.wifiApMask, configs.wifiApChannel, configs.wifiApAuthmode);
+    for (const auto &wifiConfig : configs.wifi_configs)
+        watchConfigs(wifi, wifiConfig.ssid, wifiConfig.key,
+                     wifiConfig.useStaticIp, wifiConfig.staticIp, wifiConfig.staticSubnet, wifiConfig.staticGateway,
+                     wifiConfig.useStaticDns, wifiConfig.staticDns0, wifiConfig.staticDns1, wifiConfig.staticDns2);
+
+    const auto sntp = subscribeConfigChanges([](){ sntpConfigChanged = true; });
+    watchConfigs(sntp, configs.timeServerEnabled, configs.timeServer, configs.timeSyncMode, configs.timeSyncInterval);
+}
+
+const wifi_stack::config &currentConfig()
+{
+    if (wifiConfigChanged.exchange(false))
+        cachedConfig = createConfig();
+    return cachedConfig;
+}
+
 wifi_stack::config createConfig()
 {
     return wifi_stack::config {
@@ -83,7 +136,7 @@ std::optional<wifi_stack::sta_config> createStaConfig()
             createWifiEntry(configs.wifi_configs[9])
         },
         .min_rssi = configs.wifiStaMinRssi.value,
-        .long_range = false
+        .long_range = configs.espnowLongRange.value
     };
 }
 
@@ -142,7 +195,41 @@ std::optional<wifi_stack::ap_config> createApConfig()
         .ssid_hidden = false,
         .max_connection = 4,
         .beacon_interval = 100,
-        .long_range = false
+        .long_range = configs.espnowLongRange.value
+    };
+}
+
+void updateSntp()
+{
+    if (!sntpConfigChanged.exchange(false))
+        return;
+
+    SntpConfig config{
+        .enabled = configs.timeServerEnabled.value && !configs.timeServer.value.empty(),
+        .server = configs.timeServer.value,
+        .mode = configs.timeSyncMode.value,
+        .interval = configs.timeSyncInterval.value
     };
+
+    if (appliedSntpConfig && *appliedSntpConfig == config)
+        return;
+
+    if (sntp_enabled())
+        sntp_stop();
+
+    appliedSntpConfig = std::move(config);
+    if (!appliedSntpConfig->enabled)
+    {
+        ESP_LOGI(TAG, "sntp disabled");
+        return;
+    }
+
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, appliedSntpConfig->server.c_str());
+    sntp_set_sync_mode(appliedSntpConfig->mode);
+    sntp_set_sync_interval(appliedSntpConfig->interval.count());
+    sntp_init();
+
+    ESP_LOGI(TAG, "sntp started with %s, interval %ums", appliedSntpConfig->server.c_str(), appliedSntpConfig->interval.count());
 }
 } // namespace